@@ -0,0 +1,176 @@
+// adc.c
+// author: Christophe VG <contact@christophe.vg>
+
+// background scanning of ADC channels (see adc.h)
+
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "adc.h"
+#include "sleep.h"
+#include "profile.h"
+
+#ifdef ADC_SCHED
+#include "sched.h"
+#endif
+
+#ifndef F_CPU
+#error "F_CPU is required to configure the ADC clock"
+#endif
+
+#if ADC_SAMPLES < 1 || ADC_SAMPLES > 128 || (ADC_SAMPLES & (ADC_SAMPLES - 1))
+#error "ADC_SAMPLES must be a power of 2, at most 128"
+#endif
+
+// 4^n conversions of 10 bits are summed in 16 bits, and counted in 8 bits
+#if ADC_MAX_OVERSAMPLING > 3
+#error "ADC_MAX_OVERSAMPLING can be at most 3"
+#endif
+
+#define MASK (ADC_SAMPLES - 1)
+
+// the smallest prescaler that keeps the ADC clock at most 200kHz
+#if   F_CPU /   2UL <= 200000UL
+#define PRESCALER (1 << ADPS0)
+#elif F_CPU /   4UL <= 200000UL
+#define PRESCALER (1 << ADPS1)
+#elif F_CPU /   8UL <= 200000UL
+#define PRESCALER ((1 << ADPS1) | (1 << ADPS0))
+#elif F_CPU /  16UL <= 200000UL
+#define PRESCALER (1 << ADPS2)
+#elif F_CPU /  32UL <= 200000UL
+#define PRESCALER ((1 << ADPS2) | (1 << ADPS0))
+#elif F_CPU /  64UL <= 200000UL
+#define PRESCALER ((1 << ADPS2) | (1 << ADPS1))
+#else
+#define PRESCALER ((1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0))
+#endif
+
+typedef struct {
+  uint8_t  mux;
+  uint8_t  oversampling;            // extra bits
+  uint8_t  conversions;             // summed for the next sample
+  uint16_t sum;
+  uint8_t  head;                    // next slot in the ring
+  uint32_t samples;
+  uint16_t ring[ADC_SAMPLES];
+} channel_t;
+
+// forward declarations of "private" functions
+static void _convert(void);
+
+static volatile channel_t channels[ADC_CHANNELS];
+static volatile uint8_t   count;
+static volatile uint8_t   current;  // being converted
+static volatile bool      scanning;
+static uint8_t            reference;
+
+// the ADC is only enabled while scanning, it draws current, also while sleeping
+void adc_init(uint8_t ref) {
+  reference = ref;
+  ADMUX  = reference;
+  ADCSRA = PRESCALER;
+}
+
+int8_t adc_add(uint8_t channel, uint8_t oversampling) {
+  int8_t index = -1;
+  if( oversampling > ADC_MAX_OVERSAMPLING ) { return -1; }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if( count < ADC_CHANNELS ) {
+      index = count;
+      memset((void *)&channels[index], 0, sizeof(channel_t));
+      channels[index].mux          = channel;
+      channels[index].oversampling = oversampling;
+      count++;
+    }
+  }
+  return index;
+}
+
+// samples that were being summed are discarded
+void adc_start(void) {
+  if( count == 0 ) { return; }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(uint8_t i=0; i<count; i++) {
+      channels[i].conversions = 0;
+      channels[i].sum         = 0;
+    }
+    current  = 0;
+    scanning = TRUE;
+    _convert();
+  }
+}
+
+// disabling the ADC aborts a conversion that is still running
+void adc_stop(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    scanning = FALSE;
+    ADCSRA   = PRESCALER;
+  }
+}
+
+uint16_t adc_latest(uint8_t index) {
+  uint16_t sample = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if( channels[index].samples ) {
+      sample = channels[index].ring[(channels[index].head - 1) & MASK];
+    }
+  }
+  return sample;
+}
+
+uint16_t adc_average(uint8_t index) {
+  uint32_t sum = 0;
+  uint8_t  buffered;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    buffered = channels[index].samples < ADC_SAMPLES ? channels[index].samples
+                                                     : ADC_SAMPLES;
+    for(uint8_t i=0; i<buffered; i++) { sum += channels[index].ring[i]; }
+  }
+  return buffered ? (sum + buffered / 2) / buffered : 0;
+}
+
+uint32_t adc_samples(uint8_t index) {
+  uint32_t samples;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    samples = channels[index].samples;
+  }
+  return samples;
+}
+
+uint8_t adc_sleep_guard(void) {
+  if( ! scanning ) { return SLEEP_DEEP; }
+  return ADC_NOISE_REDUCTION ? SLEEP_ADC : SLEEP_LIGHT;
+}
+
+// selects the current channel and starts a conversion, clearing a pending
+// interrupt flag. in single conversion mode, the channel can be changed right
+// before starting. call with interrupts disabled.
+static void _convert(void) {
+  ADMUX  = reference | channels[current].mux;
+  ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADIF) | (1 << ADIE) | PRESCALER;
+}
+
+// the next conversion is started right away, after 4^n conversions the next
+// channel is selected
+ISR (ADC_vect) {
+  PROFILE_ENTER();
+  volatile channel_t *channel = &channels[current];
+  channel->sum += ADC;
+  if( ++channel->conversions == 1 << (2 * channel->oversampling) ) {
+    channel->ring[channel->head] = channel->sum >> channel->oversampling;
+    channel->head        = (channel->head + 1) & MASK;
+    channel->samples++;
+    channel->sum         = 0;
+    channel->conversions = 0;
+    if( ++current == count ) { current = 0; }
+#ifdef ADC_SCHED
+    sched_signal(SCHED_ADC);
+#endif
+  }
+  if( scanning ) { _convert(); }
+  PROFILE_LEAVE(PROFILE_ADC);
+}
@@ -0,0 +1,71 @@
+// adc.h
+// author: Christophe VG <contact@christophe.vg>
+
+// background scanning of ADC channels
+// the conversion complete interrupt stores each result and starts the next
+// conversion, so the CPU doesn't wait the 13 ADC cycles (about 100us) of a
+// conversion. the channels of the scan list are converted in turn, each into
+// its own ring buffer, from which the latest or the average of the buffered
+// samples can be read at any time.
+// a channel can be oversampled: 4^n conversions are summed and decimated by
+// 2^n, which gives n extra bits of resolution, provided the signal has at
+// least one LSB of noise. with a prescaler that gives the fastest ADC clock
+// for 10 bits (at most 200kHz), about 10k conversions/s are shared by all
+// channels.
+// while scanning, the CPU may sleep in ADC noise reduction mode, when no
+// driver needs more (see adc_sleep_guard() and sleep.h).
+// avr_adc_read() mustn't be used while scanning.
+
+#ifndef __ADC_H
+#define __ADC_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "bool.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef ADC_CHANNELS              // entries in the scan list
+#define ADC_CHANNELS  4
+#endif
+
+#ifndef ADC_SAMPLES               // per channel, a power of 2
+#define ADC_SAMPLES   8
+#endif
+
+#ifndef ADC_NOISE_REDUCTION       // let the CPU sleep in ADC noise reduction
+#define ADC_NOISE_REDUCTION 0     // mode while scanning
+#endif
+
+#define ADC_MAX_OVERSAMPLING 3    // extra bits, 64 conversions per sample
+
+#define ADC_REF_AVCC  (1 << REFS0)
+#define ADC_REF_1V1   ((1 << REFS1) | (1 << REFS0))
+
+// configures the ADC with a reference, e.g. ADC_REF_AVCC. the ADC is enabled
+// by adc_start() and disabled again by adc_stop().
+void adc_init(uint8_t reference);
+
+// adds a channel (MUX value, e.g. 0-7, 8 for the temperature sensor) to the
+// scan list, with extra bits of oversampling. returns its index, or -1 if the
+// list is full or the oversampling is too high.
+int8_t adc_add(uint8_t channel, uint8_t oversampling);
+
+void adc_start(void);
+void adc_stop(void);
+
+// the last sample of a channel, of 10 + oversampling bits
+uint16_t adc_latest(uint8_t index);
+
+// the average of the buffered samples, 0 as long as there are none
+uint16_t adc_average(uint8_t index);
+
+// number of samples of a channel since it was added
+uint32_t adc_samples(uint8_t index);
+
+// a sleep guard: the ADC needs its clock, so while scanning, the CPU may at
+// most idle, or sleep in ADC noise reduction mode with ADC_NOISE_REDUCTION
+uint8_t adc_sleep_guard(void);
+
+#endif
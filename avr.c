@@ -2,6 +2,7 @@
 // author: Christophe VG <contact@christophe.vg>
 
 // elementary functions for handling the AVR/ATMEGA MCU
+// avr_adc_read() waits for its conversion, see adc.h to scan in the background
 
 #include <avr/io.h>
 #include <util/delay.h>
@@ -26,13 +27,9 @@ void avr_adc_init(void) {
 }
 
 uint16_t avr_adc_read(uint8_t ch) {
-  // select the corresponding channel 0~7
-  // ANDing with ’7′ will always keep the value
-  // of ‘ch’ between 0 and 7
-  // ch &= 0b00000111;            // AND operation with 7
-  // this trick doesn't work with 0b00000101 ;-)
-  if( ch > 5 ) { ch = 5; }
-  ADMUX = (ADMUX & 0xF8) | ch; // clears the bottom 3 bits before ORing
+  // select the channel: 0-7 (ADC6 and 7 on TQFP/QFN packages), 8 is the
+  // temperature sensor, 14 the bandgap. clears the MUX bits before ORing.
+  ADMUX = (ADMUX & 0xF0) | (ch & 0x0F);
 
   // start single convertion
   // write ’1′ to ADSC
@@ -0,0 +1,312 @@
+// bulk.c
+// author: Christophe VG <contact@christophe.vg>
+
+// bulk transfer of data larger than one XBee RF frame
+// data is split in fragments, sent using a sliding window and acknowledged
+// selectively by the receiver, who reassembles it in a bounded buffer
+
+#include <string.h>
+
+#include "bulk.h"
+#include "clock.h"
+
+// the window is tracked using 8-bit bitmaps, bit 0 = first fragment in window
+#if BULK_WINDOW < 1 || BULK_WINDOW > 8
+#error "BULK_WINDOW must be between 1 and 8"
+#endif
+
+#define WINDOW_MASK ((uint8_t)((1 << BULK_WINDOW) - 1))
+
+// the receiver acknowledges every half window, to keep the sender going
+#define ACK_EVERY   (BULK_WINDOW > 1 ? BULK_WINDOW / 2 : 1)
+
+// forward declarations of "private" functions
+static void _send_fragment(uint8_t index);
+static void _receive_data(xbee_rx_t *frame);
+static void _receive_ack(xbee_rx_t *frame);
+static void _send_ack(xbee_rx_t *frame);
+static bool _is_received(uint8_t index);
+static bool _from_destination(xbee_rx_t *frame);
+static void _dispatched(xbee_rx_t *frame);
+
+// sending side
+
+static struct {
+  uint64_t       address;
+  const uint8_t *data;
+  uint16_t       size;
+  uint8_t        id;
+  uint8_t        count;     // number of fragments
+  uint8_t        base;      // first fragment that isn't acknowledged
+  uint8_t        sent;      // bitmap of fragments in the window that are sent
+  uint8_t        acked;     //                   ... that are acknowledged
+  uint8_t        resent;    //                   ... that were resent early
+  uint8_t        retries;
+  time_t         deadline;
+  bulk_status_t  status;
+  xbee_dest_t    dest;
+} tx = { .status = BULK_IDLE };
+
+bool bulk_send(uint64_t address, const uint8_t *data, uint16_t size) {
+  if( tx.status == BULK_BUSY ) { return FALSE; }
+  // the number of fragments must fit the one byte count in the header
+  if( size == 0 || size > 255 * (uint16_t)BULK_FRAGMENT_SIZE ) { return FALSE; }
+
+  tx.address = address;
+  xbee_dest_init(&tx.dest, address, XB_NW_ADDR_UNKNOWN,
+                 XB_MAX_RADIUS, XB_OPT_NONE);
+  tx.data    = data;
+  tx.size    = size;
+  tx.id++;
+  tx.count   = (size + BULK_FRAGMENT_SIZE - 1) / BULK_FRAGMENT_SIZE;
+  tx.base    = 0;
+  tx.sent    = 0;
+  tx.acked   = 0;
+  tx.resent  = 0;
+  tx.retries = 0;
+  tx.status  = BULK_BUSY;
+
+  bulk_process();
+
+  return TRUE;
+}
+
+bulk_status_t bulk_get_status(void) {
+  return tx.status;
+}
+
+void bulk_process(void) {
+  if( tx.status != BULK_BUSY ) { return; }
+
+  // nothing acknowledged in time: resend all unacknowledged fragments
+  if( (tx.sent & ~tx.acked) &&
+      (int32_t)(clock_get_millis() - tx.deadline) >= 0 )
+  {
+    if( ++tx.retries > BULK_RETRIES ) {
+      debug_printf("bulk: transfer %i failed at %i/%i\n",
+                   tx.id, tx.base, tx.count);
+      tx.status = BULK_FAILED;
+      return;
+    }
+    // these are resent now, don't resend them early again
+    tx.sent   = tx.acked;
+    tx.resent = ~tx.acked;
+  }
+
+  // fill the window
+  for(uint8_t i=0; i<BULK_WINDOW && tx.base + i < tx.count; i++) {
+    if( ! (tx.sent & (1 << i)) ) {
+      _send_fragment(tx.base + i);
+      tx.sent    |= (1 << i);
+      tx.deadline = clock_get_millis() + BULK_TIMEOUT;
+    }
+  }
+}
+
+// sends the header and the fragment straight from the caller's buffer
+static void _send_fragment(uint8_t index) {
+  uint8_t    header[BULK_HEADER_SIZE];
+  xbee_iov_t payload[2];
+
+  uint16_t offset = (uint16_t)index * BULK_FRAGMENT_SIZE;
+  uint16_t size   = tx.size - offset;
+  if( size > BULK_FRAGMENT_SIZE ) { size = BULK_FRAGMENT_SIZE; }
+
+  header[0] = BULK_MSG_DATA;
+  header[1] = tx.id;
+  header[2] = index;
+  header[3] = tx.count;
+
+  payload[0].data = header;
+  payload[0].size = sizeof(header);
+  payload[1].data = &tx.data[offset];
+  payload[1].size = size;
+
+  xbee_send_to(&tx.dest, payload, 2);
+}
+
+static void _receive_ack(xbee_rx_t *frame) {
+  if( tx.status != BULK_BUSY  || frame->size < 4 ||
+      ! _from_destination(frame) || frame->data[1] != tx.id )
+  {
+    return;
+  }
+
+  uint8_t base   = frame->data[2];
+  uint8_t bitmap = frame->data[3];
+
+  if( base < tx.base || base > tx.count ) { return; }  // stale or bogus
+
+  // slide the window
+  if( base > tx.base ) {
+    uint8_t shift = base - tx.base;
+    if( shift >= 8 ) {
+      tx.sent = tx.acked = tx.resent = 0;
+    } else {
+      tx.sent   >>= shift;
+      tx.acked  >>= shift;
+      tx.resent >>= shift;
+    }
+    tx.base    = base;
+    tx.retries = 0;
+  }
+
+  if( tx.base == tx.count ) {
+    tx.status = BULK_DONE;
+    return;
+  }
+
+  // bit i of the bitmap acknowledges fragment base + 1 + i
+  tx.acked |= (uint8_t)(bitmap << 1) & WINDOW_MASK;
+
+  // selective acknowledgement: fragments before the last acknowledged one
+  // that are still missing, are lost. resend them (once) right away.
+  uint8_t below = 0;
+  for(uint8_t i=BULK_WINDOW-1; i>0; i--) {
+    if( tx.acked & (1 << i) ) {
+      below = (uint8_t)((1 << i) - 1);
+      break;
+    }
+  }
+  uint8_t holes = below & ~tx.acked & ~tx.resent & tx.sent;
+  tx.resent |= holes;
+  tx.sent   &= ~holes;
+
+  bulk_process();
+}
+
+// frames from the coordinator carry its own 64-bit address, not XB_COORDINATOR
+static bool _from_destination(xbee_rx_t *frame) {
+  if( tx.address == XB_COORDINATOR ) { return frame->nw_address == 0x0000; }
+  return frame->address == tx.address;
+}
+
+// receiving side, one reassembly at a time
+
+static struct {
+  uint64_t address;
+  bool     active;
+  bool     complete;
+  uint8_t  id;
+  uint8_t  count;
+  uint8_t  base;       // number of contiguous fragments received
+  uint16_t size;
+  time_t   last;
+  uint8_t  received[(BULK_MAX_FRAGMENTS + 7) / 8];
+  uint8_t  buffer[BULK_MAX_SIZE];
+} rx;
+
+static bulk_rx_handler_t rx_handler;
+
+void bulk_on_receive(bulk_rx_handler_t handler) {
+  rx_handler = handler;
+}
+
+bool bulk_init(void) {
+  return xbee_subscribe(BULK_MSG_DATA, _dispatched) &&
+         xbee_subscribe(BULK_MSG_ACK,  _dispatched);
+}
+
+static void _dispatched(xbee_rx_t *frame) {
+  bulk_receive(frame);
+}
+
+bool bulk_receive(xbee_rx_t *frame) {
+  if( frame->size < 1 ) { return FALSE; }
+
+  switch( frame->data[0] ) {
+    case BULK_MSG_DATA: _receive_data(frame); return TRUE;
+    case BULK_MSG_ACK:  _receive_ack(frame);  return TRUE;
+  }
+  return FALSE;
+}
+
+static bool _is_received(uint8_t index) {
+  return rx.received[index >> 3] & (1 << (index & 0x07));
+}
+
+static void _receive_data(xbee_rx_t *frame) {
+  if( frame->size <= BULK_HEADER_SIZE ) { return; }
+
+  uint8_t  id     = frame->data[1];
+  uint8_t  index  = frame->data[2];
+  uint8_t  count  = frame->data[3];
+  uint16_t size   = frame->size - BULK_HEADER_SIZE;
+  uint16_t offset = (uint16_t)index * BULK_FRAGMENT_SIZE;
+
+  // only full fragments, except for the last one, that fit our buffer
+  if( index >= count || count > BULK_MAX_FRAGMENTS ) { return; }
+  if( size > BULK_FRAGMENT_SIZE ) { return; }
+  if( index < count - 1 && size != BULK_FRAGMENT_SIZE ) { return; }
+  if( offset + size > BULK_MAX_SIZE ) { return; }
+
+  time_t now = clock_get_millis();
+
+  // a new transfer, if we're not busy reassembling one from another node
+  if( ! rx.active || rx.address != frame->address || rx.id != id ) {
+    if( rx.active && ! rx.complete && rx.address != frame->address &&
+        now - rx.last < BULK_RX_TIMEOUT )
+    {
+      return;
+    }
+    memset(rx.received, 0, sizeof(rx.received));
+    rx.address  = frame->address;
+    rx.id       = id;
+    rx.count    = count;
+    rx.base     = 0;
+    rx.size     = 0;
+    rx.active   = TRUE;
+    rx.complete = FALSE;
+  }
+  if( count != rx.count ) { return; }
+
+  rx.last = now;
+
+  // a duplicate means our acknowledgement got lost
+  if( rx.complete || _is_received(index) ) {
+    _send_ack(frame);
+    return;
+  }
+
+  memcpy(&rx.buffer[offset], &frame->data[BULK_HEADER_SIZE], size);
+  rx.received[index >> 3] |= (1 << (index & 0x07));
+  if( index == count - 1 ) { rx.size = offset + size; }
+
+  // acknowledge gaps, and fragments that fill one, right away, so the sender
+  // resends lost fragments early, but only once
+  bool gap = index != rx.base;
+  while( rx.base < rx.count && _is_received(rx.base) ) { rx.base++; }
+  bool filled = rx.base > index + 1;
+  rx.complete = rx.base == rx.count;
+
+  if( rx.complete || gap || filled || (index + 1) % ACK_EVERY == 0 ) {
+    _send_ack(frame);
+  }
+
+  if( rx.complete && rx_handler != NULL ) {
+    rx_handler(rx.address, rx.buffer, rx.size);
+  }
+}
+
+static void _send_ack(xbee_rx_t *received) {
+  uint8_t   payload[4];
+  xbee_tx_t frame;
+
+  payload[0] = BULK_MSG_ACK;
+  payload[1] = rx.id;
+  payload[2] = rx.base;
+  payload[3] = 0;
+  for(uint8_t i=0; i<8 && rx.base + 1 + i < rx.count; i++) {
+    if( _is_received(rx.base + 1 + i) ) { payload[3] |= (1 << i); }
+  }
+
+  frame.size       = sizeof(payload);
+  frame.id         = XB_TX_NO_RESPONSE;
+  frame.address    = received->address;
+  frame.nw_address = received->nw_address;
+  frame.radius     = XB_MAX_RADIUS;
+  frame.options    = XB_OPT_NONE;
+  frame.data       = payload;
+
+  xbee_send(&frame);
+}
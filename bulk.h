@@ -0,0 +1,80 @@
+// bulk.h
+// author: Christophe VG <contact@christophe.vg>
+
+// bulk transfer of data larger than one XBee RF frame
+// data is split in fragments, sent using a sliding window and acknowledged
+// selectively by the receiver, who reassembles it in a bounded buffer
+
+#ifndef __BULK_H
+#define __BULK_H
+
+#include "bool.h"
+#include "xbee.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef BULK_MAX_SIZE           // largest transfer that can be reassembled
+#define BULK_MAX_SIZE      512
+#endif
+
+#ifndef BULK_WINDOW             // fragments in flight, at most 8 (ack bitmap)
+#define BULK_WINDOW        8
+#endif
+
+#ifndef BULK_TIMEOUT            // ms without ack before resending the window
+#define BULK_TIMEOUT       250
+#endif
+
+#ifndef BULK_RETRIES            // timeouts before giving up a transfer
+#define BULK_RETRIES       5
+#endif
+
+#ifndef BULK_RX_TIMEOUT         // ms of silence before dropping a reassembly
+#define BULK_RX_TIMEOUT    5000
+#endif
+
+// message types, the first payload byte of every bulk frame
+
+#ifndef BULK_MSG_DATA
+#define BULK_MSG_DATA      0xB0 // [type][transfer][index][count][data...]
+#endif
+#ifndef BULK_MSG_ACK
+#define BULK_MSG_ACK       0xB1 // [type][transfer][base][bitmap]
+#endif
+
+#define BULK_HEADER_SIZE   4
+#define BULK_FRAGMENT_SIZE (XB_MAX_PAYLOAD - BULK_HEADER_SIZE)
+#define BULK_MAX_FRAGMENTS \
+  ((BULK_MAX_SIZE + BULK_FRAGMENT_SIZE - 1) / BULK_FRAGMENT_SIZE)
+
+// status of the outgoing transfer
+typedef enum {
+  BULK_IDLE,
+  BULK_BUSY,
+  BULK_DONE,
+  BULK_FAILED
+} bulk_status_t;
+
+// handler for completely reassembled incoming transfers
+typedef void (*bulk_rx_handler_t)(uint64_t address, uint8_t *data,
+                                  uint16_t size);
+
+// starts sending size bytes of data to address, data must remain untouched
+// until the transfer is done or failed. returns FALSE if a transfer is busy
+bool bulk_send(uint64_t address, const uint8_t *data, uint16_t size);
+
+bulk_status_t bulk_get_status(void);
+
+// (re)transmits fragments and handles timeouts, call from the main loop
+void bulk_process(void);
+
+// subscribes the bulk layer to its message types with the xbee driver
+bool bulk_init(void);
+
+// feeds a received frame to the bulk layer, returns TRUE if it was consumed
+// (only needed when frames aren't dispatched by the driver, see bulk_init)
+bool bulk_receive(xbee_rx_t *frame);
+
+void bulk_on_receive(bulk_rx_handler_t handler);
+
+#endif
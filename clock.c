@@ -3,30 +3,351 @@
 
 // a clock that counts miliseconds
 
-// this code sets up timer1 for a 1ms  @ 8Mhz Clock (Mode 12)
+// this code sets up timer1 to interrupt every ms (Mode 12, CTC on ICR1). the
+// prescaler is the smallest one that fits a ms in the 16-bit timer, so a ms
+// lasts F_CPU / prescaler / 1000 ticks. when that isn't a whole number, some
+// ms last a tick longer, to keep the clock exact in the long run.
 
-// TODO: make this ATMEGA1284p-only code useable on ATMEGA8 & co
+// in tickless mode, timer1 runs freely (Mode 0), with the largest prescaler
+// that still gives 100 ticks per ms. its overflows are counted in ms and a
+// remainder, to which the running timer is added when the clock is read.
+// compare match A is only enabled for the alarm.
+
+// with CLOCK_RTC, timer2 does the same, counting a 32.768kHz crystal divided
+// by 8, asynchronously. changes to its registers take up to two cycles of the
+// crystal to take effect, which is waited for where it matters.
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "clock.h"
+#include "timer.h"
+#include "profile.h"
+
+#ifndef F_CPU
+#error "F_CPU is required to configure the clock"
+#endif
+
+#if CLOCK_RTC
+
+#if ! defined(TIMSK2)
+#error "CLOCK_RTC requires an asynchronous timer2 (e.g. ATmega328p, 1284p)"
+#endif
+
+#define HZ        4096UL                        // 32768Hz / 8
+#define CS        (1 << CS21)
+#define TICKS     256UL                         // per overflow
+#define MARGIN    3                             // ticks, see _arm()
+
+#define COUNTER   TCNT2
+#define COMPARE   OCR2A
+#define TOIE      TOIE2
+#define TOV       TOV2
+#define OCIE      OCIE2A
+#define OCF       OCF2A
+#define OVF_vect  TIMER2_OVF_vect
+#define COMP_vect TIMER2_COMPA_vect
+
+#define CLOCK_TIMSK TIMSK2
+#define CLOCK_TIFR  TIFR2
+
+#elif CLOCK_TICKLESS
+
+#if   F_CPU / 1024UL >= 100000UL
+#define PRESCALER 1024UL
+#define CS        ((1 << CS12) | (1 << CS10))
+#elif F_CPU / 256UL >= 100000UL
+#define PRESCALER 256UL
+#define CS        (1 << CS12)
+#elif F_CPU / 64UL >= 100000UL
+#define PRESCALER 64UL
+#define CS        ((1 << CS11) | (1 << CS10))
+#elif F_CPU / 8UL >= 100000UL
+#define PRESCALER 8UL
+#define CS        (1 << CS11)
+#else
+#define PRESCALER 1UL
+#define CS        (1 << CS10)
+#endif
+
+#if F_CPU % PRESCALER != 0
+#error "F_CPU must be a multiple of the prescaler in tickless mode"
+#endif
+
+#define HZ        (F_CPU / PRESCALER)           // ticks per second
+#define TICKS     65536UL                       // per overflow
+#define MARGIN    2                             // ticks, see _arm()
+
+#define COUNTER   TCNT1
+#define COMPARE   OCR1A
+#define TOIE      TOIE1
+#define TOV       TOV1
+#define OCIE      OCIE1A
+#define OCF       OCF1A
+#define OVF_vect  TIMER1_OVF_vect
+#define COMP_vect TIMER1_COMPA_vect
+
+#else
+
+#if   F_CPU / 1000UL <= 65536UL
+#define PRESCALER 1UL
+#define CS        (1 << CS10)
+#elif F_CPU / 8000UL <= 65536UL
+#define PRESCALER 8UL
+#define CS        (1 << CS11)
+#elif F_CPU / 64000UL <= 65536UL
+#define PRESCALER 64UL
+#define CS        ((1 << CS11) | (1 << CS10))
+#elif F_CPU / 256000UL <= 65536UL
+#define PRESCALER 256UL
+#define CS        (1 << CS12)
+#else
+#define PRESCALER 1024UL
+#define CS        ((1 << CS12) | (1 << CS10))
+#endif
+
+#define TICKS    (F_CPU / (PRESCALER * 1000UL))   // per ms
+#define TOP      (TICKS - 1)
+#define FRACTION (F_CPU % (PRESCALER * 1000UL))   // of a tick, per ms
+#define WHOLE    (PRESCALER * 1000UL)             // one tick, in FRACTIONs
+
+// with a fraction, a single ms can be a tick too long
+#if FRACTION != 0 && 1000000UL / TICKS > CLOCK_MAX_ERROR
+#error "F_CPU is too low for a ms clock within CLOCK_MAX_ERROR"
+#endif
+
+#endif
+
+// timer1 interrupt registers are shared with other timers on older devices
+#if ! CLOCK_RTC
+#if defined(TIMSK1)               // e.g. ATmega328p, ATmega1284p
+#define CLOCK_TIMSK TIMSK1
+#define CLOCK_TIFR  TIFR1
+#else                             // e.g. ATmega8, ATmega32
+#define CLOCK_TIMSK TIMSK
+#define CLOCK_TIFR  TIFR
+#endif
+#endif
+
+static volatile time_t current_millis;
+
+#if CLOCK_TICKLESS
+
+#define OVERFLOW  (TICKS * 1000UL)              // ticks * 1000 per overflow
+
+// us since the timer matched, when its ISR starts
+#define LATENCY(ticks) \
+  ( (ticks) > 4000 ? 0xFFFF : (uint32_t)(ticks) * 1000000UL / HZ )
+
+// ticks * 1000 that passed since current_millis, less than HZ
+static volatile uint32_t remainder;
+
+static volatile bool     alarmed;
+static volatile time_t   alarm;
+
+// forward declarations of "private" functions
+static uint32_t _units(void);
+static void     _arm(void);
+
+#if CLOCK_RTC
+
+// the crystal needs time to start up, the registers must be set while the
+// timer interrupts are disabled
+void clock_init(void) {
+  CLOCK_TIMSK = 0;
+  ASSR   = (1 << AS2);
+  TCNT2  = 0;
+  TCCR2A = 0;                             // mode 0, normal
+  TCCR2B = CS;
+  while( ASSR & ((1 << TCN2UB) | (1 << TCR2AUB) | (1 << TCR2BUB)) );
+  CLOCK_TIFR  = (1 << TOV) | (1 << OCF);
+  CLOCK_TIMSK = (1 << TOIE);              // enable overflow interrupt
+
+  // turn on interrupts
+  sei();
+}
+
+// a write to a register takes effect after a rising edge of the crystal.
+// after waking up, that also ensures the counter is read correctly again.
+void clock_sync(void) {
+  TCCR2A = TCCR2A;
+  while( ASSR & ((1 << TCR2AUB) | (1 << OCR2AUB)) );
+}
+
+#else
 
 void clock_init(void) {
   // turn on interrupts
   sei();
 
-  // Clock Speed (8000000) / PreScaler(64) = 125000
-  // * timeout (0.001sec)                  = 125
-  // - 1                                   = 124
-  ICR1 = 124;
+  TCCR1A = 0;
+  TCCR1B = CS;                            // mode 0, normal
+  CLOCK_TIMSK |= (1 << TOIE);             // enable overflow interrupt
+}
+
+#endif
+
+// ticks * 1000 since current_millis, including an overflow that is pending
+// because interrupts are disabled. call with interrupts disabled.
+static uint32_t _units(void) {
+  uint16_t ticks = COUNTER;
+  uint32_t units = remainder + (uint32_t)ticks * 1000;
+  if( (CLOCK_TIFR & (1 << TOV)) && ticks < TICKS / 2 ) { units += OVERFLOW; }
+  return units;
+}
+
+time_t clock_get_millis(void) {
+  time_t millis;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    millis = current_millis + _units() / HZ;
+  }
+  return millis;
+}
+
+// ticks * 1000 stays below 1000 * 800000 (HZ is below 8 times 100 ticks/ms)
+uint32_t clock_get_micros(void) {
+  time_t   millis;
+  uint32_t units;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    millis = current_millis;
+    units  = _units();
+  }
+  millis += units / HZ;
+  units  %= HZ;
+  return millis * 1000 + units * 1000 / HZ;
+}
+
+void clock_adjust(int32_t diff) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    current_millis += diff;
+    if( alarmed ) { _arm(); }
+  }
+}
+
+void clock_alarm(time_t millis) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if( ! alarmed || (int32_t)(millis - alarm) < 0 ) {
+      alarm   = millis;
+      alarmed = TRUE;
+      _arm();
+    }
+  }
+}
 
-  TCCR1B |= (1 << WGM13) | (1 << WGM12); // mode 12, CTC on ICR1
-  TCCR1B |= (1 << CS10)  | (1 << CS11);  // prescaler of 64
-    
-  TIMSK1 |= (1 << OCIE1B);               // enable CTC interrupt 
-} 
+// enables the compare match at the tick where the alarm goes off, if it falls
+// before the next overflow, which otherwise arms it again. a target that is
+// too close could be passed before the compare register is updated, so it's
+// set MARGIN ticks ahead. call with interrupts disabled.
+static void _arm(void) {
+  int32_t  ms    = alarm - current_millis;
+  uint16_t ticks = COUNTER;
+  uint32_t target;
 
+  CLOCK_TIMSK &= ~(1 << OCIE);
+  if( ms > (int32_t)(OVERFLOW / HZ) ) { return; }
+  target = ms <= 0 ? 0 : ((uint32_t)ms * HZ - remainder + 999) / 1000;
+  if( target < (uint32_t)ticks + MARGIN ) { target = (uint32_t)ticks + MARGIN; }
+  if( target >= TICKS ) { return; }
+
+#if CLOCK_RTC
+  while( ASSR & (1 << OCR2AUB) );
+#endif
+  COMPARE = target;
+  CLOCK_TIFR  = (1 << OCF);               // clear a stale match
+  CLOCK_TIMSK |= (1 << OCIE);
+}
+
+// the ISRs are profiled once the time is consistent again
+ISR (OVF_vect) {
+  PROFILE_LATENCY(LATENCY(COUNTER));
+  uint32_t units = remainder + OVERFLOW;
+  current_millis += units / HZ;
+  remainder       = units % HZ;
+  PROFILE_ENTER();
+  if( alarmed ) { _arm(); }
+  PROFILE_LEAVE(PROFILE_CLOCK);
+}
+
+ISR (COMP_vect) {
+  PROFILE_LATENCY(LATENCY((COUNTER - COMPARE) & (TICKS - 1)));
+  PROFILE_ENTER();
+  CLOCK_TIMSK &= ~(1 << OCIE);
+  alarmed = FALSE;
+#if TIMER_ISR
+  timer_isr();                            // sets the next alarm
+#endif
+  PROFILE_LEAVE(PROFILE_CLOCK_ALARM);
+}
+
+#else
+
+void clock_init(void) {
+  // turn on interrupts
+  sei();
+
+  ICR1  = TOP;
+  OCR1B = 0;                              // interrupt at the start of each ms
+
+  TCCR1A = 0;
+  TCCR1B = (1 << WGM13) | (1 << WGM12);   // mode 12, CTC on ICR1
+  TCCR1B |= CS;
+
+  CLOCK_TIMSK |= (1 << OCIE1B);           // enable CTC interrupt
+}
+
+// a 32-bit value takes four instructions to read, the ISR mustn't run halfway
+time_t clock_get_millis(void) {
+  time_t millis;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    millis = current_millis;
+  }
+  return millis;
+}
+
+uint32_t clock_get_micros(void) {
+  time_t   millis;
+  uint16_t ticks;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    millis = current_millis;
+    ticks  = TCNT1;
+    // the timer wrapped (OCR1B = 0 matched), but the ISR hasn't run yet. if
+    // it only wrapped after reading TCNT1, ticks is still near the TOP.
+    if( (CLOCK_TIFR & (1 << OCF1B)) && ticks < TOP / 2 ) { millis++; }
+  }
+#if FRACTION == 0 && TICKS % 1000 == 0
+  return millis * 1000 + ticks / (uint16_t)(TICKS / 1000);
+#else
+  return millis * 1000 + (uint32_t)ticks * 1000 / TICKS;
+#endif
+}
+
+void clock_adjust(int32_t diff) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    current_millis += diff;
+  }
+}
+
+// the timer restarted at 0 when the ms started, it's profiled once counted
 ISR (TIMER1_COMPB_vect) {
+  PROFILE_LATENCY((uint32_t)TCNT1 * 1000 / TICKS);
   current_millis++;
+  PROFILE_ENTER();
+#if FRACTION != 0
+  // the timer just restarted, so the TOP of this ms can still be changed
+  static uint32_t fraction;
+  fraction += FRACTION;
+  if( fraction >= WHOLE ) {
+    fraction -= WHOLE;
+    ICR1 = TOP + 1;
+  } else {
+    ICR1 = TOP;
+  }
+#endif
+#if TIMER_ISR
+  timer_isr();
+#endif
+  PROFILE_LEAVE(PROFILE_CLOCK);
 }
+
+#endif
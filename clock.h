@@ -3,18 +3,68 @@
 
 // a clock that counts miliseconds
 
-// this code sets up timer1 for a 1ms  @ 8Mhz Clock (Mode 12)
+// this code sets up timer1 to interrupt every ms (Mode 12), with a prescaler
+// and TOP derived from F_CPU at compile time.
+// in tickless mode, timer1 runs freely instead and only interrupts when it
+// overflows and at the alarm set with clock_alarm(). the time is computed from
+// the overflows and the running timer when it is read.
+// with CLOCK_RTC, timer2 runs from a 32.768kHz watch crystal, asynchronous to
+// the CPU, in the same tickless way. it keeps counting in power-save sleep,
+// and its alarm wakes up the CPU, so sleeping doesn't need clock_adjust().
+// on the ATmega328p, the crystal takes the place of the main one (TOSC1/2 are
+// XTAL1/2), so the CPU must run from its internal oscillator.
 
 #ifndef __CLOCK_H
 #define __CLOCK_H
 
-#define time_t unsigned long
+#include <stdint.h>
+
+#include "bool.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef CLOCK_MAX_ERROR           // ppm, largest deviation of a single ms
+#define CLOCK_MAX_ERROR 1000
+#endif
+
+#ifndef CLOCK_RTC                 // timer2 with a 32.768kHz crystal
+#define CLOCK_RTC       0
+#endif
+
+#ifndef CLOCK_TICKLESS            // no interrupt every ms, see clock_alarm()
+#define CLOCK_TICKLESS  CLOCK_RTC
+#endif
 
-volatile time_t current_millis;
+#if CLOCK_RTC && ! CLOCK_TICKLESS
+#error "CLOCK_RTC is always tickless"
+#endif
+
+#define time_t unsigned long
 
 void   clock_init(void);
 
-#define clock_get_millis() current_millis
-#define clock_adjust(diff) (current_millis += diff)
+// ms since clock_init(), read atomically
+time_t clock_get_millis(void);
+
+// us since clock_init(), the ms counter combined with the running timer, with
+// a resolution of one timer tick or one us. wraps every 71 minutes, so use it
+// for differences, e.g. to profile ISRs and frame latencies.
+uint32_t clock_get_micros(void);
+
+// moves the clock forward (or back), e.g. after sleeping or to synchronise it
+void   clock_adjust(int32_t diff);
+
+#if CLOCK_TICKLESS
+// requests an interrupt once the clock reaches the given time, to wake up the
+// CPU and call back timers (see timer.h). only the earliest of the requested
+// alarms is kept, until it went off.
+void   clock_alarm(time_t millis);
+#endif
+
+#if CLOCK_RTC
+// waits until the asynchronous timer took over all changes, call right before
+// sleeping in power-save mode, and right after waking up from it
+void   clock_sync(void);
+#endif
 
 #endif
@@ -0,0 +1,91 @@
+// energy.c
+// author: Christophe VG <contact@christophe.vg>
+
+// accounting of where the time goes (see energy.h)
+
+#include <string.h>
+
+#include <util/atomic.h>
+
+#include "energy.h"
+#include "clock.h"
+
+#if ENERGY_ACCOUNTING
+
+// the us clock wraps every 71 minutes, longer spans, e.g. a long power down,
+// are measured in ms
+#define LONG_SPAN 60000UL           // ms
+
+// forward declarations of "private" functions
+static void _account(void);
+static void _credit(energy_state_t state, uint32_t us);
+
+static energy_state_t current;
+static time_t         since_ms;
+static uint32_t       since_us;
+static uint16_t       carry[ENERGY_STATES];   // us, not yet accounted
+static energy_stats_t stats;
+static volatile uint32_t interrupted;         // us, in ISRs since _account()
+
+void energy_init(void) {
+  memset(&stats, 0, sizeof(stats));
+  memset(carry, 0, sizeof(carry));
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    interrupted = 0;
+  }
+  current  = ENERGY_ACTIVE;
+  since_ms = clock_get_millis();
+  since_us = clock_get_micros();
+}
+
+energy_state_t energy_switch(energy_state_t state) {
+  energy_state_t previous = current;
+  _account();
+  current = state;
+  stats.switches++;
+  return previous;
+}
+
+// called from ISRs, with interrupts disabled
+void energy_interrupted(uint32_t us) {
+  interrupted += us;
+}
+
+energy_stats_t energy_get_stats(void) {
+  _account();
+  return stats;
+}
+
+static void _account(void) {
+  time_t   now_ms = clock_get_millis();
+  uint32_t now_us = clock_get_micros();
+  int32_t  span   = now_ms - since_ms;
+  uint32_t isr;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    isr         = interrupted;
+    interrupted = 0;
+  }
+  _credit(ENERGY_ISR, isr);
+
+  // the time in ISRs is taken from the state they interrupted
+  if( span >= (int32_t)LONG_SPAN ) {
+    stats.ms[current] += span - isr / 1000;
+  } else {
+    int32_t elapsed = now_us - since_us;
+    // the clock was adjusted backwards, e.g. by time synchronisation
+    if( elapsed > (int32_t)isr ) {
+      _credit(current, elapsed - isr);
+    }
+  }
+  since_ms = now_ms;
+  since_us = now_us;
+}
+
+static void _credit(energy_state_t state, uint32_t us) {
+  us += carry[state];
+  stats.ms[state] += us / 1000;
+  carry[state]     = us % 1000;
+}
+
+#endif
@@ -0,0 +1,70 @@
+// energy.h
+// author: Christophe VG <contact@christophe.vg>
+
+// accounting of where the time goes: powered down, idling, busy-waiting on a
+// driver or actually running
+// the code that changes state, e.g. sleep.c and the xbee driver, switches the
+// current state, and the time since the previous switch, measured with
+// clock_get_micros(), is added to the state that is left. the time that is
+// credited to the clock after powering down is part of that measurement.
+// the time spent in ISRs is only known when they are profiled (see profile.h):
+// with PROFILE_ISR, it is accounted to ENERGY_ISR and taken from the state
+// they interrupted, without, it counts towards that state.
+// switches are made from the main loop only. without ENERGY_ACCOUNTING, they
+// compile to nothing.
+
+#ifndef __ENERGY_H
+#define __ENERGY_H
+
+#include <stdint.h>
+
+#include "bool.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef ENERGY_ACCOUNTING
+#define ENERGY_ACCOUNTING 0
+#endif
+
+typedef enum {
+  ENERGY_ACTIVE,                  // running, the initial state
+  ENERGY_IDLE,                    // idle sleep, the clock and USARTs run
+  ENERGY_POWER_DOWN,              // power-down or power-save sleep
+  ENERGY_XBEE_TX,                 // waiting for a byte to be sent to the XBee
+  ENERGY_WIFI,                    // waiting for a byte to or from the WIFI module
+  ENERGY_ISR,                     // in profiled ISRs, not switched to
+  ENERGY_STATES
+} energy_state_t;
+
+typedef struct {
+  uint32_t ms[ENERGY_STATES];
+  uint32_t switches;
+} energy_stats_t;
+
+#if ENERGY_ACCOUNTING
+
+void energy_init(void);
+
+// accounts the time since the previous switch and enters a new state
+// returns the state that was left, to switch back to it afterwards
+energy_state_t energy_switch(energy_state_t state);
+
+// accounts the time of an ISR, called when it leaves, see PROFILE_LEAVE()
+void energy_interrupted(uint32_t us);
+
+// the time spent in each state since energy_init(), up to now
+energy_stats_t energy_get_stats(void);
+
+#else
+
+static inline void energy_init(void) {}
+
+static inline energy_state_t energy_switch(energy_state_t state) {
+  return ENERGY_ACTIVE;
+}
+
+static inline void energy_interrupted(uint32_t us) {}
+
+#endif
+
+#endif
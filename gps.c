@@ -9,6 +9,12 @@
 
 #include "gps.h"
 #include "nmea.h"
+#include "sleep.h"
+#include "profile.h"
+
+#ifdef GPS_SCHED
+#include "sched.h"
+#endif
 
 // cyclic IO buffers
 typedef struct {
@@ -21,7 +27,12 @@ volatile cyclic_buffer_t incoming = {0, 0, {0}};
 
 // interrupt vector for handling reception of a single byte
 ISR (USARTg_RX_vect) {
+  PROFILE_ENTER();
   incoming.buffer[incoming.tail++] = UDRg;
+#ifdef GPS_SCHED
+  sched_signal(SCHED_GPS);
+#endif
+  PROFILE_LEAVE(PROFILE_GPS_RX);
 }
 
 static bool _data_available(void) {
@@ -88,3 +99,7 @@ void gps_receive(void) {
     nmea_parse(_receive_byte());
   }
 }
+
+uint8_t gps_sleep_guard(void) {
+  return _data_available() ? SLEEP_BUSY : SLEEP_LIGHT;
+}
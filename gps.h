@@ -72,6 +72,9 @@
 #define TXCIEg TXCIE0
 #endif
 
+// define GPS_SCHED to signal SCHED_GPS for each received byte, so a task of
+// the scheduler can call gps_receive() (see sched.h)
+
 // RX handler type
 typedef struct {
   uint8_t deg;
@@ -87,5 +90,7 @@ typedef struct {
 // functions
 void gps_init(void);
 void gps_receive(void);
+// tells how deep the CPU may sleep (see sleep.h): the module keeps sending
+uint8_t gps_sleep_guard(void);
 
 #endif
@@ -0,0 +1,117 @@
+// health.c
+// author: Christophe VG <contact@christophe.vg>
+
+// periodic health reports over XBee (see health.h)
+
+#include <string.h>
+
+#include "health.h"
+#include "clock.h"
+
+// forward declarations of "private" functions
+static void     _send(void);
+static void     _dispatched(xbee_rx_t *frame);
+static void     _put_32(uint8_t *buffer, uint32_t value);
+static uint32_t _get_32(const uint8_t *buffer);
+
+static bool             sending;
+static uint8_t          sequence;
+static time_t           next;
+static health_handler_t handler = NULL;
+
+bool health_init(bool send) {
+  sending = send;
+  next    = clock_get_millis() + HEALTH_INTERVAL;
+  return xbee_subscribe(HEALTH_MSG_REPORT, _dispatched);
+}
+
+void health_process(void) {
+  if( ! sending ) { return; }
+  time_t now = clock_get_millis();
+  if( (int32_t)(now - next) < 0 ) { return; }
+  _send();
+  next = now + HEALTH_INTERVAL;
+}
+
+void health_on_receive(health_handler_t new_handler) {
+  handler = new_handler;
+}
+
+health_report_t health_get_report(void) {
+  health_report_t report;
+  uint32_t        failures = xbee_get_failures();
+
+  memset(&report, 0, sizeof(report));
+  report.sequence = sequence;
+  report.parent   = xbee_get_parent_address();
+  report.uptime   = clock_get_millis();
+  report.failures = failures > 0xFFFF ? 0xFFFF : failures;
+#if ENERGY_ACCOUNTING
+  energy_stats_t energy = energy_get_stats();
+  memcpy(report.ms, energy.ms, sizeof(report.ms));
+#endif
+  return report;
+}
+
+uint8_t health_encode(health_report_t *report, uint8_t *buffer) {
+  buffer[0] = HEALTH_MSG_REPORT;
+  buffer[1] = report->sequence;
+  buffer[2] = report->parent >> 8;
+  buffer[3] = report->parent;
+  _put_32(&buffer[4], report->uptime);
+  buffer[8] = report->failures >> 8;
+  buffer[9] = report->failures;
+  for(uint8_t i=0; i<ENERGY_STATES; i++) {
+    _put_32(&buffer[10 + 4 * i], report->ms[i]);
+  }
+  return HEALTH_SIZE;
+}
+
+// newer nodes may report more states, these are ignored
+bool health_decode(const uint8_t *data, uint8_t size,
+                   health_report_t *report)
+{
+  if( size < HEALTH_SIZE || data[0] != HEALTH_MSG_REPORT ) { return FALSE; }
+  report->sequence = data[1];
+  report->parent   = data[2] << 8 | data[3];
+  report->uptime   = _get_32(&data[4]);
+  report->failures = data[8] << 8 | data[9];
+  for(uint8_t i=0; i<ENERGY_STATES; i++) {
+    report->ms[i] = _get_32(&data[10 + 4 * i]);
+  }
+  return TRUE;
+}
+
+static void _send(void) {
+  uint8_t         payload[HEALTH_SIZE];
+  xbee_dest_t     dest;
+  xbee_iov_t      data = { payload, sizeof(payload) };
+  health_report_t report = health_get_report();
+
+  health_encode(&report, payload);
+  sequence++;
+
+  xbee_dest_init(&dest, XB_COORDINATOR, 0x0000, XB_MAX_RADIUS, XB_OPT_NONE);
+  xbee_send_to(&dest, &data, 1);
+}
+
+static void _dispatched(xbee_rx_t *frame) {
+  health_report_t report;
+  if( handler == NULL || ! health_decode(frame->data, frame->size, &report) ) {
+    return;
+  }
+  handler(frame, &report);
+}
+
+// big endian, like all multi-byte fields in XBee frames
+static void _put_32(uint8_t *buffer, uint32_t value) {
+  buffer[0] = value >> 24;
+  buffer[1] = value >> 16;
+  buffer[2] = value >>  8;
+  buffer[3] = value;
+}
+
+static uint32_t _get_32(const uint8_t *buffer) {
+  return (uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 |
+         (uint32_t)buffer[2] <<  8 | buffer[3];
+}
@@ -0,0 +1,63 @@
+// health.h
+// author: Christophe VG <contact@christophe.vg>
+
+// periodic health reports over XBee
+// every HEALTH_INTERVAL ms, a node sends the coordinator how long it has been
+// up, its parent in the mesh, how its time was spent (see energy.h) and how
+// many of its frames failed. the times are totals since the node started, so
+// a lost report only loses resolution: the difference between two reports
+// gives the duty cycle over the time in between.
+
+#ifndef __HEALTH_H
+#define __HEALTH_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "xbee.h"
+#include "energy.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef HEALTH_INTERVAL           // ms between reports
+#define HEALTH_INTERVAL 60000
+#endif
+
+// message types, the first payload byte of every health frame
+
+#ifndef HEALTH_MSG_REPORT
+#define HEALTH_MSG_REPORT 0xD0    // [type][sequence][parent:2][uptime:4]
+#endif                            // [failures:2][ms per energy state:4...]
+
+#define HEALTH_SIZE       (10 + 4 * ENERGY_STATES)
+
+typedef struct {
+  uint8_t  sequence;
+  uint16_t parent;                // nw address
+  uint32_t uptime;                // ms
+  uint16_t failures;              // of transmitted frames, saturates
+  uint32_t ms[ENERGY_STATES];     // all 0 without ENERGY_ACCOUNTING
+} health_report_t;
+
+typedef void (*health_handler_t)(xbee_rx_t *frame, health_report_t *report);
+
+// subscribes to the health message type with the xbee driver, reports are
+// sent when send is TRUE
+bool health_init(bool send);
+
+// sends a report every HEALTH_INTERVAL ms, call from the main loop
+void health_process(void);
+
+// installs a handler for received reports, e.g. on the coordinator to keep
+// the parents in the node table (see nodes_set_parent())
+void health_on_receive(health_handler_t handler);
+
+// the report of this node, as it would be sent now
+health_report_t health_get_report(void);
+
+// (de)serialises reports, buffer must hold HEALTH_SIZE bytes
+uint8_t health_encode(health_report_t *report, uint8_t *buffer);
+bool    health_decode(const uint8_t *data, uint8_t size,
+                      health_report_t *report);
+
+#endif
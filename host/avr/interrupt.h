@@ -0,0 +1,18 @@
+// avr/interrupt.h
+// author: Christophe VG <contact@christophe.vg>
+
+// host stand-in for interrupt handling: an ISR is a plain function, that is
+// called by a "hardware" thread while holding the interrupt lock (see hal.c)
+
+#ifndef __HOST_AVR_INTERRUPT_H
+#define __HOST_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector(void); void vector(void)
+
+void host_cli(void);
+void host_sei(void);
+
+#define cli() host_cli()
+#define sei() host_sei()
+
+#endif
@@ -0,0 +1,74 @@
+// avr/io.h
+// author: Christophe VG <contact@christophe.vg>
+
+// host stand-in for the AVR I/O registers, just enough to build the drivers
+// registers are plain variables, defined in hal.c
+
+#ifndef __HOST_AVR_IO_H
+#define __HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#define bit_is_set(sfr, bit)   ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (! ((sfr) & _BV(bit)))
+
+#define loop_until_bit_is_set(sfr, bit)   do { } while( bit_is_clear(sfr, bit) )
+#define loop_until_bit_is_clear(sfr, bit) do { } while( bit_is_set(sfr, bit) )
+
+// ports
+
+extern volatile uint8_t PORTB, DDRB, PINB;
+extern volatile uint8_t PORTC, DDRC, PINC;
+extern volatile uint8_t PORTD, DDRD, PIND;
+
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// USART0, UDR0 is only read, writes go through host_usart_write() (see hal.h)
+
+extern volatile uint8_t UBRR0H, UBRR0L, UCSR0A, UCSR0B, UCSR0C, UDR0;
+
+#define RXC0   7
+#define TXC0   6
+#define UDRE0  5
+#define U2X0   1
+#define RXCIE0 7
+#define TXCIE0 6
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ01 2
+#define UCSZ00 1
+
+void host_usart_write(uint8_t c);
+
+// ADC
+
+extern volatile uint8_t  ADMUX, ADCSRA;
+extern volatile uint16_t ADC;
+
+#define REFS1 7
+#define REFS0 6
+#define ADEN  7
+#define ADSC  6
+#define ADATE 5
+#define ADIF  4
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+// interrupt vectors, ISR() turns these into plain functions
+
+#define USART0_RX_vect host_usart0_rx_vect
+#define USART0_TX_vect host_usart0_tx_vect
+#define ADC_vect       host_adc_vect
+
+#endif
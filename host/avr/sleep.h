@@ -0,0 +1,24 @@
+// avr/sleep.h
+// author: Christophe VG <contact@christophe.vg>
+
+// host stand-in for sleep modes: a sleeping CPU pauses briefly, after which
+// it continues as if woken up by an interrupt (see hal.c)
+
+#ifndef __HOST_AVR_SLEEP_H
+#define __HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE       0
+#define SLEEP_MODE_ADC        1
+#define SLEEP_MODE_PWR_DOWN   2
+#define SLEEP_MODE_PWR_SAVE   3
+#define SLEEP_MODE_STANDBY    6
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+
+void host_sleep_cpu(void);
+
+#define sleep_cpu() host_sleep_cpu()
+
+#endif
@@ -0,0 +1,85 @@
+// clock.c
+// author: Christophe VG <contact@christophe.vg>
+
+// host implementation of the millisecond clock (see ../clock.h)
+// a thread plays the part of the timer interrupt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <util/atomic.h>
+
+#include "hal.h"
+#include "../clock.h"
+#include "../timer.h"
+
+static volatile time_t current_millis;
+
+static uint64_t start;
+static uint32_t offset;
+static int32_t  drift;        // ppm
+static uint64_t ticks;        // ms counted since start
+
+void host_clock_skew(uint32_t clock_offset, int32_t clock_drift) {
+  offset = clock_offset;
+  drift  = clock_drift;
+}
+
+// us since start, as counted by the drifting "crystal"
+static uint64_t _elapsed(void) {
+  return (host_micros() - start) * (1000000 + drift) / 1000000;
+}
+
+// counts the ms that passed, instead of setting the time, to keep adjustments
+static void _tick(void) {
+  uint64_t elapsed = _elapsed() / 1000;
+  current_millis += elapsed - ticks;
+  ticks           = elapsed;
+#if TIMER_ISR
+  timer_isr();
+#endif
+}
+
+static void *_timer(void *arg) {
+  for(uint64_t next = start + 1000;; next += 1000) {
+    host_sleep_until(next);
+    host_interrupt(_tick);
+  }
+  return NULL;
+}
+
+void clock_init(void) {
+  pthread_t thread;
+
+  start          = host_micros();
+  current_millis = offset;
+  if( pthread_create(&thread, NULL, _timer, NULL) ) {
+    perror("clock_init");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(thread);
+}
+
+time_t clock_get_millis(void) {
+  time_t millis;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    millis = current_millis;
+  }
+  return millis;
+}
+
+// the us since the last tick play the part of the running timer, including
+// whole ms for which the timer thread didn't tick yet
+uint32_t clock_get_micros(void) {
+  uint32_t micros;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    micros = current_millis * 1000 + (_elapsed() - ticks * 1000);
+  }
+  return micros;
+}
+
+void clock_adjust(int32_t diff) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    current_millis += diff;
+  }
+}
@@ -0,0 +1,510 @@
+// gateway.c
+// author: Christophe VG <contact@christophe.vg>
+
+// coordinator gateway: reads XBee API frames from one or more serial devices
+// (or PTYs, e.g. from xbeesim), and writes the payloads of the RX packets as
+// binary records to a file or stdout, keeping counters per radio and per node
+
+// record format, all integers little endian:
+//   uint64_t time       us since the epoch, when the frame was read
+//   uint64_t address    64-bit source address
+//   uint16_t nw_address 16-bit source address
+//   uint8_t  radio      index of the device on the command line
+//   uint8_t  options    RX options
+//   uint16_t size       of the payload
+//   uint8_t  data[size]
+// gateway -D file dumps a record file in text form
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "../xbee_codec.h"
+
+#define MAX_RADIOS        64
+#define READ_BUFFER       32768   // xbee_scan() takes up to 64KB
+#define OUT_BUFFER        65536
+#define FLUSH_INTERVAL    100     // ms, at most between writing batches
+#define RECORD_HEADER     22
+#define MAX_FRAME         (XB_RX_HEADER_SIZE + 256)
+
+// forward declarations of "private" functions
+static void     _usage(char *name);
+static int      _open_device(char *name, speed_t speed);
+static void     _open_output(void);
+static void     _read(int index);
+static void     _handle_frame(int index, uint8_t *frame, uint16_t length);
+static void     _record(int index, xbee_rx_t *rx);
+static void     _flush(void);
+static void     _count(xbee_rx_t *rx, int index);
+static void     _grow(void);
+static void     _stats(FILE *file);
+static void     _write_stats(void);
+static int      _dump(char *name);
+static uint64_t _now(void);
+static speed_t  _speed(int baud);
+
+// a radio, i.e. a serial device with a coordinator XBee
+typedef struct {
+  char          *name;
+  int            fd;
+  bool           escaped;
+  xbee_parser_t  parser;              // API mode 2 only
+  uint8_t        frame[MAX_FRAME];
+  uint8_t        buffer[READ_BUFFER]; // API mode 1, scanned in place
+  uint32_t       size;
+  uint64_t       bytes;
+  uint64_t       frames;
+  uint64_t       checksum_errors;
+  uint64_t       unsupported;         // frames other than RX packets
+} radio_t;
+
+static radio_t radios[MAX_RADIOS];
+static int     radio_count = 0;
+static int     open_radios = 0;
+
+// per node counters, in an open addressing hash table on the 64-bit address
+typedef struct {
+  uint64_t address;
+  uint16_t nw_address;
+  uint8_t  radio;
+  bool     used;
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t first_seen;
+  uint64_t last_seen;
+} node_t;
+
+static node_t  *nodes;
+static uint32_t node_capacity = 0, node_count = 0;
+
+// output
+static char    *output_name = NULL;   // NULL = stdout
+static int      output      = STDOUT_FILENO;
+static uint8_t  out[OUT_BUFFER];
+static uint32_t out_size = 0;
+static uint64_t records  = 0;
+
+static char    *stats_name = NULL;
+
+static volatile sig_atomic_t running = 1, reopen = 0, dump_stats = 0;
+
+static void _signal(int signal) {
+  switch( signal ) {
+    case SIGHUP  : reopen     = 1; break;
+    case SIGUSR1 : dump_stats = 1; break;
+    default      : running    = 0;
+  }
+}
+
+int main(int argc, char **argv) {
+  int      option;
+  int      baud     = 9600;
+  bool     escaped  = FALSE;
+  uint32_t interval = 0;              // s between writing statistics
+
+  while( (option = getopt(argc, argv, "o:b:es:c:D:h")) != -1 ) {
+    switch( option ) {
+      case 'o': output_name = strcmp(optarg, "-") ? optarg : NULL; break;
+      case 'b': baud        = atoi(optarg);                         break;
+      case 'e': escaped     = TRUE;                                 break;
+      case 's': interval    = atoi(optarg);                         break;
+      case 'c': stats_name  = optarg;                               break;
+      case 'D': exit(_dump(optarg));
+      default : _usage(argv[0]);
+    }
+  }
+  if( optind == argc || argc - optind > MAX_RADIOS || ! _speed(baud) ) {
+    _usage(argv[0]);
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = _signal;
+  sigaction(SIGINT,  &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGHUP,  &action, NULL);
+  sigaction(SIGUSR1, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  _open_output();
+  _grow();
+
+  int epoll = epoll_create1(0);
+  if( epoll < 0 ) { perror("epoll_create1"); exit(EXIT_FAILURE); }
+
+  for(int i=optind; i<argc; i++) {
+    radio_t *radio = &radios[radio_count];
+    radio->name    = argv[i];
+    radio->escaped = escaped;
+    radio->fd      = _open_device(argv[i], _speed(baud));
+    xbee_parser_init(&radio->parser, radio->frame, MAX_FRAME, escaped);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = radio_count };
+    if( epoll_ctl(epoll, EPOLL_CTL_ADD, radio->fd, &event) < 0 ) {
+      perror(argv[i]);
+      exit(EXIT_FAILURE);
+    }
+    radio_count++;
+  }
+  open_radios = radio_count;
+
+  uint64_t next_stats = _now() + interval * 1000000ULL;
+  uint64_t last_flush = _now();
+
+  while( running && open_radios > 0 ) {
+    struct epoll_event events[MAX_RADIOS];
+    int count = epoll_wait(epoll, events, MAX_RADIOS, FLUSH_INTERVAL);
+    if( count < 0 && errno != EINTR ) { perror("epoll_wait"); break; }
+
+    for(int e=0; e<count; e++) {
+      _read(events[e].data.u32);
+    }
+    // batches are written when the buffer fills up, or regularly
+    uint64_t now = _now();
+    if( now - last_flush >= FLUSH_INTERVAL * 1000 ) {
+      _flush();
+      last_flush = now;
+    }
+
+    if( reopen ) {
+      reopen = 0;
+      _flush();
+      _open_output();
+    }
+    if( dump_stats ) {
+      dump_stats = 0;
+      _stats(stderr);
+    }
+    if( interval && _now() >= next_stats ) {
+      next_stats += interval * 1000000ULL;
+      _write_stats();
+    }
+  }
+
+  _flush();
+  _stats(stderr);
+  _write_stats();
+
+  exit(EXIT_SUCCESS);
+}
+
+static void _usage(char *name) {
+  fprintf(stderr,
+    "usage: %s [options] device...\n"
+    "  -o file     write records to file, - = stdout (default)\n"
+    "  -b baud     serial speed (9600)\n"
+    "  -e          the XBees use API mode 2 (escaped)\n"
+    "  -s seconds  write statistics every so many seconds\n"
+    "  -c file     write statistics to file instead of stderr\n"
+    "  -D file     dump a record file as text and exit\n"
+    "SIGUSR1 writes statistics to stderr, SIGHUP reopens the output file\n",
+    name);
+  exit(EXIT_FAILURE);
+}
+
+// devices and output
+
+static speed_t _speed(int baud) {
+  switch( baud ) {
+    case 9600   : return B9600;
+    case 19200  : return B19200;
+    case 38400  : return B38400;
+    case 57600  : return B57600;
+    case 115200 : return B115200;
+    case 230400 : return B230400;
+  }
+  return 0;
+}
+
+static int _open_device(char *name, speed_t speed) {
+  struct termios tio;
+
+  int fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if( fd < 0 ) { perror(name); exit(EXIT_FAILURE); }
+
+  if( isatty(fd) ) {
+    if( tcgetattr(fd, &tio) < 0 ) { perror(name); exit(EXIT_FAILURE); }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if( tcsetattr(fd, TCSANOW, &tio) < 0 ) { perror(name); exit(EXIT_FAILURE); }
+  }
+  return fd;
+}
+
+static void _open_output(void) {
+  if( output_name == NULL ) { return; }
+  if( output != STDOUT_FILENO ) { close(output); }
+  output = open(output_name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if( output < 0 ) { perror(output_name); exit(EXIT_FAILURE); }
+}
+
+// input
+
+static void _read(int index) {
+  radio_t *radio = &radios[index];
+  ssize_t  size;
+
+  do {
+    size = read(radio->fd, &radio->buffer[radio->size],
+                sizeof(radio->buffer) - radio->size);
+    if( size < 0 && errno == EINTR ) { continue; }
+    if( size < 0 && errno == EAGAIN ) { return; }
+    if( size <= 0 ) {
+      fprintf(stderr, "%s: closed\n", radio->name);
+      close(radio->fd);               // also removes it from the epoll set
+      radio->fd = -1;
+      open_radios--;
+      return;
+    }
+    radio->bytes += size;
+
+    // API mode 2: escaped bytes, parse byte by byte
+    if( radio->escaped ) {
+      for(ssize_t i=0; i<size; i++) {
+        switch( xbee_parse(&radio->parser, radio->buffer[i]) ) {
+          case XB_PARSE_FRAME:
+            _handle_frame(index, radio->frame, radio->parser.length);
+            break;
+          case XB_PARSE_CHECKSUM_ERROR:
+          case XB_PARSE_OVERSIZE:
+            radio->checksum_errors++;
+            break;
+          default:
+            break;
+        }
+      }
+      continue;
+    }
+
+    // API mode 1: frames are decoded in place, the remainder is kept
+    radio->size += size;
+    uint32_t offset = 0;
+    xbee_frame_t     frame;
+    xbee_parse_result_t result;
+    do {
+      result = xbee_scan(&radio->buffer[offset], radio->size - offset, &frame);
+      offset += frame.consumed;
+      if( result == XB_PARSE_FRAME ) {
+        _handle_frame(index, frame.data, frame.length);
+      } else if( result == XB_PARSE_CHECKSUM_ERROR ) {
+        radio->checksum_errors++;
+      } else if( radio->size - offset >= 3 &&
+                 ((radio->buffer[offset+1] << 8) | radio->buffer[offset+2])
+                   > MAX_FRAME )
+      {
+        // a corrupt length would make us wait for a frame that never comes
+        radio->checksum_errors++;
+        offset++;
+        result = XB_PARSE_CHECKSUM_ERROR;
+      }
+    } while( result != XB_PARSE_MORE );
+    memmove(radio->buffer, &radio->buffer[offset], radio->size - offset);
+    radio->size -= offset;
+  } while( size > 0 );
+}
+
+static void _handle_frame(int index, uint8_t *frame, uint16_t length) {
+  radio_t  *radio = &radios[index];
+  xbee_rx_t rx;
+
+  radio->frames++;
+  if( ! xbee_decode_rx(frame, length, &rx) ) {
+    radio->unsupported++;
+    return;
+  }
+  _count(&rx, index);
+  _record(index, &rx);
+}
+
+// records are collected in a buffer, that is written as a whole
+
+static uint8_t *_put(uint8_t *p, uint64_t value, uint8_t size) {
+  for(uint8_t i=0; i<size; i++) {
+    *p++ = value >> (8 * i);
+  }
+  return p;
+}
+
+static void _record(int index, xbee_rx_t *rx) {
+  if( out_size + RECORD_HEADER + rx->size > sizeof(out) ) { _flush(); }
+
+  uint8_t *p = &out[out_size];
+  p = _put(p, _now(),          8);
+  p = _put(p, rx->address,     8);
+  p = _put(p, rx->nw_address,  2);
+  p = _put(p, index,           1);
+  p = _put(p, rx->options,     1);
+  p = _put(p, rx->size,        2);
+  memcpy(p, rx->data, rx->size);
+
+  out_size += RECORD_HEADER + rx->size;
+  records++;
+}
+
+static void _flush(void) {
+  uint32_t done = 0;
+  while( done < out_size ) {
+    ssize_t size = write(output, &out[done], out_size - done);
+    if( size < 0 && errno == EINTR ) { continue; }
+    if( size < 0 ) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    done += size;
+  }
+  out_size = 0;
+}
+
+// node counters
+
+static uint32_t _hash(uint64_t address) {
+  address ^= address >> 33;
+  address *= 0xff51afd7ed558ccdULL;
+  address ^= address >> 33;
+  return address;
+}
+
+static node_t *_lookup(uint64_t address) {
+  uint32_t i = _hash(address) & (node_capacity - 1);
+  while( nodes[i].used && nodes[i].address != address ) {
+    i = (i + 1) & (node_capacity - 1);
+  }
+  return &nodes[i];
+}
+
+// doubles the table (starting at 1024 entries), keeping it at most half full
+static void _grow(void) {
+  node_t  *old      = nodes;
+  uint32_t capacity = node_capacity;
+
+  node_capacity = capacity ? capacity * 2 : 1024;
+  nodes = calloc(node_capacity, sizeof(node_t));
+  if( nodes == NULL ) { perror("calloc"); exit(EXIT_FAILURE); }
+
+  for(uint32_t i=0; i<capacity; i++) {
+    if( old[i].used ) { *_lookup(old[i].address) = old[i]; }
+  }
+  free(old);
+}
+
+static void _count(xbee_rx_t *rx, int index) {
+  node_t  *node = _lookup(rx->address);
+  uint64_t now  = _now();
+
+  if( ! node->used ) {
+    if( (node_count + 1) * 2 > node_capacity ) {
+      _grow();
+      node = _lookup(rx->address);
+    }
+    node->used       = TRUE;
+    node->address    = rx->address;
+    node->first_seen = now;
+    node_count++;
+  }
+  node->nw_address = rx->nw_address;
+  node->radio      = index;
+  node->frames++;
+  node->bytes     += rx->size;
+  node->last_seen  = now;
+}
+
+// statistics
+
+static void _stats(FILE *file) {
+  uint64_t now = _now();
+
+  fprintf(file, "radio  bytes        frames     cksum      other      name\n");
+  for(int i=0; i<radio_count; i++) {
+    radio_t *radio = &radios[i];
+    fprintf(file, "%5d  %-12llu %-10llu %-10llu %-10llu %s%s\n", i,
+            (unsigned long long)radio->bytes,
+            (unsigned long long)radio->frames,
+            (unsigned long long)radio->checksum_errors,
+            (unsigned long long)radio->unsupported,
+            radio->name, radio->fd < 0 ? " (closed)" : "");
+  }
+  fprintf(file, "%llu records, %u nodes\n", (unsigned long long)records,
+          node_count);
+  fprintf(file, "address          nw   radio frames     bytes        "
+                "frames/s  last seen (s ago)\n");
+  for(uint32_t i=0; i<node_capacity; i++) {
+    node_t *node = &nodes[i];
+    if( ! node->used ) { continue; }
+    double span = (node->last_seen - node->first_seen) / 1000000.0;
+    fprintf(file, "%016llx %04x %5d %-10llu %-12llu %8.1f  %.1f\n",
+            (unsigned long long)node->address, node->nw_address, node->radio,
+            (unsigned long long)node->frames,
+            (unsigned long long)node->bytes,
+            span > 0 ? (node->frames - 1) / span : 0.0,
+            (now - node->last_seen) / 1000000.0);
+  }
+  fflush(file);
+}
+
+// writes statistics to the statistics file, replacing it atomically
+static void _write_stats(void) {
+  if( stats_name == NULL ) {
+    _stats(stderr);
+    return;
+  }
+  char temp[4096];
+  snprintf(temp, sizeof(temp), "%s.tmp", stats_name);
+  FILE *file = fopen(temp, "w");
+  if( file == NULL ) { perror(temp); return; }
+  _stats(file);
+  fclose(file);
+  if( rename(temp, stats_name) < 0 ) { perror(stats_name); }
+}
+
+// reading records back
+
+static uint64_t _get(uint8_t *p, uint8_t size) {
+  uint64_t value = 0;
+  for(uint8_t i=0; i<size; i++) {
+    value |= (uint64_t)p[i] << (8 * i);
+  }
+  return value;
+}
+
+static int _dump(char *name) {
+  FILE   *file = strcmp(name, "-") ? fopen(name, "r") : stdin;
+  uint8_t header[RECORD_HEADER], data[0x10000];
+
+  if( file == NULL ) { perror(name); return EXIT_FAILURE; }
+
+  while( fread(header, sizeof(header), 1, file) == 1 ) {
+    uint16_t size = _get(&header[20], 2);
+    if( fread(data, 1, size, file) != size ) {
+      fprintf(stderr, "%s: truncated record\n", name);
+      return EXIT_FAILURE;
+    }
+    uint64_t time = _get(header, 8);
+    printf("%llu.%06llu %016llx %04x %u %02x %u:",
+           (unsigned long long)(time / 1000000),
+           (unsigned long long)(time % 1000000),
+           (unsigned long long)_get(&header[8], 8),
+           (unsigned int)_get(&header[16], 2),
+           header[18], header[19], size);
+    for(uint16_t i=0; i<size; i++) { printf(" %02x", data[i]); }
+    printf("\n");
+  }
+  return EXIT_SUCCESS;
+}
+
+static uint64_t _now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,153 @@
+// hal.c
+// author: Christophe VG <contact@christophe.vg>
+
+// host hardware abstraction, see hal.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hal.h"
+#include "avr/io.h"
+#include "avr/interrupt.h"
+#include "avr/sleep.h"
+#include "util/atomic.h"
+#include "util/delay.h"
+
+// registers
+
+volatile uint8_t PORTB, DDRB, PINB;
+volatile uint8_t PORTC, DDRC, PINC;
+volatile uint8_t PORTD, DDRD, PIND;
+
+// the data register is always empty, writes block in host_usart_write
+volatile uint8_t UBRR0H, UBRR0L, UCSR0A = _BV(UDRE0), UCSR0B, UCSR0C, UDR0;
+
+volatile uint8_t  ADMUX, ADCSRA;
+volatile uint16_t ADC;
+
+// provided by the driver that uses USART0
+void host_usart0_rx_vect(void);
+void host_usart0_tx_vect(void);
+
+// interrupts
+// a thread that "disabled interrupts" holds the lock, ISRs need it to run
+
+static pthread_mutex_t irq_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint8_t irq_disabled = 0;
+
+void host_cli(void) {
+  if( irq_disabled ) { return; }
+  pthread_mutex_lock(&irq_lock);
+  irq_disabled = 1;
+}
+
+void host_sei(void) {
+  if( ! irq_disabled ) { return; }
+  irq_disabled = 0;
+  pthread_mutex_unlock(&irq_lock);
+}
+
+uint8_t host_irq_save(void) {
+  uint8_t state = irq_disabled;
+  host_cli();
+  return state;
+}
+
+void host_irq_restore(uint8_t *state) {
+  if( ! *state ) { host_sei(); }
+}
+
+void host_irq_on(uint8_t *state) {
+  host_sei();
+}
+
+void host_interrupt(void (*isr)(void)) {
+  host_cli();
+  isr();
+  host_sei();
+}
+
+// time
+
+uint64_t host_micros(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void host_sleep_until(uint64_t micros) {
+  struct timespec until;
+  until.tv_sec  = micros / 1000000;
+  until.tv_nsec = (micros % 1000000) * 1000;
+  while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)
+         == EINTR );
+}
+
+void host_delay_us(double us) {
+  host_sleep_until(host_micros() + (uint64_t)us);
+}
+
+// sleeping, until the next "interrupt", takes at most a clock tick
+void host_sleep_cpu(void) {
+  host_delay_us(100);
+}
+
+// USART0
+// one byte on the line takes 10 bits: start bit, 8 data bits and stop bit
+
+static int      usart_fd = -1;
+static uint32_t byte_time;          // in us
+static uint64_t tx_free, rx_free;   // when the line is free again
+static volatile uint8_t closed = 0;
+
+static void *_receive(void *arg) {
+  uint8_t buffer[256];
+  ssize_t size;
+
+  while( (size = read(usart_fd, buffer, sizeof(buffer))) != 0 ) {
+    if( size < 0 ) {
+      if( errno == EINTR ) { continue; }
+      break;
+    }
+    for(ssize_t i=0; i<size; i++) {
+      // bytes that are already waiting arrive back to back
+      uint64_t now = host_micros();
+      rx_free = (rx_free > now ? rx_free : now) + byte_time;
+      host_sleep_until(rx_free);
+      host_cli();
+      UDR0 = buffer[i];
+      if( UCSR0B & _BV(RXCIE0) ) { host_usart0_rx_vect(); }
+      host_sei();
+    }
+  }
+  closed = 1;
+  return NULL;
+}
+
+void host_usart_attach(int fd, uint32_t baud) {
+  pthread_t thread;
+
+  usart_fd  = fd;
+  byte_time = 10000000 / baud;
+  if( pthread_create(&thread, NULL, _receive, NULL) ) {
+    perror("host_usart_attach");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(thread);
+}
+
+void host_usart_write(uint8_t c) {
+  uint64_t now = host_micros();
+  tx_free = (tx_free > now ? tx_free : now) + byte_time;
+  host_sleep_until(tx_free);
+  if( ! closed && write(usart_fd, &c, 1) != 1 ) { closed = 1; }
+  if( UCSR0B & _BV(TXCIE0) ) { host_interrupt(host_usart0_tx_vect); }
+}
+
+uint8_t host_usart_closed(void) {
+  return closed;
+}
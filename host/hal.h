@@ -0,0 +1,41 @@
+// hal.h
+// author: Christophe VG <contact@christophe.vg>
+
+// host hardware abstraction: emulates the parts of the AVR that the drivers
+// use, so they can run unmodified on a (Linux) host
+// - interrupts: ISRs are called from "hardware" threads while holding a global
+//   interrupt lock, which cli()/sei() and ATOMIC_BLOCK take and release
+// - USART0: a file descriptor (pipe, socket, PTY) at a given baud rate, bytes
+//   are paced in both directions as on a real serial line
+// - timer: see clock.c
+
+#ifndef __HOST_HAL_H
+#define __HOST_HAL_H
+
+#include <stdint.h>
+
+// connects USART0 to fd, starts receiving and delivering bytes through the
+// USART0 RX interrupt
+void host_usart_attach(int fd, uint32_t baud);
+
+// transmits one byte, blocking for the duration of one byte on the line, and
+// signals completion through the USART0 TX interrupt
+void host_usart_write(uint8_t c);
+
+// TRUE once the fd was closed by the other side
+uint8_t host_usart_closed(void);
+
+// runs an interrupt service routine on behalf of a hardware thread
+void host_interrupt(void (*isr)(void));
+
+// microseconds since an arbitrary point in time
+uint64_t host_micros(void);
+
+// sleeps until the given host_micros() time
+void host_sleep_until(uint64_t micros);
+
+// (clock.c) starts the millisecond clock at offset and lets it run drift ppm
+// fast (or slow), as the clock of a real node would, call before clock_init()
+void host_clock_skew(uint32_t offset, int32_t drift);
+
+#endif
@@ -0,0 +1,167 @@
+// node.c
+// author: Christophe VG <contact@christophe.vg>
+
+// a node of the virtual XBee mesh: runs the xbee driver (and bulk transfer
+// layer) against the simulated radio, generating traffic and recording how
+// the driver fared
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "hal.h"
+
+#include "../xbee.h"
+#include "../bulk.h"
+#include "../clock.h"
+#include "../timesync.h"
+#include "../energy.h"
+#include "../health.h"
+
+// time given to outstanding statuses and transfers after sending stopped
+#define DRAIN_TIME 1000
+
+// first payload byte of plain test frames, distinct from the bulk types
+#define MSG_TEST   0x01
+
+// test frames: [MSG_TEST][sent:4][synced][time:4], the time of a synced sender
+// gives the one-way latency at a synced receiver
+#define STAMP_SIZE 10
+
+// with explicit addressing, test frames go to this endpoint and cluster
+#define TEST_ENDPOINT 0x42
+#define TEST_CLUSTER  0x0101
+
+static node_config_t *config;
+static node_report_t *report;
+
+static void _receive(xbee_rx_t *frame) {
+  report->received++;
+  if( frame->size >= STAMP_SIZE && frame->data[5] && timesync_is_synced() ) {
+    uint32_t sent;
+    memcpy(&sent, &frame->data[6], sizeof(sent));
+    int32_t latency = (uint32_t)clock_get_millis() - sent;
+    report->one_way_total += latency;
+    report->one_way_count++;
+    if( latency > report->one_way_max ) { report->one_way_max = latency; }
+  }
+  if( config->processing ) { host_delay_us(config->processing); }
+}
+
+static void _receive_health(xbee_rx_t *frame, health_report_t *health) {
+  report->health++;
+}
+
+static void _receive_bulk(uint64_t address, uint8_t *data, uint16_t size) {
+  report->received++;
+}
+
+// accounts for a finished bulk transfer
+static bool bulk_busy = FALSE;
+
+static void _check_bulk(void) {
+  if( ! bulk_busy ) { return; }
+  switch( bulk_get_status() ) {
+    case BULK_DONE   : report->sent++;   break;
+    case BULK_FAILED : report->failed++; break;
+    default          : return;
+  }
+  bulk_busy = FALSE;
+}
+
+// starts a new bulk transfer, unless one is still busy
+static bool _send_bulk(uint8_t *data) {
+  _check_bulk();
+  if( bulk_busy ) { return FALSE; }
+  bulk_busy = bulk_send(config->address, data, config->size);
+  return bulk_busy;
+}
+
+// one round of the main loop, yielding the CPU to the other nodes
+static void _process(void) {
+  xbee_receive();
+  bulk_process();
+  if( config->timesync ) { timesync_process(); }
+  if( config->health   ) { health_process();   }
+  _check_bulk();
+  host_delay_us(100);
+}
+
+void node_run(int fd, node_config_t *node_config, node_report_t *node_report) {
+  static uint8_t payload[BULK_MAX_SIZE];
+  xbee_dest_t    dest;
+
+  config = node_config;
+  report = node_report;
+
+  host_usart_attach(fd, config->baud);
+  host_clock_skew(config->clock_offset, config->clock_drift);
+  clock_init();
+  energy_init();
+  xbee_init();
+  xbee_subscribe(MSG_TEST, _receive);
+  xbee_subscribe_endpoint(TEST_ENDPOINT, TEST_CLUSTER, _receive);
+  bulk_init();
+  bulk_on_receive(_receive_bulk);
+
+  xbee_wait_for_association();
+  report->associated       = TRUE;
+  report->association_time = clock_get_millis() - config->clock_offset;
+  if( config->timesync ) { timesync_init(xbee_get_nw_address() == 0x0000); }
+  if( config->health ) {
+    health_init(xbee_get_nw_address() != 0x0000);
+    health_on_receive(_receive_health);
+  }
+
+  xbee_reset_counters(NULL);
+  xbee_dest_init(&dest, config->address, XB_NW_ADDR_UNKNOWN,
+                 XB_MAX_RADIUS, XB_OPT_NONE);
+  for(uint16_t i=0; i<sizeof(payload); i++) { payload[i] = i; }
+  payload[0] = MSG_TEST;
+
+  // the node's clock can be adjusted by time sync, so run on host time
+  uint64_t now      = host_micros();
+  uint64_t stop     = now + config->duration * 1000000ULL;
+  uint64_t interval = config->rate ? 1000000 / config->rate : 0;
+  uint64_t next     = now;
+
+  while( now < stop && ! host_usart_closed() ) {
+    _process();
+    if( config->send && host_micros() >= next ) {
+      if( config->bulk ) {
+        if( ! _send_bulk(payload) ) { continue; }
+      } else {
+        xbee_iov_t data = { payload, config->size };
+        memcpy(&payload[1], &report->sent, sizeof(report->sent));
+        if( config->size >= STAMP_SIZE ) {
+          uint32_t time = clock_get_millis();
+          payload[5] = timesync_is_synced();
+          memcpy(&payload[6], &time, sizeof(time));
+        }
+        if( config->explicit ) {
+          xbee_endpoint_t endpoint = { TEST_ENDPOINT, TEST_ENDPOINT,
+                                       TEST_CLUSTER, XB_DIGI_PROFILE };
+          xbee_send_explicit(&dest, &endpoint, &data, 1);
+        } else {
+          xbee_send_to(&dest, &data, 1);
+        }
+        report->sent++;
+      }
+      next += interval;
+    }
+    now = host_micros();
+  }
+
+  // let outstanding work finish
+  stop = now + DRAIN_TIME * 1000;
+  while( host_micros() < stop && ! host_usart_closed() ) {
+    _process();
+  }
+
+  xbee_get_counters(&report->metrics);
+  report->sync        = timesync_get_status();
+  report->energy      = energy_get_stats();
+  report->clock_error = (int64_t)clock_get_millis() * 1000 - host_micros();
+  report->done        = TRUE;
+}
@@ -0,0 +1,57 @@
+// sim.h
+// author: Christophe VG <contact@christophe.vg>
+
+// virtual XBee mesh: shared definitions of the simulated radio (xbeesim.c) and
+// the nodes that run the xbee driver against it (node.c)
+
+#ifndef __HOST_SIM_H
+#define __HOST_SIM_H
+
+#include <stdint.h>
+
+#include "../bool.h"
+#include "../xbee.h"
+#include "../timesync.h"
+#include "../energy.h"
+
+// what a node does
+typedef struct {
+  uint32_t baud;          // speed of the serial line to the XBee
+  uint64_t address;       // destination of its traffic
+  bool     send;          // FALSE = only receive
+  bool     bulk;          // send bulk transfers instead of single frames
+  bool     explicit;      // send frames to an endpoint/cluster (0x11)
+  uint16_t size;          // payload/transfer size
+  uint32_t rate;          // frames or transfers per second, 0 = flat out
+  uint32_t duration;      // seconds of sending
+  uint32_t processing;    // us spent handling each received frame
+  bool     timesync;      // synchronise clocks, node 0 is the master
+  uint32_t clock_offset;  // ms, the clock's start value
+  int32_t  clock_drift;   // ppm
+  bool     health;        // send health reports, node 0 receives them
+} node_config_t;
+
+// how it went, filled in by the node in memory shared with the simulator
+typedef struct {
+  bool           done;
+  bool           associated;
+  uint32_t       association_time;  // ms
+  uint32_t       sent;              // frames or completed transfers
+  uint32_t       failed;            // failed transfers
+  uint32_t       received;          // frames or reassembled transfers
+  xbee_metrics_t metrics;
+  // with time sync
+  timesync_status_t sync;
+  int64_t        clock_error;       // us, clock - host_micros() when done
+  int64_t        one_way_total;     // ms, of received timestamped frames
+  uint32_t       one_way_count;
+  int32_t        one_way_max;
+  // time spent per state, and health reports received
+  energy_stats_t energy;
+  uint32_t       health;
+} node_report_t;
+
+// runs the xbee driver on USART0 connected to fd, in its own process
+void node_run(int fd, node_config_t *config, node_report_t *report);
+
+#endif
@@ -0,0 +1,25 @@
+// util/atomic.h
+// author: Christophe VG <contact@christophe.vg>
+
+// host stand-in for ATOMIC_BLOCK, based on the interrupt lock of hal.c
+
+#ifndef __HOST_UTIL_ATOMIC_H
+#define __HOST_UTIL_ATOMIC_H
+
+#include <stdint.h>
+
+uint8_t host_irq_save(void);
+void    host_irq_restore(uint8_t *state);
+void    host_irq_on(uint8_t *state);
+
+#define ATOMIC_RESTORESTATE \
+  uint8_t _host_state __attribute__((__cleanup__(host_irq_restore))) = \
+    host_irq_save()
+#define ATOMIC_FORCEON \
+  uint8_t _host_state __attribute__((__cleanup__(host_irq_on))) = \
+    host_irq_save()
+
+#define ATOMIC_BLOCK(type) \
+  for( type, _host_todo = 1; _host_todo; _host_todo = 0 )
+
+#endif
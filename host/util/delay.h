@@ -0,0 +1,14 @@
+// util/delay.h
+// author: Christophe VG <contact@christophe.vg>
+
+// host stand-in for the busy-wait delays
+
+#ifndef __HOST_UTIL_DELAY_H
+#define __HOST_UTIL_DELAY_H
+
+void host_delay_us(double us);
+
+#define _delay_us(us) host_delay_us(us)
+#define _delay_ms(ms) host_delay_us((ms) * 1000.0)
+
+#endif
@@ -0,0 +1,12 @@
+// util/setbaud.h
+// author: Christophe VG <contact@christophe.vg>
+
+// host stand-in for the baud rate computation, the simulated USART ignores the
+// resulting register values, its speed is set using host_usart_attach()
+// like the original, this file is included after defining BAUD, possibly
+// more than once
+
+#define UBRR_VALUE  (((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+#define UBRRL_VALUE (UBRR_VALUE & 0xff)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+#define USE_2X      0
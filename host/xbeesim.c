@@ -0,0 +1,707 @@
+// xbeesim.c
+// author: Christophe VG <contact@christophe.vg>
+
+// virtual XBee mesh: a simulated radio that connects a number of nodes
+// - nodes run the xbee driver in a process of their own (see node.c), talking
+//   to the radio over a socket pair, or are PTYs an external program (e.g. a
+//   gateway) can connect to
+// - TX requests (0x10/0x11) are routed to their destination(s), which receive
+//   an RX packet (0x90/0x91), the sender gets a TX status (0x8B)
+// - AT commands AI, MY, MP, SH, SL and NP are answered
+// - the radio has a configurable latency, loss (per transmission attempt) and
+//   shared bandwidth, the serial lines have a configurable baud rate
+// - optionally the nodes synchronise their clocks, which start at a random
+//   offset and drift, node 0 is the master
+// when done, frames/s, delivery latency and overflows are reported per node
+
+#define _GNU_SOURCE                   // ppoll, posix_openpt and friends
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+
+#include "sim.h"
+#include "hal.h"
+
+#include "../xbee_codec.h"
+#include "../bulk.h"
+
+#define MAX_NODES       32
+#define MAX_FRAME       (XB_TX_HEADER_SIZE + 256)
+#define UART_BACKLOG    512       // bytes the XBee buffers towards its host
+#define MAC_RETRIES     3         // retransmissions of unicasts by the MAC
+#define CLOCK_OFFSET    10000     // ms, largest start value of a node's clock
+#define RF_OVERHEAD     31        // PHY, MAC, NWK and APS headers and footers
+#define ADDRESS_BASE    0x0013A20040000000
+
+// forward declarations of "private" functions
+static void _usage(char *name);
+static void _open_socket(int index);
+static void _open_pty(int index);
+static void _receive(int index);
+static void _handle_frame(int index, uint8_t *frame, uint16_t length);
+static void _handle_at(int index, xbee_at_t *at);
+static void _transmit(int index, xbee_tx_t *tx, bool explicit);
+static void _schedule(uint64_t time, uint8_t node, uint8_t source,
+                      uint64_t sent, const xbee_iov_t *iov, uint8_t count);
+static void _schedule_status(uint64_t time, uint8_t node, xbee_tx_t *tx,
+                             uint16_t nw_address, uint8_t retries,
+                             uint8_t delivery);
+static void _deliver(uint64_t now);
+static void _flush(int index);
+static int  _find(uint64_t address);
+static bool _lost(void);
+static uint64_t _occupy(uint64_t now, uint16_t size);
+static uint64_t _airtime(uint16_t size);
+static void _report(void);
+
+// configuration
+static struct {
+  int      nodes;
+  int      ptys;
+  uint32_t latency;         // us, one way
+  uint32_t loss;            // per mille, per transmission attempt
+  uint32_t bandwidth;       // bits/s
+  uint32_t baud;
+  uint32_t join;            // us
+  char    *pattern;
+  int32_t  drift;           // ppm, largest clock drift with time sync
+} sim = { 3, 0, 5000, 0, 250000, 9600, 0, "star", 0 };
+
+// a node as seen by the radio
+typedef struct {
+  int           fd;
+  int           slave;              // PTYs: keeps the slave side open
+  pid_t         pid;
+  char          name[64];
+  uint64_t      address;
+  uint16_t      nw_address;
+  uint16_t      parent;
+  int32_t       drift;              // ppm, of the node's clock
+  xbee_parser_t parser;
+  uint8_t       frame[MAX_FRAME];
+  uint8_t       out[4096];          // bytes waiting to be written
+  uint16_t      out_size;
+  uint64_t      uart_free;          // when the serial line is idle again
+  // statistics
+  uint32_t      tx_frames;          // TX requests received from the node
+  uint32_t      rx_frames;          // RX packets delivered to the node
+  uint32_t      lost;               // of its TX requests
+  uint32_t      retries;
+  uint32_t      at_commands;
+  uint32_t      checksum_errors;
+  uint32_t      uart_drops;         // frames to the node, dropped by its XBee
+  uint64_t      first_tx, last_tx;
+  uint64_t      latency_total;      // of its delivered frames
+  uint32_t      latency_count;
+  uint32_t      latency_max;
+} node_t;
+
+static node_t         nodes[MAX_NODES];
+static node_report_t *reports;        // shared with the node processes
+static uint64_t       start;
+static uint64_t       channel_free;   // when the radio channel is free again
+static uint32_t       byte_time;      // on the serial lines, in us
+
+// frames in the air, waiting to be delivered to a node's serial line
+typedef struct {
+  uint64_t time;
+  uint64_t sent;                      // when the TX request was received
+  uint8_t  node;
+  uint8_t  source;                    // for RX packets, else NO_SOURCE
+  uint16_t size;
+  uint8_t  data[MAX_FRAME + XB_FRAME_OVERHEAD];
+} event_t;
+
+#define NO_SOURCE 0xFF
+
+static event_t *events;
+static int      event_count = 0, event_capacity = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static void _stop(int signal) {
+  running = 0;
+}
+
+int main(int argc, char **argv) {
+  node_config_t config = { 0, 0, TRUE, FALSE, FALSE, 32, 5, 10, 0, FALSE, 0, 0 };
+  int           option;
+
+  while( (option = getopt(argc, argv, "n:p:d:r:s:m:bxl:L:w:B:j:P:t:eS:h")) != -1 ) {
+    switch( option ) {
+      case 'n': sim.nodes          = atoi(optarg);               break;
+      case 'p': sim.ptys           = atoi(optarg);               break;
+      case 'd': config.duration    = atoi(optarg);               break;
+      case 'r': config.rate        = atoi(optarg);               break;
+      case 's': config.size        = atoi(optarg);               break;
+      case 'm': sim.pattern        = optarg;                     break;
+      case 'b': config.bulk        = TRUE;                       break;
+      case 'x': config.explicit    = TRUE;                       break;
+      case 'l': sim.latency        = atof(optarg) * 1000;        break;
+      case 'L': sim.loss           = atof(optarg) * 10;          break;
+      case 'w': sim.bandwidth      = atoi(optarg);               break;
+      case 'B': sim.baud           = atoi(optarg);               break;
+      case 'j': sim.join           = atof(optarg) * 1000;        break;
+      case 'P': config.processing  = atoi(optarg);               break;
+      case 't': config.timesync    = TRUE;
+                sim.drift          = atoi(optarg);               break;
+      case 'e': config.health      = TRUE;                       break;
+      case 'S': srandom(atoi(optarg));                           break;
+      default : _usage(argv[0]);
+    }
+  }
+  if( sim.nodes < 2 || sim.nodes > MAX_NODES || sim.ptys > sim.nodes ||
+      sim.bandwidth == 0 || sim.baud == 0 )
+  {
+    _usage(argv[0]);
+  }
+  if( strcmp(sim.pattern, "star") && strcmp(sim.pattern, "ring") &&
+      strcmp(sim.pattern, "broadcast") )
+  {
+    _usage(argv[0]);
+  }
+  if( config.size == 0 ||
+      config.size > (config.bulk ? BULK_MAX_SIZE : XB_MAX_PAYLOAD) ||
+      (config.bulk && ! strcmp(sim.pattern, "broadcast")) )
+  {
+    fprintf(stderr, "invalid size or bulk transfers to broadcast\n");
+    exit(EXIT_FAILURE);
+  }
+
+  reports = mmap(NULL, sizeof(node_report_t) * MAX_NODES,
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if( reports == MAP_FAILED ) { perror("mmap"); exit(EXIT_FAILURE); }
+  memset(reports, 0, sizeof(node_report_t) * MAX_NODES);
+
+  signal(SIGINT,  _stop);
+  signal(SIGTERM, _stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  start       = host_micros();
+  byte_time   = 10000000 / sim.baud;
+  config.baud = sim.baud;
+
+  // node 0 is the coordinator, all others are its children
+  for(int i=0; i<sim.nodes; i++) {
+    nodes[i].address    = ADDRESS_BASE + i;
+    nodes[i].nw_address = i == 0 ? 0x0000 : 0x1000 + i;
+    nodes[i].parent     = i == 0 ? XB_NW_ADDR_UNKNOWN : 0x0000;
+    xbee_parser_init(&nodes[i].parser, nodes[i].frame, MAX_FRAME, FALSE);
+
+    if( i < sim.ptys ) {
+      _open_pty(i);
+      printf("node %d: %s\n", i, nodes[i].name);
+      fflush(stdout);
+      continue;
+    }
+    _open_socket(i);
+
+    if( ! strcmp(sim.pattern, "star") ) {
+      config.address = XB_COORDINATOR;
+      config.send    = i != 0;
+    } else if( ! strcmp(sim.pattern, "ring") ) {
+      config.address = ADDRESS_BASE + (i + 1) % sim.nodes;
+    } else {
+      config.address = XB_BROADCAST;
+    }
+
+    if( config.timesync ) {
+      config.clock_offset = random() % CLOCK_OFFSET;
+      config.clock_drift  = random() % (2 * sim.drift + 1) - sim.drift;
+      nodes[i].drift      = config.clock_drift;
+    }
+
+    fflush(stdout);
+    nodes[i].pid = fork();
+    if( nodes[i].pid < 0 ) { perror("fork"); exit(EXIT_FAILURE); }
+    if( nodes[i].pid == 0 ) {
+      for(int j=0; j<i; j++) {
+        close(nodes[j].fd);
+        if( j < sim.ptys ) { close(nodes[j].slave); }
+      }
+      close(nodes[i].fd);
+      signal(SIGINT, SIG_IGN);
+      node_run(nodes[i].slave, &config, &reports[i]);
+      exit(EXIT_SUCCESS);
+    }
+    close(nodes[i].slave);
+  }
+
+  // joining the network is announced with a modem status
+  for(int i=0; i<sim.nodes; i++) {
+    uint8_t    status[XB_MODEM_STATUS_SIZE];
+    xbee_iov_t data = {
+      status,
+      xbee_encode_modem_status(status, i == 0 ? XB_MODEM_COORD_STARTED
+                                              : XB_MODEM_JOINED)
+    };
+    _schedule(start + sim.join, i, NO_SOURCE, 0, &data, 1);
+  }
+
+  // run until all driver nodes are done, or until interrupted
+  struct pollfd fds[MAX_NODES];
+  int           spawned = sim.nodes - sim.ptys;
+
+  while( running && (spawned > 0 || sim.ptys == sim.nodes) ) {
+    uint64_t now = host_micros();
+    _deliver(now);
+
+    // wait for input, room to write or the next event
+    uint64_t wait = 100000;
+    for(int e=0; e<event_count; e++) {
+      if( events[e].time <= now ) { wait = 0; break; }
+      if( events[e].time - now < wait ) { wait = events[e].time - now; }
+    }
+    struct timespec timeout = { wait / 1000000, (wait % 1000000) * 1000 };
+
+    for(int i=0; i<sim.nodes; i++) {
+      fds[i].fd      = nodes[i].fd;
+      fds[i].events  = POLLIN | (nodes[i].out_size ? POLLOUT : 0);
+      fds[i].revents = 0;
+    }
+    if( ppoll(fds, sim.nodes, &timeout, NULL) < 0 ) {
+      if( errno == EINTR ) { continue; }
+      perror("ppoll");
+      break;
+    }
+    for(int i=0; i<sim.nodes; i++) {
+      if( fds[i].revents & POLLOUT ) { _flush(i); }
+      if( fds[i].revents & (POLLIN | POLLHUP | POLLERR) ) {
+        _receive(i);
+        if( nodes[i].fd < 0 && i >= sim.ptys ) { spawned--; }
+      }
+    }
+  }
+
+  for(int i=0; i<sim.nodes; i++) {
+    if( nodes[i].pid > 0 ) {
+      if( ! running ) { kill(nodes[i].pid, SIGTERM); }
+      waitpid(nodes[i].pid, NULL, 0);
+    }
+  }
+  _report();
+
+  exit(EXIT_SUCCESS);
+}
+
+static void _usage(char *name) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -n nodes      number of nodes, node 0 is the coordinator (3)\n"
+    "  -p ptys       expose the first nodes as PTYs instead of running the\n"
+    "                driver for them (0)\n"
+    "  -d seconds    duration of the traffic (10)\n"
+    "  -r rate       frames or transfers per second per node, 0 = max (5)\n"
+    "  -s size       payload or transfer size (32)\n"
+    "  -m pattern    star (to the coordinator), ring or broadcast (star)\n"
+    "  -b            send bulk transfers instead of single frames\n"
+    "  -x            send frames to an endpoint and cluster (0x11)\n"
+    "  -l ms         radio latency (5)\n"
+    "  -L percent    loss per transmission attempt (0)\n"
+    "  -w bits/s     radio bandwidth, shared by all nodes (250000)\n"
+    "  -B baud       serial line speed (9600)\n"
+    "  -j ms         time it takes to join the network (0)\n"
+    "  -P us         processing time per received frame in the nodes (0)\n"
+    "  -t ppm        synchronise the clocks of the nodes, which start at a\n"
+    "                random offset and drift up to ppm\n"
+    "  -e            send health reports to the coordinator every second\n"
+    "  -S seed       random seed\n", name);
+  exit(EXIT_FAILURE);
+}
+
+// node connections
+
+static void _open_socket(int index) {
+  int pair[2];
+  if( socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0 ) {
+    perror("socketpair");
+    exit(EXIT_FAILURE);
+  }
+  fcntl(pair[0], F_SETFL, O_NONBLOCK);
+  nodes[index].fd    = pair[0];
+  nodes[index].slave = pair[1];
+}
+
+static void _open_pty(int index) {
+  struct termios tio;
+  int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if( fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0 ) {
+    perror("posix_openpt");
+    exit(EXIT_FAILURE);
+  }
+  strncpy(nodes[index].name, ptsname(fd), sizeof(nodes[index].name) - 1);
+  // keep the slave side open and raw, so the PTY survives its users
+  nodes[index].slave = open(nodes[index].name, O_RDWR | O_NOCTTY);
+  if( nodes[index].slave < 0 ) { perror("open pty"); exit(EXIT_FAILURE); }
+  tcgetattr(nodes[index].slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(nodes[index].slave, TCSANOW, &tio);
+  nodes[index].fd = fd;
+}
+
+static void _receive(int index) {
+  node_t  *node = &nodes[index];
+  uint8_t  buffer[1024];
+  ssize_t  size = read(node->fd, buffer, sizeof(buffer));
+
+  if( size < 0 && (errno == EAGAIN || errno == EINTR) ) { return; }
+  if( size <= 0 ) {
+    close(node->fd);
+    node->fd = -1;
+    return;
+  }
+  for(ssize_t i=0; i<size; i++) {
+    switch( xbee_parse(&node->parser, buffer[i]) ) {
+      case XB_PARSE_FRAME:
+        _handle_frame(index, node->frame, node->parser.length);
+        break;
+      case XB_PARSE_CHECKSUM_ERROR:
+      case XB_PARSE_OVERSIZE:
+        node->checksum_errors++;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static void _handle_frame(int index, uint8_t *frame, uint16_t length) {
+  xbee_tx_t tx;
+  xbee_at_t at;
+
+  if( xbee_decode_tx(frame, length, &tx) ) {
+    _transmit(index, &tx, frame[0] == XB_TX_EXPLICIT);
+  } else if( xbee_decode_at(frame, length, &at) ) {
+    _handle_at(index, &at);
+  }
+}
+
+// AT commands
+
+static void _handle_at(int index, xbee_at_t *at) {
+  node_t  *node = &nodes[index];
+  uint64_t now  = host_micros();
+  uint8_t  value[4];
+  uint8_t  size = 0;
+
+  node->at_commands++;
+  at->status = XB_AT_OK;
+
+  switch( (at->command[0] << 8) | at->command[1] ) {
+    case ('A' << 8) | 'I':
+      value[size++] = now >= start + sim.join ? XB_AT_AI_SUCCESS
+                                              : XB_AT_AI_SCANNING;
+      break;
+    case ('M' << 8) | 'Y':
+      value[size++] = node->nw_address >> 8;
+      value[size++] = node->nw_address;
+      break;
+    case ('M' << 8) | 'P':
+      value[size++] = node->parent >> 8;
+      value[size++] = node->parent;
+      break;
+    case ('S' << 8) | 'H':
+    case ('S' << 8) | 'L':
+      for(int8_t i=at->command[1] == 'H' ? 56 : 24; size<4; i-=8) {
+        value[size++] = node->address >> i;
+      }
+      break;
+    case ('N' << 8) | 'P':
+      value[size++] = 0;
+      value[size++] = XB_MAX_PAYLOAD;
+      break;
+    default:
+      at->status = XB_AT_INV_CMD;
+  }
+
+  if( at->id == XB_TX_NO_RESPONSE ) { return; }
+
+  uint8_t    header[XB_AT_RESPONSE_HEADER_SIZE];
+  xbee_iov_t data[] = {
+    { header, xbee_encode_at_response(header, at) },
+    { value,  size }
+  };
+  _schedule(now, index, NO_SOURCE, 0, data, 2);
+}
+
+// radio
+
+static bool _lost(void) {
+  return sim.loss && (uint32_t)(random() % 1000) < sim.loss;
+}
+
+// time on the air of a frame with size bytes of payload, in us
+static uint64_t _airtime(uint16_t size) {
+  return (uint64_t)(size + RF_OVERHEAD) * 8 * 1000000 / sim.bandwidth;
+}
+
+// occupies the shared channel for one transmission, returns when it ends
+static uint64_t _occupy(uint64_t now, uint16_t size) {
+  if( channel_free < now ) { channel_free = now; }
+  channel_free += _airtime(size);
+  return channel_free;
+}
+
+// explicit TX requests are delivered as explicit RX indicators, as if all
+// radios had AT AO=1, plain ones as plain RX packets
+static void _transmit(int index, xbee_tx_t *tx, bool explicit) {
+  node_t  *node = &nodes[index];
+  uint64_t now  = host_micros();
+  xbee_rx_t rx;
+  uint8_t   header[XB_RX_EXPLICIT_HEADER_SIZE];
+  uint8_t (*encode)(uint8_t*, const xbee_rx_t*) =
+    explicit ? xbee_encode_rx_explicit : xbee_encode_rx;
+
+  node->tx_frames++;
+  if( node->first_tx == 0 ) { node->first_tx = now; }
+  node->last_tx = now;
+
+  if( tx->size > XB_MAX_PAYLOAD ) {
+    _schedule_status(now, index, tx, XB_NW_ADDR_UNKNOWN, 0,
+                     XB_DELIVERY_PAYLOAD_TOO_LARGE);
+    return;
+  }
+
+  rx.address    = node->address;
+  rx.nw_address = node->nw_address;
+  rx.size       = tx->size;
+  rx.data       = tx->data;
+  rx.endpoint   = tx->endpoint;
+
+  // broadcasts are sent once and received (or not) by every other node
+  if( tx->address == XB_BROADCAST ) {
+    uint64_t done = _occupy(now, tx->size) + sim.latency;
+    rx.options = XB_RX_OPT_BROADCAST;
+    xbee_iov_t data[] = {
+      { header, encode(header, &rx) },
+      { tx->data, tx->size }
+    };
+    for(int i=0; i<sim.nodes; i++) {
+      if( i == index ) { continue; }
+      if( _lost() ) { node->lost++; continue; }
+      _schedule(done, i, index, now, data, 2);
+    }
+    _schedule_status(done, index, tx, XB_NW_BROADCAST, 0, XB_DELIVERY_OK);
+    return;
+  }
+
+  int destination = _find(tx->address);
+  if( destination < 0 ) {
+    node->lost++;
+    _schedule_status(now + 2 * sim.latency, index, tx, XB_NW_ADDR_UNKNOWN, 0,
+                     XB_DELIVERY_ADDRESS_NOT_FOUND);
+    return;
+  }
+
+  // unicasts are retried by the MAC until acknowledged
+  uint64_t done    = now;
+  uint8_t  retries = 0;
+  bool     lost;
+  while( (lost = _lost()) && retries < MAC_RETRIES ) {
+    done = _occupy(done, tx->size);
+    retries++;
+  }
+  done = _occupy(done, tx->size) + sim.latency;
+  node->retries += retries;
+
+  if( lost ) {
+    node->lost++;
+    _schedule_status(done, index, tx, XB_NW_ADDR_UNKNOWN, retries,
+                     XB_DELIVERY_MAC_ACK);
+    return;
+  }
+
+  rx.options = XB_RX_OPT_ACK;
+  xbee_iov_t data[] = {
+    { header, encode(header, &rx) },
+    { tx->data, tx->size }
+  };
+  _schedule(done, destination, index, now, data, 2);
+  // the acknowledgement has to travel back
+  _schedule_status(done + sim.latency, index, tx,
+                   nodes[destination].nw_address, retries, XB_DELIVERY_OK);
+}
+
+static int _find(uint64_t address) {
+  if( address == XB_COORDINATOR ) { return 0; }
+  for(int i=0; i<sim.nodes; i++) {
+    if( nodes[i].address == address ) { return i; }
+  }
+  return -1;
+}
+
+// events
+
+static void _schedule(uint64_t time, uint8_t node, uint8_t source,
+                      uint64_t sent, const xbee_iov_t *iov, uint8_t count)
+{
+  if( event_count == event_capacity ) {
+    event_capacity = event_capacity ? event_capacity * 2 : 64;
+    events = realloc(events, event_capacity * sizeof(event_t));
+    if( events == NULL ) { perror("realloc"); exit(EXIT_FAILURE); }
+  }
+  event_t *event = &events[event_count++];
+  event->time   = time;
+  event->sent   = sent;
+  event->node   = node;
+  event->source = source;
+  event->size   = xbee_encode(event->data, sizeof(event->data), iov, count,
+                              FALSE);
+}
+
+static void _schedule_status(uint64_t time, uint8_t node, xbee_tx_t *tx,
+                             uint16_t nw_address, uint8_t retries,
+                             uint8_t delivery)
+{
+  if( tx->id == XB_TX_NO_RESPONSE ) { return; }
+
+  xbee_tx_status_t status = {
+    tx->id, nw_address, retries, delivery,
+    tx->nw_address == XB_NW_ADDR_UNKNOWN && tx->address != XB_BROADCAST
+  };
+  uint8_t    frame[XB_TX_STATUS_SIZE];
+  xbee_iov_t data = { frame, xbee_encode_tx_status(frame, &status) };
+  _schedule(time, node, NO_SOURCE, 0, &data, 1);
+}
+
+// hands all due frames to the XBee of their node, which sends them over the
+// serial line, dropping them when it has too much to send already
+static void _deliver(uint64_t now) {
+  for(int e=0; e<event_count; ) {
+    event_t *event = &events[e];
+    if( event->time > now ) { e++; continue; }
+
+    node_t *node = &nodes[event->node];
+    if( node->uart_free < now ) { node->uart_free = now; }
+    uint64_t backlog = (node->uart_free - now) / byte_time;
+
+    if( node->fd < 0 ) {
+      // gone
+    } else if( backlog + event->size > UART_BACKLOG ||
+               node->out_size + event->size > sizeof(node->out) )
+    {
+      node->uart_drops++;
+    } else {
+      memcpy(&node->out[node->out_size], event->data, event->size);
+      node->out_size  += event->size;
+      node->uart_free += event->size * byte_time;
+      if( event->source != NO_SOURCE ) {
+        node_t  *source  = &nodes[event->source];
+        uint32_t latency = node->uart_free - event->sent;
+        node->rx_frames++;
+        source->latency_total += latency;
+        source->latency_count++;
+        if( latency > source->latency_max ) { source->latency_max = latency; }
+      }
+      _flush(event->node);
+    }
+    *event = events[--event_count];
+  }
+}
+
+static void _flush(int index) {
+  node_t *node = &nodes[index];
+  if( node->fd < 0 || node->out_size == 0 ) { return; }
+
+  ssize_t size = write(node->fd, node->out, node->out_size);
+  if( size <= 0 ) { return; }
+  memmove(node->out, &node->out[size], node->out_size - size);
+  node->out_size -= size;
+}
+
+// reporting
+
+static void _report(void) {
+  printf("\nradio:\n");
+  printf("node address          nw    tx     tx/s     rx   lost retries"
+         " drops latency ms avg/max\n");
+  for(int i=0; i<sim.nodes; i++) {
+    node_t *node = &nodes[i];
+    double  span = (node->last_tx - node->first_tx) / 1000000.0;
+    printf("%4d %016llx %04x %6u %8.1f %6u %6u %7u %5u %9.1f / %.1f\n",
+           i, (unsigned long long)node->address, node->nw_address,
+           node->tx_frames,
+           span > 0 ? (node->tx_frames - 1) / span : 0.0,
+           node->rx_frames, node->lost, node->retries, node->uart_drops,
+           node->latency_count ? node->latency_total / 1000.0
+                                 / node->latency_count : 0.0,
+           node->latency_max / 1000.0);
+  }
+
+  if( sim.ptys == sim.nodes ) { return; }
+
+  printf("\ndriver:\n");
+  printf("node joined ms   sent failed received overflows cksum tx-fail"
+         " retries status ms (median)\n");
+  for(int i=sim.ptys; i<sim.nodes; i++) {
+    node_report_t  *report  = &reports[i];
+    xbee_metrics_t *metrics = &report->metrics;
+    if( ! report->done ) {
+      printf("%4d %s\n", i, report->associated ? "did not finish"
+                                               : "did not join");
+      continue;
+    }
+    uint32_t failed = 0, statuses = 0, median = 0;
+    for(int f=0; f<XB_FAIL_REASONS; f++) { failed += metrics->failures[f]; }
+    for(int b=0; b<XB_METRICS_LATENCY_BUCKETS; b++) {
+      statuses += metrics->latency[b];
+    }
+    // buckets hold latencies of b significant bits, report the upper bound
+    for(uint32_t b=0, count=0; b<XB_METRICS_LATENCY_BUCKETS; b++) {
+      count += metrics->latency[b];
+      if( statuses && count * 2 >= statuses ) {
+        median = (1 << b) - 1;
+        break;
+      }
+    }
+    printf("%4d %9u %6u %6u %8u %9u %5u %7u %7u %s%u\n",
+           i, report->association_time, report->sent, report->failed,
+           report->received, metrics->overflows, metrics->checksum_errors,
+           failed, metrics->retries, statuses ? "<= " : "", median);
+  }
+
+  // the share of the time spent waiting for the serial line to the XBee
+  printf("\nenergy:\n");
+  printf("node active ms xbee-tx ms tx-wait %% health\n");
+  for(int i=sim.ptys; i<sim.nodes; i++) {
+    node_report_t  *report = &reports[i];
+    energy_stats_t *energy = &report->energy;
+    if( ! report->done ) { continue; }
+    uint32_t total = 0;
+    for(int s=0; s<ENERGY_STATES; s++) { total += energy->ms[s]; }
+    printf("%4d %9u %10u %9.1f %6u\n",
+           i, energy->ms[ENERGY_ACTIVE], energy->ms[ENERGY_XBEE_TX],
+           total ? 100.0 * energy->ms[ENERGY_XBEE_TX] / total : 0.0,
+           report->health);
+  }
+
+  if( ! reports[0].sync.synced ) { return; }
+
+  // the error of a clock is relative to the master's, node 0
+  printf("\nsync:\n");
+  printf("node error ms drift ppm (real) samples rejected steps rtt ms"
+         " one-way ms avg/max\n");
+  for(int i=sim.ptys; i<sim.nodes; i++) {
+    node_report_t *report = &reports[i];
+    if( ! report->done ) { continue; }
+    printf("%4d %8.1f %9d %6d %7u %8u %5u %6u %11.1f / %d\n",
+           i, (report->clock_error - reports[0].clock_error) / 1000.0,
+           report->sync.drift, i ? nodes[i].drift - nodes[0].drift : 0,
+           report->sync.samples, report->sync.rejected, report->sync.steps,
+           report->sync.rtt,
+           report->one_way_count ? (double)report->one_way_total
+                                   / report->one_way_count : 0.0,
+           report->one_way_max);
+  }
+}
@@ -0,0 +1,204 @@
+// nodes.c
+// author: Christophe VG <contact@christophe.vg>
+
+// table of the nodes a coordinator receives frames from (see nodes.h)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nodes.h"
+#include "clock.h"
+
+#if NODES_CAPACITY < 1 || NODES_CAPACITY > 127
+#error "NODES_CAPACITY must be between 1 and 127"
+#endif
+
+// the hash table holds indices into the entries and is kept at most half full,
+// so probe sequences stay short
+#define SLOTS (NODES_CAPACITY <=  8 ?  16 : NODES_CAPACITY <= 16 ?  32 : \
+               NODES_CAPACITY <= 32 ?  64 : NODES_CAPACITY <= 64 ? 128 : 256)
+#define MASK  (SLOTS - 1)
+#define NONE  0xFF
+
+#define UNKNOWN_ADDRESS 0xFFFFFFFFFFFFFFFFULL
+
+// forward declarations of "private" functions
+static uint8_t _hash(uint64_t address);
+static uint8_t _find(uint64_t address);
+static void    _unslot(uint8_t slot);
+static void    _unlink(uint8_t index);
+static void    _link(uint8_t index);
+static void    _evict(void);
+
+static nodes_entry_t entries[NODES_CAPACITY];
+static uint8_t       slots[SLOTS];
+static uint8_t       newest, oldest;      // most recently seen order
+static uint8_t       unused;              // list of free entries, by older
+static nodes_stats_t stats;
+
+void nodes_init(void) {
+  memset(slots, NONE, sizeof(slots));
+  newest = oldest = NONE;
+  for(uint8_t i=0; i<NODES_CAPACITY; i++) {
+    entries[i].older = i + 1 < NODES_CAPACITY ? i + 1 : NONE;
+  }
+  unused = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+nodes_entry_t *nodes_update(xbee_rx_t *frame) {
+  if( frame->address == UNKNOWN_ADDRESS ) { return NULL; }
+
+  uint8_t slot = _find(frame->address);
+  uint8_t index;
+
+  if( slots[slot] == NONE ) {
+    if( unused == NONE ) {
+      _evict();
+      slot = _find(frame->address);       // the table was reshuffled
+    }
+    index  = unused;
+    unused = entries[index].older;
+    memset(&entries[index], 0, sizeof(nodes_entry_t));
+    entries[index].address    = frame->address;
+    entries[index].parent     = XB_NW_ADDR_UNKNOWN;
+    entries[index].first_seen = clock_get_millis();
+    slots[slot] = index;
+    stats.count++;
+  } else {
+    index = slots[slot];
+    _unlink(index);
+  }
+  _link(index);
+
+  nodes_entry_t *node = &entries[index];
+  node->nw_address = frame->nw_address;
+  node->last_seen  = clock_get_millis();
+  node->frames++;
+  node->bytes     += frame->size;
+  return node;
+}
+
+nodes_entry_t *nodes_lookup(uint64_t address) {
+  uint8_t index = slots[_find(address)];
+  return index == NONE ? NULL : &entries[index];
+}
+
+void nodes_set_parent(uint64_t address, uint16_t parent) {
+  nodes_entry_t *node = nodes_lookup(address);
+  if( node != NULL ) { node->parent = parent; }
+}
+
+uint8_t nodes_sequence(nodes_entry_t *node, uint8_t sequence) {
+  if( ! node->sequenced ) {
+    node->sequenced = TRUE;
+    node->sequence  = sequence;
+    return 0;
+  }
+  uint8_t gap = sequence - node->sequence - 1;
+  // the same or an earlier one (half the sequence space back) was repeated
+  if( sequence == node->sequence || gap >= 0x80 ) {
+    node->duplicates++;
+    return 0;
+  }
+  node->lost    += gap;
+  node->sequence = sequence;
+  return gap;
+}
+
+void nodes_remove(uint64_t address) {
+  uint8_t slot  = _find(address);
+  uint8_t index = slots[slot];
+  if( index == NONE ) { return; }
+
+  _unslot(slot);
+  _unlink(index);
+  entries[index].older = unused;
+  unused = index;
+  stats.count--;
+}
+
+nodes_entry_t *nodes_next(nodes_entry_t *node) {
+  uint8_t index = node == NULL ? newest : node->older;
+  return index == NONE ? NULL : &entries[index];
+}
+
+nodes_stats_t nodes_get_stats(void) {
+  return stats;
+}
+
+void nodes_dump(void) {
+  time_t now = clock_get_millis();
+
+  printf("address          nw   parent  seen ms   frames    bytes   lost"
+         " dups\n");
+  for(nodes_entry_t *node = nodes_next(NULL); node; node = nodes_next(node)) {
+    printf("%08lx%08lx %04x %04x %9lu %8lu %8lu %6lu %4lu\n",
+           (unsigned long)(node->address >> 32),
+           (unsigned long)(node->address & 0xFFFFFFFF),
+           node->nw_address, node->parent,
+           (unsigned long)(now - node->last_seen),
+           (unsigned long)node->frames, (unsigned long)node->bytes,
+           (unsigned long)node->lost, (unsigned long)node->duplicates);
+  }
+  printf("%u nodes, %lu evicted\n", stats.count,
+         (unsigned long)stats.evictions);
+}
+
+// the low 32 bits of XBee addresses differ most, fold in the high ones anyway
+// and take the best mixed, high bits of a multiplicative hash
+static uint8_t _hash(uint64_t address) {
+  uint32_t hash = (uint32_t)address ^ (uint32_t)(address >> 32);
+  return (hash * 2654435761UL) >> 24;
+}
+
+// returns the slot of address, or the empty slot where it belongs
+static uint8_t _find(uint64_t address) {
+  uint8_t slot = _hash(address) & MASK;
+  while( slots[slot] != NONE && entries[slots[slot]].address != address ) {
+    slot = (slot + 1) & MASK;
+  }
+  return slot;
+}
+
+// empties a slot, shifting back entries that probed past it, so lookups never
+// stop at the hole (linear probing without tombstones)
+static void _unslot(uint8_t slot) {
+  uint8_t next = slot;
+  for(;;) {
+    next = (next + 1) & MASK;
+    if( slots[next] == NONE ) { break; }
+    uint8_t home = _hash(entries[slots[next]].address) & MASK;
+    // entries whose home lies cyclically in (slot, next] stay put
+    if( slot <= next ? ( slot < home && home <= next )
+                     : ( slot < home || home <= next ) )
+    {
+      continue;
+    }
+    slots[slot] = slots[next];
+    slot = next;
+  }
+  slots[slot] = NONE;
+}
+
+static void _unlink(uint8_t index) {
+  nodes_entry_t *node = &entries[index];
+  if( node->newer == NONE ) { newest = node->older; }
+  else                      { entries[node->newer].older = node->older; }
+  if( node->older == NONE ) { oldest = node->newer; }
+  else                      { entries[node->older].newer = node->newer; }
+}
+
+// makes an entry the most recently seen one
+static void _link(uint8_t index) {
+  entries[index].newer = NONE;
+  entries[index].older = newest;
+  if( newest != NONE ) { entries[newest].newer = index; }
+  newest = index;
+  if( oldest == NONE ) { oldest = index; }
+}
+
+static void _evict(void) {
+  nodes_remove(entries[oldest].address);
+  stats.evictions++;
+}
@@ -0,0 +1,73 @@
+// nodes.h
+// author: Christophe VG <contact@christophe.vg>
+
+// table of the nodes a coordinator receives frames from
+// a fixed number of entries, found in O(1) through an open addressing hash on
+// their 64-bit address. when the table is full, the least recently seen node
+// is evicted. each entry tracks when the node was last seen, how much it sent,
+// its nw address and parent, and gaps in the sequence numbers of its frames.
+
+#ifndef __NODES_H
+#define __NODES_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "xbee_codec.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+// number of nodes, at most 127. on AVR an entry takes 40 bytes, plus 2 to 4
+// bytes of hash slots, so 16 nodes take 672 bytes of RAM, 32 nodes 1344 bytes.
+#ifndef NODES_CAPACITY
+#define NODES_CAPACITY 16
+#endif
+
+typedef struct {
+  uint64_t address;
+  uint16_t nw_address;            // as last received
+  uint16_t parent;                // XB_NW_ADDR_UNKNOWN until set
+  uint32_t first_seen;            // ms
+  uint32_t last_seen;             // ms
+  uint32_t frames;
+  uint32_t bytes;                 // payload
+  // see nodes_sequence()
+  bool     sequenced;
+  uint8_t  sequence;              // last one
+  uint32_t lost;                  // frames missing from the sequence
+  uint32_t duplicates;            // repeated or out of order frames
+  // most recently seen order, internal
+  uint8_t  newer, older;
+} nodes_entry_t;
+
+typedef struct {
+  uint8_t  count;
+  uint32_t evictions;
+} nodes_stats_t;
+
+void nodes_init(void);
+
+// accounts a received frame to its sender, adding it to the table if needed
+// returns the sender's entry, NULL for frames without a valid address
+nodes_entry_t *nodes_update(xbee_rx_t *frame);
+
+// returns the entry of a node, NULL if it isn't in the table
+nodes_entry_t *nodes_lookup(uint64_t address);
+
+void nodes_set_parent(uint64_t address, uint16_t parent);
+
+// accounts a sequence number, taken from the payload of the last frame of the
+// node, returns the number of frames that were lost before it
+uint8_t nodes_sequence(nodes_entry_t *node, uint8_t sequence);
+
+void nodes_remove(uint64_t address);
+
+// iterates the nodes from most to least recently seen, start with NULL
+nodes_entry_t *nodes_next(nodes_entry_t *node);
+
+nodes_stats_t nodes_get_stats(void);
+
+// prints the table to stdout, e.g. a serial console
+void nodes_dump(void);
+
+#endif
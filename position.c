@@ -0,0 +1,216 @@
+// position.c
+// author: Christophe VG <contact@christophe.vg>
+
+// compact position reports (see position.h)
+
+#include <string.h>
+
+#include "position.h"
+
+// forward declarations of "private" functions
+static int32_t  _to_micro_degrees(uint8_t deg, float min, bool negative);
+static uint8_t  _put_uint32(uint8_t *buffer, uint32_t value);
+static uint32_t _get_uint32(const uint8_t *buffer);
+static uint8_t  _put_varint(uint8_t *buffer, uint32_t value);
+static uint8_t  _get_varint(const uint8_t *buffer, uint8_t size,
+                            uint32_t *value);
+
+// zigzag encoding maps small negative and positive numbers to small numbers
+// 0 -> 0, -1 -> 1, 1 -> 2, -2 -> 3,...
+
+static uint32_t _zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t _unzigzag(uint32_t value) {
+  return (int32_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+bool position_from_nmea(nmea_position *nmea, position_t *position) {
+  if( ( nmea->lattitude.ns != 'N' && nmea->lattitude.ns != 'S' ) ||
+      ( nmea->longitude.ew != 'E' && nmea->longitude.ew != 'W' ) )
+  {
+    return FALSE;
+  }
+
+  position->time = ( (uint32_t)nmea->time.hour * 60 + nmea->time.min ) * 60000
+                 + (uint32_t)(nmea->time.sec * 1000 + 0.5);
+  position->latitude  = _to_micro_degrees(nmea->lattitude.deg,
+                                          nmea->lattitude.min,
+                                          nmea->lattitude.ns == 'S');
+  position->longitude = _to_micro_degrees(nmea->longitude.deg,
+                                          nmea->longitude.min,
+                                          nmea->longitude.ew == 'W');
+  return TRUE;
+}
+
+// minutes are < 60, so min * 16666.67 keeps enough precision in a float
+static int32_t _to_micro_degrees(uint8_t deg, float min, bool negative) {
+  int32_t value = (int32_t)deg * 1000000
+                + (int32_t)(min * (1000000.0 / 60) + 0.5);
+  return negative ? -value : value;
+}
+
+// encoding
+
+void position_encoder_init(position_encoder_t *encoder) {
+  memset(encoder, 0, sizeof(position_encoder_t));
+  encoder->force = TRUE;
+}
+
+void position_keyframe(position_encoder_t *encoder) {
+  encoder->force = TRUE;
+}
+
+uint8_t position_encode(position_encoder_t *encoder, position_t *position,
+                        uint8_t *buffer)
+{
+  uint8_t size = POSITION_HEADER_SIZE;
+
+  buffer[0] = POSITION_MSG_REPORT;
+  buffer[1] = ++encoder->sequence;
+  buffer[2] = 0;
+
+  if( ! encoder->force &&
+      ( POSITION_KEYFRAME_INTERVAL == 0 ||
+        encoder->reports < POSITION_KEYFRAME_INTERVAL ) )
+  {
+    // the time wraps at midnight, so its delta is always positive
+    uint8_t  deltas[15];
+    uint8_t  used = 0;
+    uint32_t time = ( position->time + POSITION_DAY - encoder->last.time )
+                    % POSITION_DAY;
+    if( time == encoder->interval ) {
+      buffer[2] |= POSITION_INTERVAL;   // fixed rate, omit the time delta
+    } else {
+      used += _put_varint(&deltas[used], time);
+    }
+    used += _put_varint(&deltas[used],
+                        _zigzag(position->latitude - encoder->last.latitude));
+    used += _put_varint(&deltas[used],
+                        _zigzag(position->longitude - encoder->last.longitude));
+    // (huge) deltas that don't save any space are sent as a keyframe
+    if( used < POSITION_MAX_SIZE - POSITION_HEADER_SIZE ) {
+      memcpy(&buffer[size], deltas, used);
+      size += used;
+      encoder->reports++;
+      encoder->interval = time;
+    }
+  }
+
+  // first report, asked for, periodic or replacing huge deltas
+  if( size == POSITION_HEADER_SIZE ) {
+    buffer[2] = POSITION_KEYFRAME;
+    encoder->interval = 0;
+    size += _put_uint32(&buffer[size], position->time);
+    size += _put_uint32(&buffer[size], (uint32_t)position->latitude);
+    size += _put_uint32(&buffer[size], (uint32_t)position->longitude);
+    encoder->reports = 0;
+    encoder->force   = FALSE;
+  }
+
+  encoder->last = *position;
+  return size;
+}
+
+// decoding
+
+void position_decoder_init(position_decoder_t *decoder) {
+  memset(decoder, 0, sizeof(position_decoder_t));
+}
+
+position_result_t position_decode(position_decoder_t *decoder,
+                                  const uint8_t *data, uint8_t size,
+                                  position_t *position)
+{
+  if( size < POSITION_HEADER_SIZE || data[0] != POSITION_MSG_REPORT ) {
+    return POSITION_INVALID;
+  }
+
+  uint8_t sequence = data[1];
+
+  if( decoder->synced && sequence == decoder->sequence ) {
+    return POSITION_DUPLICATE;
+  }
+
+  if( data[2] & POSITION_KEYFRAME ) {
+    if( size < POSITION_MAX_SIZE ) { return POSITION_INVALID; }
+    decoder->last.time      = _get_uint32(&data[3]);
+    decoder->last.latitude  = (int32_t)_get_uint32(&data[7]);
+    decoder->last.longitude = (int32_t)_get_uint32(&data[11]);
+    decoder->interval       = 0;
+  } else {
+    if( ! decoder->synced || sequence != (uint8_t)(decoder->sequence + 1) ) {
+      decoder->synced = FALSE;
+      return POSITION_LOST;
+    }
+    uint32_t time, latitude, longitude;
+    uint8_t  offset = POSITION_HEADER_SIZE, used;
+    if( data[2] & POSITION_INTERVAL ) {
+      time = decoder->interval;
+    } else {
+      if( ! (used = _get_varint(&data[offset], size - offset, &time)) ) {
+        goto invalid;
+      }
+      offset += used;
+    }
+    if( ! (used = _get_varint(&data[offset], size - offset, &latitude)) ) {
+      goto invalid;
+    }
+    offset += used;
+    if( ! _get_varint(&data[offset], size - offset, &longitude) ) {
+      goto invalid;
+    }
+    decoder->interval        = time;
+    decoder->last.time       = ( decoder->last.time + time ) % POSITION_DAY;
+    decoder->last.latitude  += _unzigzag(latitude);
+    decoder->last.longitude += _unzigzag(longitude);
+  }
+
+  decoder->synced   = TRUE;
+  decoder->sequence = sequence;
+  *position = decoder->last;
+  return POSITION_OK;
+
+invalid:
+  // the deltas of the next report can't be applied either
+  decoder->synced = FALSE;
+  return POSITION_INVALID;
+}
+
+// big endian, like all multi-byte fields in XBee frames
+static uint8_t _put_uint32(uint8_t *buffer, uint32_t value) {
+  buffer[0] = value >> 24;
+  buffer[1] = value >> 16;
+  buffer[2] = value >>  8;
+  buffer[3] = value;
+  return 4;
+}
+
+static uint32_t _get_uint32(const uint8_t *buffer) {
+  return (uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 |
+         (uint32_t)buffer[2] <<  8 | buffer[3];
+}
+
+// 7 bits per byte, least significant first, the high bit marks continuation
+static uint8_t _put_varint(uint8_t *buffer, uint32_t value) {
+  uint8_t size = 0;
+  while( value > 0x7F ) {
+    buffer[size++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  buffer[size++] = value;
+  return size;
+}
+
+// returns the number of bytes used, 0 if the varint is incomplete
+static uint8_t _get_varint(const uint8_t *buffer, uint8_t size,
+                           uint32_t *value)
+{
+  *value = 0;
+  for(uint8_t i=0; i<size && i<5; i++) {
+    *value |= (uint32_t)(buffer[i] & 0x7F) << (7 * i);
+    if( ! (buffer[i] & 0x80) ) { return i + 1; }
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+// position.h
+// author: Christophe VG <contact@christophe.vg>
+
+// compact position reports, to send GPS fixes over XBee
+// a keyframe carries the complete fix, as integer micro-degrees and the time
+// of day in ms. all other reports only carry the differences to the previous
+// fix, as zigzag varints: a few bytes instead of a 19 byte nmea_position.
+// at a fixed rate, the time delta is omitted when it equals the previous one.
+// a sequence number allows receivers to detect lost reports and request a
+// keyframe. this is plain C, so reports can be decoded on a host too.
+
+#ifndef __POSITION_H
+#define __POSITION_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "nmea.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef POSITION_KEYFRAME_INTERVAL  // reports between keyframes, 0 = never
+#define POSITION_KEYFRAME_INTERVAL 25
+#endif
+
+// message types, the first payload byte of every position frame
+
+#ifndef POSITION_MSG_REPORT
+#define POSITION_MSG_REPORT  0xC0 // [type][sequence][flags][fix or deltas]
+#endif
+#ifndef POSITION_MSG_REQUEST
+#define POSITION_MSG_REQUEST 0xC1 // [type], asks the sender for a keyframe
+#endif
+
+#define POSITION_KEYFRAME    0x01 // flag: report contains the complete fix
+#define POSITION_INTERVAL    0x02 // flag: time delta equals the previous one
+
+#define POSITION_HEADER_SIZE 3
+#define POSITION_MAX_SIZE    (POSITION_HEADER_SIZE + 12)
+
+#define POSITION_DAY         86400000UL   // ms
+
+// a fix, latitude and longitude in micro-degrees, negative = south/west
+typedef struct {
+  uint32_t time;            // ms since midnight UTC
+  int32_t  latitude;
+  int32_t  longitude;
+} position_t;
+
+// converts a parsed NMEA position, returns FALSE if it contains no fix
+bool position_from_nmea(nmea_position *nmea, position_t *position);
+
+typedef struct {
+  uint8_t    sequence;
+  uint8_t    reports;       // since the last keyframe
+  bool       force;         // next report must be a keyframe
+  uint32_t   interval;      // ms between the last two reports
+  position_t last;
+} position_encoder_t;
+
+void position_encoder_init(position_encoder_t *encoder);
+
+// encodes a report of the fix in buffer (at least POSITION_MAX_SIZE bytes),
+// returns its size
+uint8_t position_encode(position_encoder_t *encoder, position_t *position,
+                        uint8_t *buffer);
+
+// makes the next report a keyframe, e.g. on a POSITION_MSG_REQUEST
+void position_keyframe(position_encoder_t *encoder);
+
+// decoding, one decoder per sender
+
+typedef enum {
+  POSITION_OK,
+  POSITION_DUPLICATE,       // already decoded, ignore
+  POSITION_LOST,            // reports were lost, request a keyframe
+  POSITION_INVALID          // not a (complete) position report
+} position_result_t;
+
+typedef struct {
+  bool       synced;        // a keyframe was received and no report lost
+  uint8_t    sequence;
+  uint32_t   interval;
+  position_t last;
+} position_decoder_t;
+
+void position_decoder_init(position_decoder_t *decoder);
+
+position_result_t position_decode(position_decoder_t *decoder,
+                                  const uint8_t *data, uint8_t size,
+                                  position_t *position);
+
+#endif
@@ -0,0 +1,85 @@
+// profile.c
+// author: Christophe VG <contact@christophe.vg>
+
+// profiling of interrupt service routines (see profile.h)
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/atomic.h>
+
+#include "profile.h"
+#include "energy.h"
+
+#if PROFILE_ISR
+
+static const char *names[PROFILE_VECTORS] = {
+  "clock", "alarm", "wdt", "xbee rx", "xbee tx", "gps rx", "wifi rx", "wifi tx",
+  "adc"
+};
+
+static volatile profile_stats_t stats[PROFILE_VECTORS];
+static volatile uint16_t        max_latency;
+
+// called from ISRs, with interrupts disabled
+void profile_account(profile_vector_t vector, uint32_t entered) {
+  volatile profile_stats_t *s = &stats[vector];
+  uint32_t us = clock_get_micros() - entered;
+
+  uint8_t bucket = 0;
+  for(uint32_t v=us; v && bucket<PROFILE_BUCKETS-1; v >>= 1) { bucket++; }
+  if( s->histogram[bucket] < 0xFFFF ) { s->histogram[bucket]++; }
+
+  energy_interrupted(us);
+
+  if( us > 0xFFFF ) { us = 0xFFFF; }
+  if( us > s->max ) { s->max = us; }
+  s->total += us;
+  s->count++;
+}
+
+void profile_latency(uint16_t us) {
+  if( us > max_latency ) { max_latency = us; }
+}
+
+profile_stats_t profile_get_stats(profile_vector_t vector) {
+  profile_stats_t copy;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memcpy(&copy, (const void *)&stats[vector], sizeof(copy));
+  }
+  return copy;
+}
+
+uint16_t profile_get_max_latency(void) {
+  uint16_t latency;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    latency = max_latency;
+  }
+  return latency;
+}
+
+void profile_reset(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memset((void *)stats, 0, sizeof(stats));
+    max_latency = 0;
+  }
+}
+
+void profile_dump(void) {
+  printf("vector      count  avg us  max us  histogram"
+         " (0, 1, 2-3, 4-7,... us)\n");
+  for(uint8_t v=0; v<PROFILE_VECTORS; v++) {
+    profile_stats_t s = profile_get_stats(v);
+    if( s.count == 0 ) { continue; }
+    printf("%-7s %9lu %7lu %7u ", names[v], (unsigned long)s.count,
+           (unsigned long)(s.total / s.count), s.max);
+    for(uint8_t b=0; b<PROFILE_BUCKETS; b++) {
+      printf(" %u", s.histogram[b]);
+    }
+    printf("\n");
+  }
+  printf("longest window without interrupts: %u us\n",
+         profile_get_max_latency());
+}
+
+#endif
@@ -0,0 +1,87 @@
+// profile.h
+// author: Christophe VG <contact@christophe.vg>
+
+// profiling of interrupt service routines
+// PROFILE_ENTER() and PROFILE_LEAVE() around the body of an ISR time it with
+// clock_get_micros(), which reads the running timer. per vector, the number
+// of interrupts, the total and longest time, and a histogram of the times are
+// kept.
+// the clock also reports the latency of its own interrupt: the timer value
+// when the ISR starts, i.e. how long ago the timer matched. it is late when
+// interrupts were disabled or another ISR ran, so its maximum is the longest
+// window without interrupts that was seen, sampled every ms (every overflow
+// in tickless mode). a byte arrives every 87us at 115200 baud, so an ISR or
+// window longer than that drops bytes.
+// with ENERGY_ACCOUNTING, the time of the ISRs is also accounted to ENERGY_ISR
+// (see energy.h).
+// without PROFILE_ISR, the macros compile to nothing.
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "clock.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef PROFILE_ISR
+#define PROFILE_ISR 0
+#endif
+
+typedef enum {
+  PROFILE_CLOCK,                  // the ms tick or overflow
+  PROFILE_CLOCK_ALARM,
+  PROFILE_WDT,
+  PROFILE_XBEE_RX,
+  PROFILE_XBEE_TX,
+  PROFILE_GPS_RX,
+  PROFILE_WIFI_RX,
+  PROFILE_WIFI_TX,
+  PROFILE_ADC,
+  PROFILE_VECTORS
+} profile_vector_t;
+
+// bucket i counts times of i significant bits (in us), i.e. 0, 1, 2-3, 4-7,...
+// the last bucket also holds everything beyond
+#define PROFILE_BUCKETS 9
+
+typedef struct {
+  uint32_t count;
+  uint32_t total;                 // us
+  uint16_t max;                   // us
+  uint16_t histogram[PROFILE_BUCKETS];   // saturate
+} profile_stats_t;
+
+#if PROFILE_ISR
+
+#define PROFILE_ENTER()       uint32_t _profile_entered = clock_get_micros()
+#define PROFILE_LEAVE(vector) profile_account(vector, _profile_entered)
+#define PROFILE_LATENCY(us)   profile_latency(us)
+
+// accounts an ISR that started at the given time, up to now
+void profile_account(profile_vector_t vector, uint32_t entered);
+
+// accounts the latency of the clock interrupt
+void profile_latency(uint16_t us);
+
+profile_stats_t profile_get_stats(profile_vector_t vector);
+
+// the longest latency of the clock interrupt, in us
+uint16_t profile_get_max_latency(void);
+
+void profile_reset(void);
+
+// prints the stats of all vectors to stdout, e.g. a serial console
+void profile_dump(void);
+
+#else
+
+#define PROFILE_ENTER()
+#define PROFILE_LEAVE(vector)
+#define PROFILE_LATENCY(us)
+
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+// sched.c
+// author: Christophe VG <contact@christophe.vg>
+
+// a cooperative, run-to-completion scheduler (see sched.h)
+
+#include <stddef.h>
+#include <string.h>
+#include <util/atomic.h>
+
+#include "sched.h"
+#include "clock.h"
+#include "sleep.h"
+
+// longest sleep without a timer to wake up for, in ms
+#define FOREVER 0x7FFFFFFFUL
+
+// forward declarations of "private" functions
+static void          _expired(void *data);
+static sched_task_t *_next(void);
+static void          _idle(void);
+static uint8_t       _guard(void);
+
+// ordered by priority
+static sched_task_t *tasks[SCHED_MAX_TASKS];
+static uint8_t       count;
+
+static volatile uint8_t  signalled;           // events not yet taken by tasks
+static volatile uint32_t signalled_at;        // us
+static sched_stats_t     stats;
+static bool              guarded;             // _guard() was added
+
+void sched_init(void) {
+  count     = 0;
+  signalled = 0;
+  stats     = (sched_stats_t){ 0 };
+  if( ! guarded ) { guarded = sleep_guard(_guard); }
+}
+
+bool sched_add(sched_task_t *task, sched_state_t (*run)(sched_task_t *task),
+               uint8_t events, uint8_t priority)
+{
+  if( count == SCHED_MAX_TASKS ) { return FALSE; }
+
+  task->run      = run;
+  task->events   = events;
+  task->priority = priority;
+  task->lc       = 0;
+  task->pending  = 0;
+  task->ready    = TRUE;
+  // the task is new, so is its timer
+  memset(&task->timer, 0, sizeof(task->timer));
+  timer_setup(&task->timer, _expired, task, 0);
+
+  // after the tasks with the same priority, they take turns
+  uint8_t i = count++;
+  for(; i > 0 && tasks[i-1]->priority > priority; i--) {
+    tasks[i] = tasks[i-1];
+  }
+  tasks[i] = task;
+  return TRUE;
+}
+
+void sched_remove(sched_task_t *task) {
+  timer_cancel(&task->timer);
+  for(uint8_t i=0; i<count; i++) {
+    if( tasks[i] != task ) { continue; }
+    count--;
+    for(; i<count; i++) { tasks[i] = tasks[i+1]; }
+    return;
+  }
+}
+
+void sched_signal(uint8_t events) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if( ! signalled ) { signalled_at = clock_get_micros(); }
+    signalled |= events;
+  }
+}
+
+bool sched_step(void) {
+  sched_task_t *task = _next();
+  if( task == NULL ) { return FALSE; }
+
+  uint32_t start = clock_get_micros();
+  if( task->pending && start - task->since > stats.max_latency ) {
+    stats.max_latency = start - task->since;
+  }
+  task->pending = 0;
+  task->ready   = FALSE;
+
+  switch( task->run(task) ) {
+    case SCHED_WAITING : break;
+    case SCHED_YIELDED : task->ready = TRUE; break;
+    case SCHED_EXITED  : sched_remove(task); break;
+  }
+
+  uint32_t run = clock_get_micros() - start;
+  if( run > stats.max_run ) { stats.max_run = run; }
+  stats.runs++;
+  return TRUE;
+}
+
+void sched_run(void) {
+  for(;;) {
+    timer_process();
+    if( ! sched_step() ) { _idle(); }
+  }
+}
+
+sched_stats_t sched_get_stats(void) {
+  return stats;
+}
+
+static void _expired(void *data) {
+  ((sched_task_t *)data)->ready = TRUE;
+}
+
+// hands out the signalled events to the tasks that wait for them, and returns
+// the first one, by priority, that can run
+static sched_task_t *_next(void) {
+  uint8_t  events;
+  uint32_t since;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    events    = signalled;
+    since     = signalled_at;
+    signalled = 0;
+  }
+
+  sched_task_t *next = NULL;
+  for(uint8_t i=0; i<count; i++) {
+    sched_task_t *task = tasks[i];
+    if( events & task->events ) {
+      if( ! task->pending ) { task->since = since; }
+      task->pending |= events & task->events;
+    }
+    if( next == NULL && ( task->pending || task->ready ) ) { next = task; }
+  }
+
+  // let the others with the same priority go first next time
+  if( next ) {
+    uint8_t i = 0;
+    while( tasks[i] != next ) { i++; }
+    for(; i+1 < count && tasks[i+1]->priority == next->priority; i++) {
+      tasks[i] = tasks[i+1];
+    }
+    tasks[i] = next;
+  }
+  return next;
+}
+
+// sleeps as deep as the guards of the drivers allow, until the next deadline
+// of a timer, or until an interrupt signals an event
+static void _idle(void) {
+  time_t   deadline;
+  uint32_t ms = FOREVER;
+  if( timer_next_deadline(&deadline) ) {
+    int32_t left = deadline - clock_get_millis();
+    ms = left > 0 ? left : 0;
+  }
+  stats.sleeps++;
+  sleep_idle(ms);
+}
+
+// sleep_idle() asks the guards with interrupts disabled, so an event that is
+// signalled right before sleeping, keeps the CPU awake
+static uint8_t _guard(void) {
+  return signalled ? SLEEP_BUSY : SLEEP_DEEP;
+}
@@ -0,0 +1,122 @@
+// sched.h
+// author: Christophe VG <contact@christophe.vg>
+
+// a cooperative, run-to-completion scheduler
+// tasks run when an event they wait for is signalled, e.g. from an interrupt,
+// or when they asked to run again. of the tasks that can run, the one with the
+// highest priority runs first, so the latency to react to an event is bounded
+// by the longest running task. when no task can run, the CPU sleeps, as deep
+// as the guards of the drivers allow (see sleep.h), until the next deadline of
+// a timer or until an interrupt signals an event. sched_init() adds the guard
+// of the scheduler itself, those of the drivers are added by the application,
+// e.g. sleep_guard(xbee_sleep_guard).
+// tasks are protothreads: a function that returns when it has to wait, and
+// continues where it left off the next time it runs, without a stack of its
+// own. local variables don't survive waiting, keep state in static variables
+// or in a struct around the task.
+//
+// the drivers signal received bytes when built with XBEE_SCHED and GPS_SCHED
+// (MORE_CDEFS), so a task can wait for SCHED_XBEE and call xbee_receive().
+// with ADC_SCHED, the ADC scanner signals every new sample.
+
+#ifndef __SCHED_H
+#define __SCHED_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "timer.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS 8
+#endif
+
+// events, one bit each, the rest are free for applications
+#define SCHED_XBEE  0x01
+#define SCHED_GPS   0x02
+#define SCHED_ADC   0x04
+
+// what a task returns
+typedef enum {
+  SCHED_WAITING,                  // until an event or a timer, see SCHED_WAIT_*
+  SCHED_YIELDED,                  // run again, after the tasks that can run
+  SCHED_EXITED                    // done, the task is removed
+} sched_state_t;
+
+typedef struct sched_task {
+  sched_state_t (*run)(struct sched_task *task);
+  uint8_t        events;          // that make the task run
+  uint8_t        priority;        // 0 = highest
+  // internal
+  uint16_t       lc;              // where the protothread continues
+  uint8_t        pending;         // events signalled since it last ran
+  bool           ready;
+  uint32_t       since;           // us, when its pending events were signalled
+  timer_entry_t  timer;           // for SCHED_WAIT_MS
+} sched_task_t;
+
+typedef struct {
+  uint32_t runs;
+  uint32_t sleeps;
+  uint32_t max_latency;           // us, from signalling an event to handling it
+  uint32_t max_run;               // us, longest run of a task
+} sched_stats_t;
+
+void sched_init(void);
+
+// adds a task, that runs at least once, returns FALSE if there is no room
+bool sched_add(sched_task_t *task, sched_state_t (*run)(sched_task_t *task),
+               uint8_t events, uint8_t priority);
+
+void sched_remove(sched_task_t *task);
+
+// signals events, also from an interrupt
+void sched_signal(uint8_t events);
+
+// runs the task with the highest priority that can run, returns FALSE if there
+// was none
+bool sched_step(void);
+
+// runs tasks and timers (see timer.h) forever, sleeping in between
+void sched_run(void);
+
+sched_stats_t sched_get_stats(void);
+
+// protothread statements, for use in the run function of a task
+
+#define SCHED_BEGIN(task)         switch( (task)->lc ) { case 0:
+
+// waits until cond holds, it is checked each time the task runs
+#define SCHED_WAIT_UNTIL(task, cond)                                     \
+  do {                                                                   \
+    (task)->lc = __LINE__; case __LINE__:                                \
+    if( ! (cond) ) { return SCHED_WAITING; }                             \
+  } while(0)
+
+// waits until one of the events of the task is signalled
+#define SCHED_WAIT_EVENT(task)                                           \
+  do {                                                                   \
+    (task)->lc = __LINE__; return SCHED_WAITING; case __LINE__: ;        \
+  } while(0)
+
+#define SCHED_WAIT_MS(task, ms)                                          \
+  do {                                                                   \
+    timer_start(&(task)->timer, (ms), 0);                                \
+    SCHED_WAIT_UNTIL(task, ! timer_is_active(&(task)->timer));           \
+  } while(0)
+
+// lets other tasks run first
+#define SCHED_YIELD(task)                                                \
+  do {                                                                   \
+    (task)->lc = __LINE__; return SCHED_YIELDED; case __LINE__: ;        \
+  } while(0)
+
+// starts over when the task runs again
+#define SCHED_RESTART(task)                                              \
+  do { (task)->lc = 0; return SCHED_YIELDED; } while(0)
+
+#define SCHED_END(task)           } (task)->lc = 0; return SCHED_EXITED
+
+#endif
@@ -1,4 +1,4 @@
-// avr.c
+// sleep.c
 // author: Christophe VG <contact@christophe.vg>
 
 // support for sleeping
@@ -11,93 +11,246 @@
 #include <avr/interrupt.h>
 
 #include <util/delay.h>
+#include <util/atomic.h>
 
+#include "bool.h"
 #include "clock.h"
+#include "energy.h"
+#include "profile.h"
 
 #include "sleep.h"
 
+#define STEPS       10              // 16ms << 0 ... 16ms << 9 = 8s
+#define NOMINAL     16000UL         // us, of the shortest step at 128kHz
+#define CALIBRATION 2               // step used to calibrate (64ms)
+
+// forward declarations of "private" functions
+static void    _sleep_until(time_t until, uint8_t mode);
+static uint8_t _level(void);
+#if ! CLOCK_RTC
+static void    _watchdog(uint8_t step);
+static void    _power_down(uint8_t step);
+
+static uint32_t        period = NOMINAL;  // us, of the shortest step, measured
+static uint16_t        carry;             // us, slept but not yet credited
+static volatile bool   woken;
+#endif
+
+static sleep_guard_t guards[SLEEP_MAX_GUARDS];
+static uint8_t       guard_count;
+
+#if CLOCK_RTC
+
+// the clock keeps running in power-save mode, and its alarm wakes us up
+void sleep_init(void) {
+  // turn on interrupts
+  sei();
+}
+
+void sleep_ms(long ms)  {
+  time_t until = clock_get_millis() + ms;
+
+  // to avoid garbage (e.g. on serial)
+  _delay_ms(10);
+
+  // disable ADC
+  uint8_t adc = ADCSRA;
+  ADCSRA = 0;
+
+  energy_state_t state = energy_switch(ENERGY_POWER_DOWN);
+  _sleep_until(until, SLEEP_MODE_PWR_SAVE);
+  energy_switch(state);
+
+  ADCSRA = adc;
+}
+
+#else
+
 // watchdog interrupt
 ISR (WDT_vect) {
+  PROFILE_ENTER();
   wdt_disable();  // disable watchdog
+  woken = TRUE;
+  PROFILE_LEAVE(PROFILE_WDT);
 }
 
+// the watchdog oscillator runs at 128kHz, give or take 10%, so time one of
+// its intervals against the clock
 void sleep_init(void) {
   // turn on interrupts
   sei();
+
+  woken = FALSE;
+  _watchdog(CALIBRATION);
+  uint32_t start = clock_get_micros();
+  while( ! woken );
+  uint32_t measured = (clock_get_micros() - start) >> CALIBRATION;
+
+  // without a running clock, keep the nominal period
+  if( measured > NOMINAL / 2 && measured < NOMINAL * 2 ) { period = measured; }
 }
 
-void sleep_ms(long sleep)  {
-  // TODO: dynamically changing the watchdog's time-out doesn't seem to work
-  //       for now only 1 second resolution ;-)
-  long step,
-       ms = sleep;
-  
+void sleep_ms(long ms)  {
+  time_t until = clock_get_millis() + ms;
+
   // to avoid garbage (e.g. on serial)
   _delay_ms(10);
-  
+
   // disable ADC
-  ADCSRA = 0;  
+  uint8_t adc = ADCSRA;
+  ADCSRA = 0;
 
-  while(ms > 0) {
-    // clear various "reset" flags
-    MCUSR = 0;     
-    // allow changes, disable reset
-    WDTCSR = _BV (WDCE) | _BV (WDE);
-
-    // set interrupt mode and an interval 
-    // set WDIE and delay of ...
-    /*
-    if( ms > 8000 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP3) | _BV (WDP0);              // 8 seconds
-      step = 8000;
-    } else if( ms > 4000 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP3);                           // 4 seconds
-      step = 4000;
-    } else if( ms > 2000 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP2) | _BV (WDP1) | _BV (WDP0); // 2 seconds
-      step = 2000;
-    } else if( ms > 1000 ) { */
-      WDTCSR = _BV (WDIE) | _BV (WDP2) | _BV (WDP1);              // 1 second
-      step = 1000;
-    /*
-    } else if( ms > 500 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP2) | _BV (WDP0);              // 1/2 second
-      step = 500;
-    } else if( ms > 250 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP2);                           // 1/4 second
-      step = 250;
-    } else if( ms > 125 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP1) | _BV (WDP0);              // 1/8 second
-      step = 125;
-    } else if( ms > 64 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP1);                           // 1/16 second
-      step = 64;
-    } else if( ms > 32 ) {
-      WDTCSR = _BV (WDIE) | _BV (WDP0);                           // 1/32 second
-      step = 32;
-    } else  {
-      WDTCSR = _BV (WDIE);                                        // 1/64 second
-      step = 16;
+  // power down as long as possible, taking the longest steps first
+  energy_state_t state = energy_switch(ENERGY_POWER_DOWN);
+  int32_t  left  = until - clock_get_millis();
+  uint32_t us    = left > 0 ? (uint32_t)left * 1000 : 0;
+  uint32_t slept = carry;
+  for(int8_t step=STEPS-1; step>=0; step--) {
+    while( us >= period << step ) {
+      _power_down(step);
+      us    -= period << step;
+      slept += period << step;
     }
-    */
+  }
+
+  // while powered down, our clock stood still, adjust it with the time that
+  // the watchdog measured
+  clock_adjust(slept / 1000);
+  carry = slept % 1000;
+
+  // the rest, less than one step, with the clock running
+  energy_switch(ENERGY_IDLE);
+  _sleep_until(until, SLEEP_MODE_IDLE);
+  energy_switch(state);
+
+  ADCSRA = adc;
+}
+
+// starts the watchdog in interrupt mode. the new prescaler must be written
+// within four cycles after enabling changes, so it's computed up front.
+static void _watchdog(uint8_t step) {
+  uint8_t prescaler = _BV(WDIE)                    |
+                      (step & 1 ? _BV(WDP0) : 0)  |
+                      (step & 2 ? _BV(WDP1) : 0)  |
+                      (step & 4 ? _BV(WDP2) : 0)  |
+                      (step & 8 ? _BV(WDP3) : 0);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
     wdt_reset();  // pat the dog
-  
-    set_sleep_mode(SLEEP_MODE_PWR_DOWN);  
+    // clear the reset flag, WDE can't be cleared while it is set
+    MCUSR &= ~_BV(WDRF);
+    // allow changes, disable reset
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = prescaler;
+  }
+}
+
+// sleeps until the watchdog interrupt, other interrupts don't end the step
+static void _power_down(uint8_t step) {
+  woken = FALSE;
+  _watchdog(step);
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  while( ! woken ) {
+    cli();
+    if( ! woken ) {
+      sleep_enable();
+      // BODS seems unknown ...
+      // TODO: investigate
+      // turn off brown-out enable in software
+      // MCUCR = _BV (BODS) | _BV (BODSE);
+      // MCUCR = _BV (BODS);
+      sei();
+      sleep_cpu();
+      // cancel sleep as a precaution
+      sleep_disable();
+    }
+    sei();
+  }
+}
+
+#endif
+
+// sleeps while the clock runs, woken up every ms by the clock, or by its alarm
+static void _sleep_until(time_t until, uint8_t mode) {
+  set_sleep_mode(mode);
+  for(;;) {
+    cli();
+    if( (int32_t)(until - clock_get_millis()) <= 0 ) { break; }
+#if CLOCK_TICKLESS
+    clock_alarm(until);                 // an earlier one may have gone off
+#endif
+#if CLOCK_RTC
+    clock_sync();
+#endif
     sleep_enable();
- 
-    // BODS seems unknown ...
-    // TODO: investigate
-    // turn off brown-out enable in software
-    // MCUCR = _BV (BODS) | _BV (BODSE);
-    // MCUCR = _BV (BODS); 
-
-    sleep_cpu ();
-  
-    // cancel sleep as a precaution
-    sleep_disable(); 
-    
-    ms = ms - step;
+    sei();
+    sleep_cpu();
+    sleep_disable();
+#if CLOCK_RTC
+    clock_sync();                       // before the counter is read again
+#endif
+  }
+  sei();
+}
+
+bool sleep_guard(sleep_guard_t guard) {
+  if( guard_count == SLEEP_MAX_GUARDS ) { return FALSE; }
+  guards[guard_count++] = guard;
+  return TRUE;
+}
+
+bool sleep_idle(uint32_t ms) {
+  time_t         until = clock_get_millis() + ms;
+  uint8_t        level;
+  energy_state_t state = energy_switch(ENERGY_IDLE);
+
+  for(;;) {
+    // the guards are asked with interrupts disabled, so no byte arrives
+    // unnoticed before sleeping
+    cli();
+    level = _level();
+    if( level == SLEEP_BUSY ) { break; }
+    if( (int32_t)(until - clock_get_millis()) <= 0 ) { break; }
+#if CLOCK_TICKLESS
+    clock_alarm(until);
+#endif
+#if CLOCK_RTC
+    if( level == SLEEP_DEEP ) {
+      set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+      energy_switch(ENERGY_POWER_DOWN);
+      clock_sync();
+    } else if( level == SLEEP_ADC ) {
+      set_sleep_mode(SLEEP_MODE_ADC);
+      energy_switch(ENERGY_IDLE);
+      clock_sync();
+    } else {
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      energy_switch(ENERGY_IDLE);
+    }
+#else
+    // without a clock that runs while powered down (or while the I/O clock
+    // is stopped for the ADC), idle is the deepest
+    set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+#if CLOCK_RTC
+    if( level != SLEEP_LIGHT ) { clock_sync(); }
+#endif
+  }
+  sei();
+  energy_switch(state);
+  return level == SLEEP_BUSY;
+}
+
+// the lightest sleep any of the guards allows
+static uint8_t _level(void) {
+  uint8_t level = SLEEP_DEEP;
+  for(uint8_t i=0; i<guard_count; i++) {
+    uint8_t allowed = guards[i]();
+    if( allowed < level ) { level = allowed; }
   }
-  // while sleeping, our clock stood still, adjust this before returning :-)
-  clock_adjust(sleep);
+  return level;
 }
@@ -3,6 +3,51 @@
 
 // support for sleeping
 // based on: http://www.gammon.com.au/forum/?id=11497
+// long sleeps power down and are timed by the watchdog, in steps of 16ms to
+// 8s. its oscillator is calibrated against the clock by sleep_init(), so the
+// time that was slept can be credited to the clock. the last few ms are slept
+// in idle mode, with the clock running.
+// with CLOCK_RTC (see clock.h), the clock keeps running in power-save mode,
+// and its alarm ends the sleep, so the watchdog isn't used.
 
-void sleep_ms(long ms);
+#ifndef __SLEEP_H
+#define __SLEEP_H
+
+#include <stdint.h>
+
+#include "bool.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef SLEEP_MAX_GUARDS
+#define SLEEP_MAX_GUARDS 4
+#endif
+
+// calibrates the watchdog, call after clock_init()
 void sleep_init(void);
+
+// powers down, nothing is received while sleeping
+void sleep_ms(long ms);
+
+// sleeping between events
+// drivers tell how deep the CPU may sleep through a guard function. as long
+// as one of them needs its USART, the CPU only idles, so the RX interrupt
+// still receives bytes and wakes it up within a few cycles. when none does,
+// and the clock keeps running (CLOCK_RTC), it sleeps in power-save mode, or
+// in ADC noise reduction mode while the ADC converts (see adc.h).
+
+#define SLEEP_BUSY  0             // there is work to do, don't sleep
+#define SLEEP_LIGHT 1             // idle, the USARTs and timers run
+#define SLEEP_ADC   2             // ADC noise reduction, only the ADC runs
+#define SLEEP_DEEP  3             // nothing needs to be received
+
+typedef uint8_t (*sleep_guard_t)(void);
+
+// adds a guard, e.g. xbee_sleep_guard, returns FALSE if there is no room
+bool sleep_guard(sleep_guard_t guard);
+
+// sleeps until a guard reports work, or at most ms, waking up for interrupts
+// in between that didn't cause work. returns TRUE if there is work.
+bool sleep_idle(uint32_t ms);
+
+#endif
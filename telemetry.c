@@ -0,0 +1,279 @@
+// telemetry.c
+// author: Christophe VG <contact@christophe.vg>
+
+// compact encoding of time series of samples into blocks (see telemetry.h)
+
+#include <string.h>
+
+#include "telemetry.h"
+
+// forward declarations of "private" functions
+static uint8_t  _put(telemetry_encoder_t*, uint32_t, uint8_t, bool);
+static uint8_t  _put_varint(telemetry_encoder_t*, uint32_t, bool);
+static uint8_t  _put_code(telemetry_encoder_t*, uint32_t, const uint8_t*, bool);
+static uint16_t _encode(telemetry_encoder_t*, uint32_t, const uint16_t*, bool);
+static bool     _get(telemetry_decoder_t*, uint8_t, uint32_t*);
+static bool     _get_varint(telemetry_decoder_t*, uint32_t*);
+static bool     _get_code(telemetry_decoder_t*, const uint8_t*, uint32_t*);
+
+// payload sizes of the four classes of codes, with prefixes 0, 10, 110, 111
+static const uint8_t time_bits[]  = { 0, 6, 12, 32 };
+static const uint8_t value_bits[] = { 0, 4,  8, 16 };
+
+#define KEYFRAME_FLAG 0x80
+#define COUNT_MASK    0x7F
+
+// zigzag encoding maps small negative and positive numbers to small numbers
+// 0 -> 0, -1 -> 1, 1 -> 2, -2 -> 3,...
+
+static uint32_t _zigzag32(uint32_t value) {
+  return (value << 1) ^ (0 - (value >> 31));
+}
+
+static uint32_t _unzigzag32(uint32_t value) {
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+static uint16_t _zigzag16(uint16_t value) {
+  return (uint16_t)(value << 1) ^ (uint16_t)(0 - (value >> 15));
+}
+
+static uint16_t _unzigzag16(uint16_t value) {
+  return (value >> 1) ^ (uint16_t)(0 - (value & 1));
+}
+
+// encoding
+
+void telemetry_init(telemetry_encoder_t *encoder, uint8_t channels,
+                    uint8_t keyframe_interval)
+{
+  memset(encoder, 0, sizeof(telemetry_encoder_t));
+  encoder->channels          = channels;
+  encoder->keyframe_interval = keyframe_interval;
+  encoder->force             = TRUE;
+}
+
+void telemetry_begin(telemetry_encoder_t *encoder, uint8_t *buffer,
+                     uint8_t capacity)
+{
+  encoder->keyframe = encoder->force ||
+                      ( encoder->keyframe_interval &&
+                        encoder->blocks >= encoder->keyframe_interval );
+  encoder->force    = FALSE;
+  encoder->buffer   = buffer;
+  encoder->capacity = capacity;
+  encoder->bit      = TELEMETRY_HEADER_SIZE * 8;
+  encoder->count    = 0;
+  memset(buffer, 0, capacity);
+}
+
+bool telemetry_add(telemetry_encoder_t *encoder, uint32_t time,
+                   const uint16_t *values)
+{
+  if( encoder->count == TELEMETRY_MAX_SAMPLES ) { return FALSE; }
+
+  // find out if it fits, before actually adding it
+  uint16_t bits = _encode(encoder, time, values, FALSE);
+  if( encoder->bit + bits > (uint16_t)encoder->capacity * 8 ) { return FALSE; }
+  _encode(encoder, time, values, TRUE);
+
+  if( encoder->keyframe && encoder->count == 0 ) {
+    encoder->delta = 0;
+  } else {
+    encoder->delta = time - encoder->time;
+  }
+  encoder->time = time;
+  memcpy(encoder->values, values, encoder->channels * sizeof(uint16_t));
+  encoder->count++;
+
+  return TRUE;
+}
+
+uint8_t telemetry_end(telemetry_encoder_t *encoder) {
+  if( encoder->count == 0 ) {
+    encoder->force |= encoder->keyframe;  // try again with the next block
+    return 0;
+  }
+
+  encoder->buffer[0] = encoder->sequence++;
+  encoder->buffer[1] = (encoder->keyframe ? KEYFRAME_FLAG : 0) | encoder->count;
+
+  if( encoder->keyframe ) { encoder->blocks = 0; }
+  if( encoder->blocks < 0xFF ) { encoder->blocks++; }
+
+  return (encoder->bit + 7) / 8;
+}
+
+void telemetry_keyframe(telemetry_encoder_t *encoder) {
+  encoder->force = TRUE;
+}
+
+// encodes a sample, or only computes its size in bits if write is FALSE
+static uint16_t _encode(telemetry_encoder_t *encoder, uint32_t time,
+                        const uint16_t *values, bool write)
+{
+  uint16_t bits = 0;
+
+  if( encoder->keyframe && encoder->count == 0 ) {
+    bits += _put_varint(encoder, time, write);
+    for(uint8_t c=0; c<encoder->channels; c++) {
+      bits += _put_varint(encoder, values[c], write);
+    }
+    return bits;
+  }
+
+  uint32_t delta = time - encoder->time;
+  bits += _put_code(encoder, _zigzag32(delta - encoder->delta), time_bits,
+                    write);
+  for(uint8_t c=0; c<encoder->channels; c++) {
+    bits += _put_code(encoder, _zigzag16(values[c] - encoder->values[c]),
+                      value_bits, write);
+  }
+  return bits;
+}
+
+// writes the bits least significant bits of value, most significant first
+static uint8_t _put(telemetry_encoder_t *encoder, uint32_t value, uint8_t bits,
+                    bool write)
+{
+  if( write ) {
+    for(uint8_t i=bits; i>0; i--) {
+      if( (value >> (i-1)) & 1 ) {
+        encoder->buffer[encoder->bit >> 3] |= 0x80 >> (encoder->bit & 0x07);
+      }
+      encoder->bit++;
+    }
+  }
+  return bits;
+}
+
+// 7 bits per byte, least significant first, the high bit marks continuation
+static uint8_t _put_varint(telemetry_encoder_t *encoder, uint32_t value,
+                           bool write)
+{
+  uint8_t bits = 0;
+  while( value > 0x7F ) {
+    bits += _put(encoder, (value & 0x7F) | 0x80, 8, write);
+    value >>= 7;
+  }
+  return bits + _put(encoder, value, 8, write);
+}
+
+static uint8_t _put_code(telemetry_encoder_t *encoder, uint32_t value,
+                         const uint8_t *sizes, bool write)
+{
+  if( value == 0 ) { return _put(encoder, 0, 1, write); }
+  if( value < (1UL << sizes[1]) ) {
+    return _put(encoder, 0x2, 2, write) + _put(encoder, value, sizes[1], write);
+  }
+  if( value < (1UL << sizes[2]) ) {
+    return _put(encoder, 0x6, 3, write) + _put(encoder, value, sizes[2], write);
+  }
+  return _put(encoder, 0x7, 3, write) + _put(encoder, value, sizes[3], write);
+}
+
+// decoding
+
+void telemetry_decoder_init(telemetry_decoder_t *decoder, uint8_t channels) {
+  memset(decoder, 0, sizeof(telemetry_decoder_t));
+  decoder->channels = channels;
+}
+
+bool telemetry_decode_begin(telemetry_decoder_t *decoder, const uint8_t *block,
+                            uint8_t size)
+{
+  decoder->remaining = 0;
+  if( size < TELEMETRY_HEADER_SIZE ) { return FALSE; }
+
+  bool keyframe = block[1] & KEYFRAME_FLAG;
+
+  if( decoder->synced && block[0] == decoder->sequence ) { return FALSE; }
+  if( ! keyframe &&
+      ( ! decoder->synced || block[0] != (uint8_t)(decoder->sequence + 1) ) )
+  {
+    decoder->synced = FALSE;
+    return FALSE;
+  }
+
+  decoder->synced    = TRUE;
+  decoder->sequence  = block[0];
+  decoder->block     = block;
+  decoder->size      = size;
+  decoder->bit       = TELEMETRY_HEADER_SIZE * 8;
+  decoder->remaining = block[1] & COUNT_MASK;
+  decoder->first     = keyframe;
+  return TRUE;
+}
+
+bool telemetry_decode_next(telemetry_decoder_t *decoder, uint32_t *time,
+                           uint16_t *values)
+{
+  uint32_t value;
+
+  if( decoder->remaining == 0 ) { return FALSE; }
+
+  if( decoder->first ) {
+    if( ! _get_varint(decoder, &decoder->time) ) { goto corrupt; }
+    decoder->delta = 0;
+    for(uint8_t c=0; c<decoder->channels; c++) {
+      if( ! _get_varint(decoder, &value) ) { goto corrupt; }
+      decoder->values[c] = value;
+    }
+    decoder->first = FALSE;
+  } else {
+    if( ! _get_code(decoder, time_bits, &value) ) { goto corrupt; }
+    decoder->delta += _unzigzag32(value);
+    decoder->time  += decoder->delta;
+    for(uint8_t c=0; c<decoder->channels; c++) {
+      if( ! _get_code(decoder, value_bits, &value) ) { goto corrupt; }
+      decoder->values[c] += _unzigzag16(value);
+    }
+  }
+  decoder->remaining--;
+
+  *time = decoder->time;
+  memcpy(values, decoder->values, decoder->channels * sizeof(uint16_t));
+  return TRUE;
+
+corrupt:
+  decoder->synced    = FALSE;
+  decoder->remaining = 0;
+  return FALSE;
+}
+
+static bool _get(telemetry_decoder_t *decoder, uint8_t bits, uint32_t *value) {
+  if( decoder->bit + bits > (uint16_t)decoder->size * 8 ) { return FALSE; }
+  *value = 0;
+  for(uint8_t i=0; i<bits; i++) {
+    uint8_t bit = decoder->block[decoder->bit >> 3] >> (7 - (decoder->bit & 0x07));
+    *value = (*value << 1) | (bit & 1);
+    decoder->bit++;
+  }
+  return TRUE;
+}
+
+static bool _get_varint(telemetry_decoder_t *decoder, uint32_t *value) {
+  uint32_t byte;
+  *value = 0;
+  for(uint8_t shift=0; shift<35; shift+=7) {
+    if( ! _get(decoder, 8, &byte) ) { return FALSE; }
+    *value |= (byte & 0x7F) << shift;
+    if( ! (byte & 0x80) ) { return TRUE; }
+  }
+  return FALSE;
+}
+
+static bool _get_code(telemetry_decoder_t *decoder, const uint8_t *sizes,
+                      uint32_t *value)
+{
+  uint32_t bit;
+  uint8_t  code = 0;
+
+  // count the ones of the prefix, at most three
+  while( code < 3 ) {
+    if( ! _get(decoder, 1, &bit) ) { return FALSE; }
+    if( ! bit ) { break; }
+    code++;
+  }
+  return _get(decoder, sizes[code], value);
+}
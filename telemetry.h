@@ -0,0 +1,94 @@
+// telemetry.h
+// author: Christophe VG <contact@christophe.vg>
+
+// compact encoding of time series of samples (a timestamp and a few values,
+// e.g. from clock_get_millis() and avr_adc_read()) into blocks, that each fit
+// one XBee payload. this is plain C, so blocks can be decoded on a host too.
+
+// a block starts with a two byte header: [sequence][keyframe:1|count:7]
+// a keyframe block starts with a complete first sample, timestamp and values
+// as varints. all other samples are bit-packed:
+// - the timestamp as the zigzag encoded delta of the delta to the previous one
+//     0 | 10 + 6 bits | 110 + 12 bits | 111 + 32 bits
+// - each value as the zigzag encoded delta to the previous one
+//     0 | 10 + 4 bits | 110 + 8 bits  | 111 + 16 bits
+// blocks that aren't keyframes continue from the last sample of the previous
+// block. when a block is lost, the decoder skips blocks until the next
+// keyframe, which the encoder inserts every keyframe_interval blocks.
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <stdint.h>
+
+#include "bool.h"
+
+#ifndef TELEMETRY_MAX_CHANNELS
+#define TELEMETRY_MAX_CHANNELS 8
+#endif
+
+#define TELEMETRY_HEADER_SIZE  2
+#define TELEMETRY_MAX_SAMPLES  127
+
+typedef struct {
+  uint8_t  channels;
+  uint8_t  keyframe_interval;   // in blocks, 0 = only when asked for
+  uint8_t  blocks;              // since the last keyframe
+  bool     force;               // next block must be a keyframe
+  bool     keyframe;            // current block is a keyframe
+  uint8_t  sequence;
+  // previous sample
+  uint32_t time;
+  uint32_t delta;
+  uint16_t values[TELEMETRY_MAX_CHANNELS];
+  // current block
+  uint8_t *buffer;
+  uint8_t  capacity;
+  uint16_t bit;
+  uint8_t  count;
+} telemetry_encoder_t;
+
+void telemetry_init(telemetry_encoder_t *encoder, uint8_t channels,
+                    uint8_t keyframe_interval);
+
+// starts a new block in buffer
+void telemetry_begin(telemetry_encoder_t *encoder, uint8_t *buffer,
+                     uint8_t capacity);
+
+// adds a sample to the block, returns FALSE if it doesn't fit (anymore)
+bool telemetry_add(telemetry_encoder_t *encoder, uint32_t time,
+                   const uint16_t *values);
+
+// finishes the block, returns its size, 0 if it contains no samples
+uint8_t telemetry_end(telemetry_encoder_t *encoder);
+
+// makes the next block a keyframe, e.g. after a failed transmission
+void telemetry_keyframe(telemetry_encoder_t *encoder);
+
+typedef struct {
+  uint8_t        channels;
+  bool           synced;        // a keyframe was received and no block lost
+  uint8_t        sequence;
+  uint32_t       time;
+  uint32_t       delta;
+  uint16_t       values[TELEMETRY_MAX_CHANNELS];
+  const uint8_t *block;
+  uint8_t        size;
+  uint16_t       bit;
+  uint8_t        remaining;     // samples
+  bool           first;         // next sample is the keyframe sample
+} telemetry_decoder_t;
+
+void telemetry_decoder_init(telemetry_decoder_t *decoder, uint8_t channels);
+
+// starts decoding a block, returns FALSE if it can't be decoded because
+// blocks were lost since the last keyframe, or if it is a duplicate
+bool telemetry_decode_begin(telemetry_decoder_t *decoder, const uint8_t *block,
+                            uint8_t size);
+
+// decodes the next sample of the block, returns FALSE when there are no more
+// all samples of a block must be decoded before the next block can be
+bool telemetry_decode_next(telemetry_decoder_t *decoder, uint32_t *time,
+                           uint16_t *values);
+
+#endif
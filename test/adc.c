@@ -0,0 +1,108 @@
+// adc.c
+// author: Christophe VG
+
+// tests for the background scanning of ADC channels, converting synthetic
+// values by calling the conversion complete interrupt
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../adc.h"
+#include "../sleep.h"
+
+#define ROUNDS 20
+
+// stand-ins for the registers and the interrupt lock
+volatile uint8_t  ADMUX, ADCSRA;
+volatile uint16_t ADC;
+
+uint8_t host_irq_save(void)               { return 0; }
+void    host_irq_restore(uint8_t *state)  {}
+void    host_irq_on(uint8_t *state)       {}
+
+void ADC_vect(void);
+
+#define ENABLED ((1 << ADEN) | (1 << ADIE))
+#define MUX     0x0F
+
+// channels with their oversampling, and the values they convert to
+#define PLAIN   0                   // 0, 1, 2,... one sample per conversion
+#define NOISY   8                   // 511, 512, 511,... 64 per sample
+#define FULL    2                   // 1023, 64 per sample
+
+uint32_t conversions[16];
+
+uint16_t value(uint8_t mux) {
+  uint32_t n = conversions[mux]++;
+  switch( mux ) {
+    case PLAIN : return n % 1024;
+    case NOISY : return 511 + n % 2;
+    case FULL  : return 1023;
+  }
+  assert(0);
+}
+
+// completes the running conversion, the ISR starts the next one
+void convert(void) {
+  assert((ADCSRA & ENABLED) == ENABLED && (ADCSRA & (1 << ADSC)));
+  assert((ADMUX & ~MUX) == ADC_REF_AVCC);
+  ADC     = value(ADMUX & MUX);
+  ADCSRA &= ~(1 << ADSC);
+  ADC_vect();
+}
+
+int main(void) {
+  adc_init(ADC_REF_AVCC);
+  assert(ADMUX == ADC_REF_AVCC);
+  assert((ADCSRA & (1 << ADEN)) == 0);          // until scanning
+
+  assert(adc_add(PLAIN, 0) == 0);
+  assert(adc_add(NOISY, ADC_MAX_OVERSAMPLING) == 1);
+  assert(adc_add(FULL,  ADC_MAX_OVERSAMPLING) == 2);
+  assert(adc_add(FULL,  ADC_MAX_OVERSAMPLING + 1) == -1);
+  assert(adc_latest(0) == 0 && adc_average(0) == 0 && adc_samples(0) == 0);
+  assert(adc_sleep_guard() == SLEEP_DEEP);
+
+  adc_start();
+  assert(adc_sleep_guard() == SLEEP_LIGHT);
+
+  // the channels are converted in turn, after 4^n conversions each
+  for(int round=0; round<ROUNDS; round++) {
+    assert((ADMUX & MUX) == PLAIN);
+    convert();
+    assert((ADMUX & MUX) == NOISY);
+    for(int i=0; i<64; i++) { convert(); }
+    assert((ADMUX & MUX) == FULL);
+    for(int i=0; i<64; i++) { convert(); }
+  }
+  for(uint8_t i=0; i<3; i++) { assert(adc_samples(i) == ROUNDS); }
+
+  // the ring holds the last 8 samples, 12 to 19 average 15.5, rounded to 16
+  assert(ADC_SAMPLES == 8);
+  assert(adc_latest(0) == 19 && adc_average(0) == 16);
+
+  // 64 conversions are summed and decimated by 8, into 3 extra bits: 511.5
+  // becomes 4092. the largest sum, of 64 * 1023, still fits the 16 bits.
+  assert(adc_latest(1) == 4092 && adc_average(1) == 4092);
+  assert(adc_latest(2) == 8184 && adc_average(2) == 8184);
+
+  // stopping disables the ADC, also in the middle of a sample
+  for(int i=0; i<10; i++) { convert(); }
+  adc_stop();
+  assert((ADCSRA & ENABLED) == 0);
+  assert(adc_sleep_guard() == SLEEP_DEEP);
+
+  // the partial sum is discarded when starting again
+  adc_start();
+  assert((ADCSRA & ENABLED) == ENABLED && (ADMUX & MUX) == PLAIN);
+  for(int i=0; i<1+64; i++) { convert(); }
+  assert(adc_samples(1) == ROUNDS + 1 && adc_latest(1) == 4092);
+
+  // a last interrupt after stopping doesn't start a new conversion
+  adc_stop();
+  ADC_vect();
+  assert((ADCSRA & ENABLED) == 0 && (ADCSRA & (1 << ADSC)) == 0);
+
+  exit(EXIT_SUCCESS);
+}
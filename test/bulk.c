@@ -0,0 +1,156 @@
+// bulk.c
+// author: Christophe VG
+
+// tests for the bulk transfer layer, sending to itself over a radio that drops
+// and reorders fragments
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../bulk.h"
+
+#define ADDRESS   0x0013A20040000001ULL
+#define TRANSFERS 200
+#define QUEUE     64
+
+// stand-ins for the clock and the xbee driver, the bulk layer sends and
+// receives frames through the queue of the radio
+
+unsigned long current_millis;
+
+unsigned long clock_get_millis(void) {
+  return current_millis;
+}
+
+bool xbee_subscribe(uint8_t type, xbee_rx_handler_t handler) {
+  return TRUE;
+}
+
+typedef struct {
+  uint8_t  data[XB_MAX_PAYLOAD];
+  uint16_t size;
+} frame_t;
+
+frame_t  queue[QUEUE];
+uint8_t  queued;
+
+uint8_t  sends[256];                // transmissions per fragment
+bool     dropped[256];              // its first transmission was dropped
+uint8_t  loss;                      // % of first transmissions
+
+void enqueue(const xbee_iov_t *iov, uint8_t count) {
+  assert(queued < QUEUE);
+  frame_t *frame = &queue[queued++];
+  frame->size = 0;
+  for(uint8_t s=0; s<count; s++) {
+    assert(frame->size + iov[s].size <= XB_MAX_PAYLOAD);
+    memcpy(&frame->data[frame->size], iov[s].data, iov[s].size);
+    frame->size += iov[s].size;
+  }
+}
+
+// data fragments
+void xbee_send_to(xbee_dest_t *dest, const xbee_iov_t *iov, uint8_t count) {
+  assert(dest->address == ADDRESS);
+  enqueue(iov, count);
+}
+
+// acknowledgements
+void xbee_send(xbee_tx_t *frame) {
+  assert(frame->address == ADDRESS);
+  assert(frame->id == XB_TX_NO_RESPONSE);
+  xbee_iov_t iov = { frame->data, frame->size };
+  enqueue(&iov, 1);
+}
+
+// delivers the queued frames in random order, frames that are sent meanwhile
+// are delivered too
+void deliver(void) {
+  while( queued ) {
+    uint8_t  pick  = random() % queued;
+    frame_t  frame = queue[pick];
+    queue[pick] = queue[--queued];
+
+    if( frame.data[0] == BULK_MSG_DATA ) {
+      uint8_t index = frame.data[2];
+      sends[index]++;
+      if( sends[index] == 1 && random() % 100 < loss ) {
+        dropped[index] = TRUE;
+        continue;
+      }
+    }
+    xbee_rx_t rx = { .address = ADDRESS, .nw_address = 0x1234,
+                     .data = frame.data, .size = frame.size };
+    assert(bulk_receive(&rx));
+  }
+}
+
+uint8_t  data[BULK_MAX_SIZE];
+uint8_t  received[BULK_MAX_SIZE];
+uint16_t received_size;
+uint32_t completed;
+
+void receive(uint64_t address, uint8_t *buffer, uint16_t size) {
+  assert(address == ADDRESS);
+  memcpy(received, buffer, size);
+  received_size = size;
+  completed++;
+}
+
+void transfer(uint16_t size) {
+  memset(sends,   0, sizeof(sends));
+  memset(dropped, 0, sizeof(dropped));
+  for(uint16_t i=0; i<size; i++) { data[i] = random(); }
+  received_size = 0;
+  uint32_t before = completed;
+
+  assert(bulk_send(ADDRESS, data, size));
+  for(int round=0; bulk_get_status() == BULK_BUSY; round++) {
+    assert(round < 100);
+    deliver();
+    // only what was lost and not selectively acknowledged, times out
+    current_millis += BULK_TIMEOUT;
+    bulk_process();
+  }
+  assert(bulk_get_status() == BULK_DONE);
+
+  // reassembled once and completely
+  assert(completed == before + 1);
+  assert(received_size == size);
+  assert(memcmp(received, data, size) == 0);
+
+  // every fragment is resent at most once. reordering can make a fragment
+  // that is still underway look lost, so also those that got through.
+  uint8_t count = (size + BULK_FRAGMENT_SIZE - 1) / BULK_FRAGMENT_SIZE;
+  for(uint8_t i=0; i<count; i++) {
+    assert(sends[i] >= 1 && sends[i] <= 2);
+    if( dropped[i] ) { assert(sends[i] == 2); }
+  }
+}
+
+int main(void) {
+  srandom(1234);
+  bulk_init();
+  bulk_on_receive(receive);
+
+  // sizes around fragment and window boundaries, without loss
+  uint16_t sizes[] = {
+    1, BULK_FRAGMENT_SIZE - 1, BULK_FRAGMENT_SIZE, BULK_FRAGMENT_SIZE + 1,
+    BULK_WINDOW * BULK_FRAGMENT_SIZE, BULK_WINDOW * BULK_FRAGMENT_SIZE + 1,
+    BULK_MAX_SIZE
+  };
+  for(uint8_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+    transfer(sizes[i]);
+  }
+
+  // random sizes with increasing loss
+  for(loss=5; loss<=50; loss+=15) {
+    for(int i=0; i<TRANSFERS; i++) {
+      transfer(1 + random() % BULK_MAX_SIZE);
+    }
+  }
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,125 @@
+// energy.c
+// author: Christophe VG
+
+// tests for the energy accounting
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../energy.h"
+
+// stand-ins for the clock and the interrupt lock, the us clock wraps, like the
+// real one
+unsigned long current_micros;
+
+unsigned long clock_get_millis(void) {
+  return current_micros / 1000;
+}
+
+uint32_t clock_get_micros(void) {
+  return current_micros;
+}
+
+void elapse(unsigned long us) {
+  current_micros += us;
+}
+
+uint8_t host_irq_save(void)               { return 0; }
+void    host_irq_restore(uint8_t *state)  {}
+void    host_irq_on(uint8_t *state)       {}
+
+void test_states(void) {
+  current_micros = 123456;
+  energy_init();
+
+  elapse(5000);
+  assert(energy_switch(ENERGY_IDLE) == ENERGY_ACTIVE);
+  elapse(20000);
+  energy_state_t state = energy_switch(ENERGY_XBEE_TX);
+  assert(state == ENERGY_IDLE);
+  elapse(3000);
+  assert(energy_switch(state) == ENERGY_XBEE_TX);
+  elapse(1000);
+
+  energy_stats_t stats = energy_get_stats();
+  assert(stats.ms[ENERGY_ACTIVE]     ==  5);
+  assert(stats.ms[ENERGY_IDLE]       == 21);    // including the current one
+  assert(stats.ms[ENERGY_XBEE_TX]    ==  3);
+  assert(stats.ms[ENERGY_POWER_DOWN] ==  0);
+  assert(stats.switches == 3);
+}
+
+// waits much shorter than a ms add up
+void test_carry(void) {
+  current_micros = 0;
+  energy_init();
+
+  for(int i=0; i<10000; i++) {
+    energy_state_t state = energy_switch(ENERGY_XBEE_TX);
+    elapse(150);
+    energy_switch(state);
+    elapse(50);
+  }
+  energy_stats_t stats = energy_get_stats();
+  assert(stats.ms[ENERGY_XBEE_TX] == 1500);
+  assert(stats.ms[ENERGY_ACTIVE]  ==  500);
+}
+
+// spans beyond the wrap of the us clock, are measured in ms
+void test_long_span(void) {
+  current_micros = 0xFFFFFFFFUL - 500000;
+  energy_init();
+
+  energy_switch(ENERGY_POWER_DOWN);
+  elapse(2UL * 3600 * 1000000);                 // two hours
+  energy_switch(ENERGY_ACTIVE);
+  elapse(10000);
+
+  energy_stats_t stats = energy_get_stats();
+  assert(stats.ms[ENERGY_POWER_DOWN] == 2UL * 3600 * 1000);
+  assert(stats.ms[ENERGY_ACTIVE]     == 10);
+}
+
+// a clock that is set back, doesn't add (a lot of) time
+void test_backwards(void) {
+  current_micros = 1000000;
+  energy_init();
+
+  elapse(2000);
+  current_micros -= 5000;
+  energy_stats_t stats = energy_get_stats();
+  assert(stats.ms[ENERGY_ACTIVE] == 0);
+  elapse(1000);
+  stats = energy_get_stats();
+  assert(stats.ms[ENERGY_ACTIVE] == 1);
+}
+
+// time in ISRs is taken from the state they interrupted
+void test_interrupts(void) {
+  current_micros = 0;
+  energy_init();
+
+  energy_switch(ENERGY_IDLE);
+  for(int i=0; i<1000; i++) {
+    elapse(900);
+    energy_interrupted(100);                    // happened in the last 100us
+    elapse(100);
+  }
+  energy_switch(ENERGY_ACTIVE);
+
+  energy_stats_t stats = energy_get_stats();
+  assert(stats.ms[ENERGY_IDLE]   == 900);
+  assert(stats.ms[ENERGY_ISR]    == 100);
+  assert(stats.ms[ENERGY_ACTIVE] ==   0);
+}
+
+int main(void) {
+  test_states();
+  test_carry();
+  test_long_span();
+  test_backwards();
+  test_interrupts();
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,121 @@
+// nodes.c
+// author: Christophe VG
+
+// tests for the node table
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../nodes.h"
+
+// stand-in for the clock, nodes.c only reads it
+unsigned long current_millis;
+
+unsigned long clock_get_millis(void) {
+  return current_millis;
+}
+
+#define ADDRESSES 200
+#define ROUNDS    20000
+
+uint64_t addresses[ADDRESSES];
+uint32_t seen[ADDRESSES];           // reference: when last seen, 0 = not in table
+
+nodes_entry_t *receive(uint64_t address, uint16_t size) {
+  xbee_rx_t frame = { .address = address, .nw_address = address & 0xFFFF,
+                      .size = size };
+  return nodes_update(&frame);
+}
+
+// the reference evicts the least recently seen address
+void reference_evict(void) {
+  int oldest = -1, count = 0;
+  for(int i=0; i<ADDRESSES; i++) {
+    if( ! seen[i] ) { continue; }
+    count++;
+    if( oldest < 0 || seen[i] < seen[oldest] ) { oldest = i; }
+  }
+  if( count > NODES_CAPACITY ) { seen[oldest] = 0; }
+}
+
+void test_lru(void) {
+  nodes_init();
+  srand(42);
+  // real XBee addresses share their high bits
+  for(int i=0; i<ADDRESSES; i++) {
+    addresses[i] = 0x0013A20040000000ULL + rand() % 0x1000000;
+  }
+
+  for(current_millis=1; current_millis<=ROUNDS; current_millis++) {
+    int i = rand() % ADDRESSES;
+    if( rand() % 10 == 0 ) {
+      nodes_remove(addresses[i]);
+      seen[i] = 0;
+    } else {
+      nodes_entry_t *node = receive(addresses[i], 10);
+      assert(node->address == addresses[i]);
+      assert(node->last_seen == current_millis);
+      seen[i] = current_millis;
+      reference_evict();
+    }
+    // spot check
+    int j = rand() % ADDRESSES;
+    nodes_entry_t *node = nodes_lookup(addresses[j]);
+    assert((node != NULL) == (seen[j] != 0));
+  }
+
+  // full check, in order of recency
+  int count = 0;
+  uint32_t last = 0xFFFFFFFF;
+  for(nodes_entry_t *node=nodes_next(NULL); node; node=nodes_next(node)) {
+    assert(node->last_seen < last);
+    last = node->last_seen;
+    count++;
+  }
+  for(int i=0; i<ADDRESSES; i++) {
+    nodes_entry_t *node = nodes_lookup(addresses[i]);
+    assert((node != NULL) == (seen[i] != 0));
+    if( node ) { assert(node->last_seen == seen[i]); }
+  }
+  nodes_stats_t stats = nodes_get_stats();
+  assert(count == stats.count && count == NODES_CAPACITY);
+  assert(stats.evictions > 0);
+}
+
+void test_counters(void) {
+  nodes_init();
+  current_millis = 1000;
+
+  nodes_entry_t *node = receive(0x0013A20040000001ULL, 20);
+  assert(node->first_seen == 1000 && node->frames == 1 && node->bytes == 20);
+  assert(node->nw_address == 0x0001 && node->parent == XB_NW_ADDR_UNKNOWN);
+  current_millis = 2000;
+  node = receive(0x0013A20040000001ULL, 30);
+  assert(node->first_seen == 1000 && node->last_seen == 2000);
+  assert(node->frames == 2 && node->bytes == 50);
+
+  nodes_set_parent(0x0013A20040000001ULL, 0x1234);
+  assert(node->parent == 0x1234);
+
+  assert(nodes_sequence(node, 250) == 0);
+  assert(nodes_sequence(node, 251) == 0);
+  assert(nodes_sequence(node, 254) == 2);
+  assert(nodes_sequence(node, 2) == 3);         // wraps
+  assert(nodes_sequence(node, 2) == 0);         // duplicate
+  assert(nodes_sequence(node, 200) == 0);       // late
+  assert(node->lost == 5 && node->duplicates == 2 && node->sequence == 2);
+
+  xbee_rx_t unknown = { .address = 0xFFFFFFFFFFFFFFFFULL };
+  assert(nodes_update(&unknown) == NULL);
+
+  receive(0x0013A20040000002ULL, 10);
+  nodes_dump();
+}
+
+int main(void) {
+  test_lru();
+  test_counters();
+  exit(EXIT_SUCCESS);
+}
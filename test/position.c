@@ -0,0 +1,134 @@
+// position.c
+// author: Christophe VG
+
+// tests for compact position reports
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../position.h"
+
+#define FIXES 500
+
+// unused, but required by nmea.h
+void gps_position_handler(nmea_position pos) {}
+
+void test_from_nmea(void) {
+  nmea_position nmea = { { 22, 7, 10.25 }, { 53, 1.8561, 'N' },
+                                           { 13, 18.2237, 'W' } };
+  position_t    position;
+
+  assert(position_from_nmea(&nmea, &position));
+  assert(position.time == (22 * 3600 + 7 * 60 + 10) * 1000UL + 250);
+  assert(position.latitude  ==  53030935);    // 53 + 1.8561 / 60
+  assert(position.longitude == -13303728);
+
+  nmea.lattitude.ns = '_';
+  assert(! position_from_nmea(&nmea, &position));
+}
+
+// a track at 5 Hz, crossing midnight and the equator
+void generate(position_t *track) {
+  position_t position = { POSITION_DAY - 30000, 500, 4350000 };
+  srand(42);
+  for(int i=0; i<FIXES; i++) {
+    position.time       = ( position.time + 200 ) % POSITION_DAY;
+    position.latitude  += -12 + rand() % 9;
+    position.longitude +=  20 + rand() % 9;
+    track[i] = position;
+  }
+}
+
+void test_track(void) {
+  position_t         track[FIXES], position;
+  position_encoder_t encoder;
+  position_decoder_t decoder;
+  uint8_t            buffer[POSITION_MAX_SIZE];
+  uint8_t            size;
+  int                bytes = 0;
+
+  generate(track);
+  position_encoder_init(&encoder);
+  position_decoder_init(&decoder);
+
+  for(int i=0; i<FIXES; i++) {
+    size = position_encode(&encoder, &track[i], buffer);
+    assert(size <= POSITION_MAX_SIZE);
+    bytes += size;
+    assert(position_decode(&decoder, buffer, size, &position) == POSITION_OK);
+    assert(memcmp(&position, &track[i], sizeof(position_t)) == 0);
+    assert(position_decode(&decoder, buffer, size, &position)
+           == POSITION_DUPLICATE);
+  }
+  printf("%d fixes: %d bytes = %.1f bytes/fix\n",
+         FIXES, bytes, (double)bytes / FIXES);
+  assert(bytes < FIXES * 8);
+}
+
+void test_loss(void) {
+  position_t         track[FIXES], position;
+  position_encoder_t encoder;
+  position_decoder_t decoder;
+  uint8_t            buffer[POSITION_MAX_SIZE];
+  uint8_t            size;
+
+  generate(track);
+  position_encoder_init(&encoder);
+  position_decoder_init(&decoder);
+
+  size = position_encode(&encoder, &track[0], buffer);
+  assert(buffer[2] & POSITION_KEYFRAME);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_OK);
+
+  position_encode(&encoder, &track[1], buffer);             // lost
+  size = position_encode(&encoder, &track[2], buffer);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_LOST);
+  size = position_encode(&encoder, &track[3], buffer);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_LOST);
+
+  // the receiver requests a keyframe
+  position_keyframe(&encoder);
+  size = position_encode(&encoder, &track[4], buffer);
+  assert(size == POSITION_MAX_SIZE);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_OK);
+  assert(memcmp(&position, &track[4], sizeof(position_t)) == 0);
+
+  // truncated reports are invalid and need a keyframe too
+  size = position_encode(&encoder, &track[5], buffer);
+  assert(position_decode(&decoder, buffer, POSITION_HEADER_SIZE + 1, &position)
+         == POSITION_INVALID);
+  size = position_encode(&encoder, &track[6], buffer);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_LOST);
+
+  // periodic keyframes, without asking
+  int i;
+  for(i=7; i<7+POSITION_KEYFRAME_INTERVAL+1; i++) {
+    size = position_encode(&encoder, &track[i], buffer);
+    if( buffer[2] & POSITION_KEYFRAME ) { break; }
+  }
+  assert(i < 7 + POSITION_KEYFRAME_INTERVAL + 1);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_OK);
+  assert(memcmp(&position, &track[i], sizeof(position_t)) == 0);
+
+  // huge jumps are sent as keyframes
+  position_t jump = { 1000, -89000000, 179000000 };
+  size = position_encode(&encoder, &jump, buffer);
+  assert(buffer[2] & POSITION_KEYFRAME);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_OK);
+  jump.longitude = -179000000;
+  size = position_encode(&encoder, &jump, buffer);
+  assert(position_decode(&decoder, buffer, size, &position) == POSITION_OK);
+  assert(memcmp(&position, &jump, sizeof(position_t)) == 0);
+
+  buffer[0] = POSITION_MSG_REQUEST;
+  assert(position_decode(&decoder, buffer, 1, &position) == POSITION_INVALID);
+}
+
+int main(void) {
+  test_from_nmea();
+  test_track();
+  test_loss();
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,88 @@
+// profile.c
+// author: Christophe VG
+
+// tests for the ISR profiling
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../profile.h"
+
+// stand-ins for the clock and the interrupt lock
+uint32_t current_micros;
+
+uint32_t clock_get_micros(void) {
+  return current_micros;
+}
+
+uint8_t host_irq_save(void)               { return 0; }
+void    host_irq_restore(uint8_t *state)  {}
+void    host_irq_on(uint8_t *state)       {}
+
+// an ISR that takes us
+void isr(profile_vector_t vector, uint32_t us) {
+  PROFILE_ENTER();
+  current_micros += us;
+  PROFILE_LEAVE(vector);
+}
+
+void test_histogram(void) {
+  profile_reset();
+  uint32_t times[] = { 0, 1, 2, 3, 4, 7, 8, 100, 127, 128, 5000 };
+  uint16_t counts[PROFILE_BUCKETS] = { 1, 1, 2, 2, 1, 0, 0, 2, 2 };
+  uint32_t total = 0;
+  for(int i=0; i<sizeof(times)/sizeof(times[0]); i++) {
+    isr(PROFILE_XBEE_RX, times[i]);
+    total += times[i];
+  }
+
+  profile_stats_t stats = profile_get_stats(PROFILE_XBEE_RX);
+  assert(stats.count == sizeof(times)/sizeof(times[0]));
+  assert(stats.total == total);
+  assert(stats.max   == 5000);
+  for(int b=0; b<PROFILE_BUCKETS; b++) {
+    assert(stats.histogram[b] == counts[b]);
+  }
+
+  // other vectors are kept apart
+  assert(profile_get_stats(PROFILE_GPS_RX).count == 0);
+}
+
+// across the wrap of the us clock, and beyond the 16-bit maximum
+void test_wrap(void) {
+  profile_reset();
+  current_micros = 0xFFFFFFFFUL - 10;
+  isr(PROFILE_CLOCK, 20);
+  isr(PROFILE_CLOCK, 100000);
+
+  profile_stats_t stats = profile_get_stats(PROFILE_CLOCK);
+  assert(stats.count == 2);
+  assert(stats.total == 20 + 0xFFFF);
+  assert(stats.max   == 0xFFFF);
+  assert(stats.histogram[5] == 1);
+  assert(stats.histogram[PROFILE_BUCKETS-1] == 1);
+}
+
+void test_latency(void) {
+  profile_reset();
+  assert(profile_get_max_latency() == 0);
+  profile_latency(12);
+  profile_latency(250);
+  profile_latency(40);
+  assert(profile_get_max_latency() == 250);
+  profile_reset();
+  assert(profile_get_max_latency() == 0);
+}
+
+int main(void) {
+  test_histogram();
+  test_wrap();
+  test_latency();
+
+  isr(PROFILE_XBEE_TX, 3);
+  profile_latency(87);
+  profile_dump();
+
+  exit(EXIT_SUCCESS);
+}
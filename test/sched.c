@@ -0,0 +1,201 @@
+// sched.c
+// author: Christophe VG
+
+// tests for the cooperative scheduler
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <setjmp.h>
+
+#include "../sched.h"
+#include "../sleep.h"
+
+// stand-ins for the clock, the interrupt lock and sleeping
+unsigned long current_millis;
+
+unsigned long clock_get_millis(void) { return current_millis; }
+uint32_t      clock_get_micros(void) { return current_millis * 1000; }
+
+uint8_t host_irq_save(void)               { return 0; }
+void    host_irq_restore(uint8_t *state)  {}
+void    host_irq_on(uint8_t *state)       {}
+
+// sleeping returns to the test, with how deep and how long it would sleep
+sleep_guard_t guard;
+int           guards;
+uint8_t       slept_level;
+uint32_t      slept_ms;
+jmp_buf       woken;
+
+bool sleep_guard(sleep_guard_t new_guard) {
+  guard = new_guard;
+  guards++;
+  return TRUE;
+}
+
+bool sleep_idle(uint32_t ms) {
+  slept_level = guard();
+  slept_ms    = ms;
+  longjmp(woken, 1);
+}
+
+#define EVENT_A 0x10
+#define EVENT_B 0x20
+
+char trace[64];
+
+void trace_add(char c) {
+  trace[strlen(trace)] = c;
+}
+
+// runs all tasks that can run, returns the order in which they ran
+char *run_all(void) {
+  memset(trace, 0, sizeof(trace));
+  timer_process();
+  while( sched_step() ) { timer_process(); }
+  return trace;
+}
+
+// a multi-step protocol: waits for an event, a while, and an event again
+int step;
+
+sched_state_t protocol(sched_task_t *task) {
+  SCHED_BEGIN(task);
+  step = 1;
+  SCHED_WAIT_EVENT(task);
+  step = 2;
+  SCHED_WAIT_MS(task, 10);
+  step = 3;
+  SCHED_WAIT_UNTIL(task, current_millis >= 1020);
+  step = 4;
+  SCHED_END(task);
+}
+
+void test_protothread(void) {
+  sched_task_t task;
+
+  current_millis = 1000;
+  sched_init();
+  timer_init();
+  sched_add(&task, protocol, EVENT_A, 0);
+
+  run_all();
+  assert(step == 1);
+  run_all();
+  assert(step == 1);                      // nothing signalled
+  sched_signal(EVENT_B);
+  run_all();
+  assert(step == 1);                      // not one of its events
+  sched_signal(EVENT_A);
+  run_all();
+  assert(step == 2);
+  current_millis += 9;
+  run_all();
+  assert(step == 2);
+  current_millis += 1;
+  run_all();
+  assert(step == 3);                      // the condition doesn't hold yet
+  current_millis += 10;
+  sched_signal(EVENT_A);
+  run_all();
+  assert(step == 4);
+  sched_signal(EVENT_A);                  // exited, so removed
+  assert(! sched_step());
+}
+
+// tasks with a higher priority go first, equal ones take turns
+sched_state_t task_a(sched_task_t *task) { trace_add('a'); return SCHED_WAITING; }
+sched_state_t task_b(sched_task_t *task) { trace_add('b'); return SCHED_WAITING; }
+sched_state_t task_c(sched_task_t *task) { trace_add('c'); return SCHED_WAITING; }
+
+int yields;
+
+sched_state_t task_y(sched_task_t *task) {
+  trace_add('y');
+  return ++yields < 3 ? SCHED_YIELDED : SCHED_WAITING;
+}
+
+void test_priorities(void) {
+  sched_task_t a, b, c, y;
+
+  current_millis = 2000;
+  sched_init();
+  timer_init();
+  sched_add(&y, task_y, 0,       2);
+  sched_add(&b, task_b, EVENT_B, 1);
+  sched_add(&c, task_c, EVENT_B, 1);
+  sched_add(&a, task_a, EVENT_A, 0);
+  assert(strcmp(run_all(), "abcyyy") == 0);     // all run once at first
+  assert(strcmp(run_all(), "") == 0);
+
+  sched_signal(EVENT_B);
+  sched_signal(EVENT_A);
+  assert(strcmp(run_all(), "abc") == 0);
+  sched_signal(EVENT_B);
+  assert(strcmp(run_all(), "bc") == 0);
+
+  // the latency is measured from the first signal to the task that runs
+  sched_signal(EVENT_B);
+  current_millis += 5;
+  sched_signal(EVENT_A);
+  run_all();
+  assert(sched_get_stats().max_latency == 5000);
+
+  sched_remove(&a);
+  sched_signal(EVENT_A | EVENT_B);
+  assert(strcmp(run_all(), "bc") == 0);
+}
+
+// tasks with the same priority that keep yielding, don't starve each other
+sched_state_t task_p(sched_task_t *task) { trace_add('p'); return SCHED_YIELDED; }
+sched_state_t task_q(sched_task_t *task) { trace_add('q'); return SCHED_YIELDED; }
+
+void test_turns(void) {
+  sched_task_t p, q, a;
+
+  sched_init();
+  sched_add(&p, task_p, 0,       1);
+  sched_add(&q, task_q, 0,       1);
+  sched_add(&a, task_a, EVENT_A, 0);
+  memset(trace, 0, sizeof(trace));
+  for(int i=0; i<6; i++) {
+    if( i == 3 ) { sched_signal(EVENT_A); }
+    sched_step();
+  }
+  assert(strcmp(trace, "apqapq") == 0);
+}
+
+// the CPU sleeps until the next deadline of a timer, as deep as the guards
+// allow, and not at all when an event was signalled
+void test_idle(void) {
+  sched_task_t task;
+
+  current_millis = 3000;
+  sched_init();
+  timer_init();
+  assert(guards == 1);                    // only added once
+  sched_add(&task, protocol, EVENT_A, 0);
+  run_all();
+  sched_signal(EVENT_A);
+  run_all();
+  assert(step == 2);                      // waits 10ms
+
+  current_millis += 4;
+  if( setjmp(woken) == 0 ) { sched_run(); }
+  assert(slept_level == SLEEP_DEEP && slept_ms == 6);
+  assert(sched_get_stats().sleeps == 1);
+
+  // an event that is signalled right before sleeping
+  sched_signal(EVENT_B);
+  assert(guard() == SLEEP_BUSY);
+}
+
+int main(void) {
+  test_protothread();
+  test_priorities();
+  test_turns();
+  test_idle();
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,181 @@
+// telemetry.c
+// author: Christophe VG
+
+// tests for the compact telemetry encoding
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../telemetry.h"
+
+#define CHANNELS 3
+#define SAMPLES  2000
+#define BLOCK    80           // XB_MAX_PAYLOAD minus a message type and more
+
+uint32_t times[SAMPLES];
+uint16_t values[SAMPLES][CHANNELS];
+
+// samples every 100ms with a little jitter, slowly changing noisy readings
+void generate(void) {
+  uint32_t time = 123456;
+  srand(42);
+  for(int i=0; i<SAMPLES; i++) {
+    time += 100 + rand() % 3 - 1;
+    times[i] = time;
+    for(int c=0; c<CHANNELS; c++) {
+      values[i][c] = 512 + c * 100 + (i / 20) % 50 + rand() % 7 - 3;
+    }
+  }
+}
+
+// encodes all samples into blocks, returns the number of blocks
+int encode(uint8_t blocks[][BLOCK], uint8_t *sizes, uint8_t interval) {
+  telemetry_encoder_t encoder;
+  int                 count = 0;
+
+  telemetry_init(&encoder, CHANNELS, interval);
+  telemetry_begin(&encoder, blocks[count], BLOCK);
+  for(int i=0; i<SAMPLES; i++) {
+    if( ! telemetry_add(&encoder, times[i], values[i]) ) {
+      sizes[count] = telemetry_end(&encoder);
+      assert(sizes[count] > 0 && sizes[count] <= BLOCK);
+      telemetry_begin(&encoder, blocks[++count], BLOCK);
+      assert(telemetry_add(&encoder, times[i], values[i]));
+    }
+  }
+  sizes[count] = telemetry_end(&encoder);
+  return count + 1;
+}
+
+// decodes a block and checks its samples, starting at sample index
+int check(telemetry_decoder_t *decoder, uint8_t *block, uint8_t size,
+          int index)
+{
+  uint32_t time;
+  uint16_t decoded[CHANNELS];
+  while( telemetry_decode_next(decoder, &time, decoded) ) {
+    assert(time == times[index]);
+    assert(memcmp(decoded, values[index], sizeof(decoded)) == 0);
+    index++;
+  }
+  return index;
+}
+
+void test_round_trip(void) {
+  static uint8_t      blocks[SAMPLES][BLOCK];
+  uint8_t             sizes[SAMPLES];
+  telemetry_decoder_t decoder;
+  int                 count, index = 0, bytes = 0;
+
+  count = encode(blocks, sizes, 8);
+  telemetry_decoder_init(&decoder, CHANNELS);
+  for(int b=0; b<count; b++) {
+    assert(telemetry_decode_begin(&decoder, blocks[b], sizes[b]));
+    index = check(&decoder, blocks[b], sizes[b], index);
+    bytes += sizes[b];
+  }
+  assert(index == SAMPLES);
+
+  // raw: a 32-bit timestamp and 16-bit values
+  int raw = SAMPLES * (4 + 2 * CHANNELS);
+  printf("%d samples: %d bytes raw, %d bytes in %d blocks = %.1fx\n",
+         SAMPLES, raw, bytes, count, (double)raw / bytes);
+  assert(raw >= 3 * bytes);
+}
+
+void test_loss(void) {
+  static uint8_t      blocks[SAMPLES][BLOCK];
+  uint8_t             sizes[SAMPLES];
+  telemetry_decoder_t decoder;
+  int                 index = 0;
+
+  int count = encode(blocks, sizes, 4);
+  assert(count > 12);
+  telemetry_decoder_init(&decoder, CHANNELS);
+
+  // blocks 0-1 are fine, 2 is lost, 3 can't be decoded, 4 is a keyframe
+  for(int b=0; b<2; b++) {
+    assert(telemetry_decode_begin(&decoder, blocks[b], sizes[b]));
+    index = check(&decoder, blocks[b], sizes[b], index);
+  }
+  // a duplicate is refused, without losing sync
+  assert(! telemetry_decode_begin(&decoder, blocks[1], sizes[1]));
+  assert(! telemetry_decode_begin(&decoder, blocks[3], sizes[3]));
+  assert(! decoder.synced);
+  assert(blocks[4][1] & 0x80);
+  assert(telemetry_decode_begin(&decoder, blocks[4], sizes[4]));
+
+  // find the index of the first sample of block 4 and continue from there
+  uint32_t time;
+  uint16_t decoded[CHANNELS];
+  assert(telemetry_decode_next(&decoder, &time, decoded));
+  while( times[index] != time ) { index++; }
+  assert(memcmp(decoded, values[index], sizeof(decoded)) == 0);
+  index = check(&decoder, blocks[4], sizes[4], index + 1);
+  for(int b=5; b<count; b++) {
+    assert(telemetry_decode_begin(&decoder, blocks[b], sizes[b]));
+    index = check(&decoder, blocks[b], sizes[b], index);
+  }
+  assert(index == SAMPLES);
+
+  // a truncated block is detected and requires a keyframe
+  telemetry_decoder_init(&decoder, CHANNELS);
+  assert(telemetry_decode_begin(&decoder, blocks[0], sizes[0] / 2));
+  index = check(&decoder, blocks[0], sizes[0] / 2, 0);
+  assert(index < SAMPLES && ! decoder.synced);
+  assert(! telemetry_decode_begin(&decoder, blocks[1], sizes[1]));
+}
+
+void test_extremes(void) {
+  uint8_t             block[BLOCK];
+  telemetry_encoder_t encoder;
+  telemetry_decoder_t decoder;
+  uint32_t            time[]     = { 0xFFFFFFF0, 5, 5, 0x80000000, 7 };
+  uint16_t            value[][2] = { { 0, 0xFFFF }, { 0xFFFF, 0 }, { 1, 1 },
+                                     { 0x8000, 0x7FFF }, { 0, 0 } };
+  uint32_t            t;
+  uint16_t            v[2];
+
+  telemetry_init(&encoder, 2, 0);
+  telemetry_begin(&encoder, block, sizeof(block));
+  for(int i=0; i<5; i++) { assert(telemetry_add(&encoder, time[i], value[i])); }
+  uint8_t size = telemetry_end(&encoder);
+
+  telemetry_decoder_init(&decoder, 2);
+  assert(telemetry_decode_begin(&decoder, block, size));
+  for(int i=0; i<5; i++) {
+    assert(telemetry_decode_next(&decoder, &t, v));
+    assert(t == time[i] && v[0] == value[i][0] && v[1] == value[i][1]);
+  }
+  assert(! telemetry_decode_next(&decoder, &t, v));
+
+  // without keyframe interval, only on request
+  telemetry_begin(&encoder, block, sizeof(block));
+  assert(telemetry_add(&encoder, 8, value[4]));
+  size = telemetry_end(&encoder);
+  assert(! (block[1] & 0x80));
+  assert(telemetry_decode_begin(&decoder, block, size));
+  assert(telemetry_decode_next(&decoder, &t, v) && t == 8);
+
+  telemetry_keyframe(&encoder);
+  telemetry_begin(&encoder, block, sizeof(block));
+  assert(telemetry_end(&encoder) == 0);         // empty, keyframe postponed
+  telemetry_begin(&encoder, block, sizeof(block));
+  assert(telemetry_add(&encoder, 9, value[4]));
+  telemetry_end(&encoder);
+  assert(block[1] & 0x80);
+
+  // a tiny block can't take a keyframe sample
+  telemetry_begin(&encoder, block, 4);
+  assert(! telemetry_add(&encoder, 0x10000000, value[0]));
+}
+
+int main(void) {
+  generate();
+  test_round_trip();
+  test_loss();
+  test_extremes();
+  exit(EXIT_SUCCESS);
+}
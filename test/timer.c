@@ -0,0 +1,171 @@
+// timer.c
+// author: Christophe VG
+
+// tests for the software timers
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../timer.h"
+
+// stand-ins for the clock and the interrupt lock, timer.c only reads the clock
+unsigned long current_millis;
+
+unsigned long clock_get_millis(void) {
+  return current_millis;
+}
+
+uint8_t host_irq_save(void)               { return 0; }
+void    host_irq_restore(uint8_t *state)  {}
+void    host_irq_on(uint8_t *state)       {}
+
+#define TIMERS 100
+#define ROUNDS 20000
+
+timer_entry_t timers[TIMERS];
+bool          active[TIMERS];         // reference
+time_t        expected[TIMERS];       // reference: next deadline
+uint32_t      periods[TIMERS];
+uint32_t      fired[TIMERS];
+
+void fire(void *data) {
+  timer_entry_t *timer = data;
+  int i = timer - timers;
+  assert(active[i] && expected[i] == current_millis);
+  fired[i]++;
+  active[i]   = periods[i] != 0;
+  expected[i] = current_millis + periods[i];
+}
+
+// random timers, started, restarted and cancelled, must fire exactly on time
+void test_random(uint32_t start) {
+  memset(active, 0, sizeof(active));
+  current_millis = start;
+  timer_init();
+  memset(timers, 0, sizeof(timers));      // forgotten by timer_init()
+  for(int i=0; i<TIMERS; i++) {
+    timer_setup(&timers[i], fire, &timers[i], i % 2 ? TIMER_IN_ISR : 0);
+  }
+  srand(42);
+  for(int round=0; round<ROUNDS; round++) {
+    current_millis++;
+    timer_isr();
+    timer_process();
+    for(int i=0; i<TIMERS; i++) {
+      assert(timer_is_active(&timers[i]) == active[i]);
+    }
+
+    int i = rand() % TIMERS;
+    switch( rand() % 4 ) {
+      case 0:
+        timer_cancel(&timers[i]);
+        active[i] = FALSE;
+        break;
+      case 1:
+      case 2:
+        periods[i] = rand() % 3 ? 0 : 1 + rand() % 100;
+        uint32_t delay = 1 + rand() % ( rand() % 2 ? 20 : 1000 );
+        timer_start(&timers[i], delay, periods[i]);
+        expected[i] = current_millis + delay;
+        active[i]   = TRUE;
+        break;
+    }
+
+    time_t next, reference = 0;
+    bool   any = FALSE;
+    for(int j=0; j<TIMERS; j++) {
+      if( active[j] && ( ! any || (int32_t)(expected[j] - reference) < 0 ) ) {
+        reference = expected[j];
+        any       = TRUE;
+      }
+    }
+    assert(timer_next_deadline(&next) == any);
+    if( any ) { assert(next == reference); }
+  }
+}
+
+// a main loop that is late, calls back expired timers once
+void test_late(void) {
+  current_millis = 1000;
+  timer_init();
+  memset(timers, 0, sizeof(timers));      // forgotten by timer_init()
+  memset(fired, 0, sizeof(fired));
+  timer_setup(&timers[0], fire, &timers[0], 0);
+  timer_setup(&timers[1], fire, &timers[1], 0);
+  periods[0] = 0;
+  periods[1] = 0;
+  timer_start(&timers[0], 10, 0);
+  timer_start(&timers[1], 300, 0);
+  active[0]   = active[1]   = TRUE;
+  expected[0] = expected[1] = current_millis = 1500;
+  timer_process();
+  assert(fired[0] == 1 && fired[1] == 1);
+  assert(! timer_is_active(&timers[0]) && ! timer_is_active(&timers[1]));
+
+  // periodic timers skip the periods that were missed
+  timer_start(&timers[0], 10, 50);
+  current_millis = expected[0] = 2000;
+  active[0]  = TRUE;
+  periods[0] = 50;
+  timer_process();
+  assert(fired[0] == 2 && timer_is_active(&timers[0]));
+  assert(timers[0].deadline == 2050);
+}
+
+// an active timer can't be set up again, it stays in its wheel
+void test_setup_active(void) {
+  current_millis = 8000;
+  timer_init();
+  memset(timers, 0, sizeof(timers));      // forgotten by timer_init()
+  memset(fired, 0, sizeof(fired));
+  assert(timer_setup(&timers[0], fire, &timers[0], 0));
+  timer_start(&timers[0], 10, 0);
+  assert(! timer_setup(&timers[0], fire, &timers[0], TIMER_IN_ISR));
+  assert(timer_is_active(&timers[0]));
+  periods[0]  = 0;
+  active[0]   = TRUE;
+  expected[0] = current_millis = 8010;
+  timer_isr();
+  assert(fired[0] == 0);
+  timer_process();
+  assert(fired[0] == 1 && ! timer_is_active(&timers[0]));
+  assert(timer_setup(&timers[0], fire, &timers[0], 0));
+}
+
+// a callback that restarts its timer without delay, is called back again in
+// the next ms, not over and over again in the same one
+int restarts;
+
+void restart(void *data) {
+  restarts++;
+  timer_start(data, 0, 0);
+}
+
+void test_restart(void) {
+  current_millis = 5000;
+  timer_init();
+  memset(timers, 0, sizeof(timers));      // forgotten by timer_init()
+  timer_setup(&timers[0], restart, &timers[0], 0);
+  timer_start(&timers[0], 0, 0);
+  current_millis++;
+  timer_process();
+  assert(restarts == 1);
+  current_millis++;
+  timer_process();
+  assert(restarts == 2);
+  timer_cancel(&timers[0]);
+  current_millis++;
+  timer_process();
+  assert(restarts == 2);
+}
+
+int main(void) {
+  test_random(0);
+  test_random(0xFFFFFFFFUL - ROUNDS / 2);     // across the wrap of a 32-bit clock
+  test_late();
+  test_restart();
+  test_setup_active();
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,122 @@
+// timesync.c
+// author: Christophe VG
+
+// tests for the time synchronisation of a node, with a local clock that runs
+// at a known skew from the master and round trips with random, asymmetric
+// delays
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../timesync.h"
+
+#define MINUTES   45
+#define SETTLED   20                // minutes before the estimate is checked
+#define TOLERANCE 20                // ppm, with 20ms of jitter each way
+
+// stand-ins for the clock and the xbee driver. the master runs on the true
+// time, the local clock at a skew from it, plus the corrections.
+
+uint64_t true_us;
+int32_t  skew;                      // ppm
+int32_t  corrections;               // ms
+
+unsigned long master_millis(void) {
+  return true_us / 1000;
+}
+
+unsigned long clock_get_millis(void) {
+  int64_t local_us = true_us + (int64_t)true_us * skew / 1000000;
+  return 123456 + local_us / 1000 + corrections;
+}
+
+void clock_adjust(int32_t diff) {
+  corrections += diff;
+}
+
+xbee_rx_handler_t handler;
+
+bool xbee_subscribe(uint8_t type, xbee_rx_handler_t new_handler) {
+  handler = new_handler;
+  return TRUE;
+}
+
+uint16_t xbee_get_nw_address(void) {
+  return 0x1234;
+}
+
+void xbee_send(xbee_tx_t *frame) {
+  assert(0);                        // only the master responds
+}
+
+// a request is answered once it reached the master, the response is delivered
+// once it made it back
+uint8_t  response[10];
+bool     underway;
+uint64_t arrives;
+
+uint32_t delay(void) {
+  uint32_t us = 20000 + random() % 20000;
+  if( random() % 5 == 0 ) { us += 50000 + random() % 100000; }  // queueing
+  return us;
+}
+
+void xbee_send_to(xbee_dest_t *dest, const xbee_iov_t *iov, uint8_t count) {
+  assert(count == 1 && iov[0].size == 6);
+  assert(iov[0].data[0] == TIMESYNC_MSG_REQUEST);
+  uint64_t at_master = true_us + delay();
+  unsigned long t2 = at_master / 1000;
+
+  response[0] = TIMESYNC_MSG_RESPONSE;
+  memcpy(&response[1], &iov[0].data[1], 5);
+  response[6] = t2 >> 24;
+  response[7] = t2 >> 16;
+  response[8] = t2 >>  8;
+  response[9] = t2;
+  arrives  = at_master + delay();
+  underway = TRUE;
+}
+
+void run(int32_t new_skew) {
+  true_us     = 0;
+  skew        = new_skew;
+  corrections = 0;
+  underway    = FALSE;
+  assert(timesync_init(FALSE));
+
+  for(uint64_t ms=0; ms<MINUTES*60*1000UL; ms++) {
+    true_us = ms * 1000;
+    if( underway && true_us >= arrives ) {
+      underway = FALSE;
+      xbee_rx_t rx = { .data = response, .size = sizeof(response) };
+      handler(&rx);
+    }
+    timesync_process();
+
+    if( ms >= SETTLED*60*1000UL && ms % 1000 == 0 ) {
+      timesync_status_t status = timesync_get_status();
+      int32_t error = (int32_t)(clock_get_millis() - master_millis());
+      if( status.drift < skew - TOLERANCE || status.drift > skew + TOLERANCE ||
+          error < -TIMESYNC_STEP || error > TIMESYNC_STEP )
+      {
+        printf("skew %d ppm: estimated %d ppm, off by %d ms after %lu s\n",
+               skew, status.drift, error, (unsigned long)(ms / 1000));
+        fflush(stdout);
+        assert(0);
+      }
+    }
+  }
+}
+
+int main(void) {
+  srandom(1234);
+
+  int32_t skews[] = { 0, -3, 84, -250, 400 };
+  for(uint8_t i=0; i<sizeof(skews)/sizeof(skews[0]); i++) {
+    run(skews[i]);
+  }
+
+  exit(EXIT_SUCCESS);
+}
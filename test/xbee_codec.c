@@ -0,0 +1,344 @@
+// xbee_codec.c
+// author: Christophe VG
+
+// tests for the XBee API frame codec, with frames taken from the XBee manual
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "../xbee_codec.h"
+
+// TX request to 0013A200400A0127, nw unknown, frame id 1, data "TxData0A"
+uint8_t tx_frame[] = {
+  0x7E, 0x00, 0x16, 0x10, 0x01, 0x00, 0x13, 0xA2, 0x00, 0x40, 0x0A, 0x01,
+  0x27, 0xFF, 0xFE, 0x00, 0x00, 0x54, 0x78, 0x44, 0x61, 0x74, 0x61, 0x30,
+  0x41, 0x13
+};
+
+// RX packet from 0013A20040522BAA, nw 7D84, acknowledged, data "RxData"
+uint8_t rx_frame[] = {
+  0x7E, 0x00, 0x12, 0x90, 0x00, 0x13, 0xA2, 0x00, 0x40, 0x52, 0x2B, 0xAA,
+  0x7D, 0x84, 0x01, 0x52, 0x78, 0x44, 0x61, 0x74, 0x61, 0x0D
+};
+
+// explicit TX to 0013A20001238456, endpoints A0 -> A1, cluster 1554, profile
+// C105, data "TxData"
+uint8_t tx_explicit_frame[] = {
+  0x7E, 0x00, 0x1A, 0x11, 0x01, 0x00, 0x13, 0xA2, 0x00, 0x01, 0x23, 0x84,
+  0x56, 0xFF, 0xFE, 0xA0, 0xA1, 0x15, 0x54, 0xC1, 0x05, 0x00, 0x00, 0x54,
+  0x78, 0x44, 0x61, 0x74, 0x61, 0x87
+};
+
+// explicit RX from 0013A20040522BAA, nw 7D84, endpoints E0 -> E0, cluster
+// 2211, profile C105, broadcast, data "RxData"
+uint8_t rx_explicit_frame[] = {
+  0x7E, 0x00, 0x18, 0x91, 0x00, 0x13, 0xA2, 0x00, 0x40, 0x52, 0x2B, 0xAA,
+  0x7D, 0x84, 0xE0, 0xE0, 0x22, 0x11, 0xC1, 0x05, 0x02, 0x52, 0x78, 0x44,
+  0x61, 0x74, 0x61, 0x52
+};
+
+// AT command NJ, frame id 0x52
+uint8_t at_frame[] = { 0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x4A, 0x0D };
+
+// feeds bytes to a parser, returns the last result
+xbee_parse_result_t parse(xbee_parser_t *parser, uint8_t *bytes, int size) {
+  xbee_parse_result_t result = XB_PARSE_MORE;
+  for(int i=0; i<size; i++) {
+    result = xbee_parse(parser, bytes[i]);
+    if( result != XB_PARSE_MORE ) { assert(i == size - 1); }
+  }
+  return result;
+}
+
+void test_encode_tx(void) {
+  xbee_dest_t dest;
+  uint8_t     header[XB_TX_HEADER_SIZE];
+  uint8_t     buffer[64];
+
+  xbee_dest_init(&dest, 0x0013A200400A0127, XB_NW_ADDR_UNKNOWN,
+                 XB_MAX_RADIUS, XB_OPT_NONE);
+  assert(dest.resolve);
+
+  xbee_iov_t data[] = {
+    { header, xbee_encode_tx(header, 0x01, &dest) },
+    { (uint8_t*)"TxData", 6 },
+    { (uint8_t*)"0A",     2 }
+  };
+
+  assert(xbee_encode(buffer, sizeof(buffer), data, 3, FALSE)
+         == sizeof(tx_frame));
+  assert(memcmp(buffer, tx_frame, sizeof(tx_frame)) == 0);
+
+  // the precomputed checksum equals the checksum over the addressing bytes
+  assert(dest.checksum == xbee_sum(&tx_frame[5], 12));
+
+  // too small
+  assert(xbee_encode(buffer, sizeof(tx_frame) - 1, data, 3, FALSE) == 0);
+}
+
+void test_decode_tx(void) {
+  uint8_t   frame[sizeof(tx_frame)];
+  xbee_tx_t tx;
+
+  memcpy(frame, tx_frame, sizeof(frame));
+  assert(xbee_decode_tx(&frame[3], sizeof(frame) - 4, &tx));
+  assert(tx.id         == 0x01);
+  assert(tx.address    == 0x0013A200400A0127);
+  assert(tx.nw_address == XB_NW_ADDR_UNKNOWN);
+  assert(tx.size       == 8);
+  assert(memcmp(tx.data, "TxData0A", 8) == 0);
+  assert(tx.data == &frame[3 + XB_TX_HEADER_SIZE]);  // zero copy
+
+  assert(! xbee_decode_rx(&frame[3], sizeof(frame) - 4, NULL));
+}
+
+void test_rx(void) {
+  xbee_parser_t parser;
+  uint8_t       buffer[XB_RX_HEADER_SIZE + XB_MAX_PAYLOAD];
+  xbee_rx_t     rx;
+
+  xbee_parser_init(&parser, buffer, sizeof(buffer), FALSE);
+  assert(parse(&parser, rx_frame, sizeof(rx_frame)) == XB_PARSE_FRAME);
+  assert(parser.length == 0x12);
+
+  assert(xbee_decode_rx(buffer, parser.length, &rx));
+  assert(rx.address    == 0x0013A20040522BAA);
+  assert(rx.nw_address == 0x7D84);
+  assert(rx.options    == XB_RX_OPT_ACK);
+  assert(rx.size       == 6);
+  assert(memcmp(rx.data, "RxData", 6) == 0);
+
+  // and back again
+  uint8_t    header[XB_RX_HEADER_SIZE];
+  uint8_t    frame[64];
+  xbee_iov_t data[] = {
+    { header, xbee_encode_rx(header, &rx) },
+    { rx.data, rx.size }
+  };
+  assert(xbee_encode(frame, sizeof(frame), data, 2, FALSE) == sizeof(rx_frame));
+  assert(memcmp(frame, rx_frame, sizeof(rx_frame)) == 0);
+}
+
+void test_explicit(void) {
+  xbee_dest_t     dest;
+  xbee_endpoint_t endpoint = { 0xA0, 0xA1, 0x1554, XB_DIGI_PROFILE };
+  uint8_t         header[XB_TX_EXPLICIT_HEADER_SIZE];
+  uint8_t         buffer[64];
+  xbee_tx_t       tx;
+  xbee_rx_t       rx;
+
+  xbee_dest_init(&dest, 0x0013A20001238456, XB_NW_ADDR_UNKNOWN,
+                 XB_MAX_RADIUS, XB_OPT_NONE);
+  xbee_iov_t data[] = {
+    { header, xbee_encode_tx_explicit(header, 0x01, &dest, &endpoint) },
+    { (uint8_t*)"TxData", 6 }
+  };
+  assert(xbee_encode(buffer, sizeof(buffer), data, 2, FALSE)
+         == sizeof(tx_explicit_frame));
+  assert(memcmp(buffer, tx_explicit_frame, sizeof(tx_explicit_frame)) == 0);
+
+  assert(xbee_decode_tx(&buffer[3], sizeof(tx_explicit_frame) - 4, &tx));
+  assert(tx.address == 0x0013A20001238456 && tx.id == 0x01);
+  assert(tx.endpoint.source == 0xA0 && tx.endpoint.destination == 0xA1);
+  assert(tx.endpoint.cluster == 0x1554 && tx.endpoint.profile == 0xC105);
+  assert(tx.radius == XB_MAX_RADIUS && tx.options == XB_OPT_NONE);
+  assert(tx.size == 6 && memcmp(tx.data, "TxData", 6) == 0);
+
+  // plain frames are decoded as coming from and going to the data endpoint
+  memcpy(buffer, tx_frame, sizeof(tx_frame));
+  assert(xbee_decode_tx(&buffer[3], sizeof(tx_frame) - 4, &tx));
+  assert(tx.endpoint.destination == XB_DATA_ENDPOINT);
+  assert(tx.endpoint.cluster == XB_DATA_CLUSTER);
+  memcpy(buffer, rx_frame, sizeof(rx_frame));
+  assert(xbee_decode_rx(&buffer[3], sizeof(rx_frame) - 4, &rx));
+  assert(rx.endpoint.source == XB_DATA_ENDPOINT);
+  assert(rx.endpoint.profile == XB_DIGI_PROFILE);
+
+  memcpy(buffer, rx_explicit_frame, sizeof(rx_explicit_frame));
+  assert(xbee_decode_rx(&buffer[3], sizeof(rx_explicit_frame) - 4, &rx));
+  assert(rx.address == 0x0013A20040522BAA && rx.nw_address == 0x7D84);
+  assert(rx.endpoint.source == 0xE0 && rx.endpoint.destination == 0xE0);
+  assert(rx.endpoint.cluster == 0x2211 && rx.endpoint.profile == 0xC105);
+  assert(rx.options == XB_RX_OPT_BROADCAST);
+  assert(rx.size == 6 && memcmp(rx.data, "RxData", 6) == 0);
+  assert(! xbee_decode_rx(&buffer[3], XB_RX_EXPLICIT_HEADER_SIZE - 1, &rx));
+
+  // and back again
+  uint8_t    rx_header[XB_RX_EXPLICIT_HEADER_SIZE];
+  xbee_iov_t rx_data[] = {
+    { rx_header, xbee_encode_rx_explicit(rx_header, &rx) },
+    { rx.data, rx.size }
+  };
+  uint8_t frame[64];
+  assert(xbee_encode(frame, sizeof(frame), rx_data, 2, FALSE)
+         == sizeof(rx_explicit_frame));
+  assert(memcmp(frame, rx_explicit_frame, sizeof(rx_explicit_frame)) == 0);
+}
+
+void test_at(void) {
+  uint8_t    header[XB_AT_HEADER_SIZE];
+  uint8_t    frame[16];
+  xbee_iov_t data = { header, xbee_encode_at(header, 0x52, 'N', 'J') };
+
+  assert(xbee_encode(frame, sizeof(frame), &data, 1, FALSE) == sizeof(at_frame));
+  assert(memcmp(frame, at_frame, sizeof(at_frame)) == 0);
+
+  xbee_at_t at;
+  assert(xbee_decode_at(&frame[3], data.size, &at));
+  assert(at.id == 0x52 && at.command[0] == 'N' && at.command[1] == 'J');
+  assert(at.size == 0);
+
+  // response to MY: 0x1234
+  uint8_t    value[] = { 0x12, 0x34 };
+  xbee_at_t  response = { 0x01, { 'M', 'Y' }, XB_AT_OK, value, 2 };
+  uint8_t    response_header[XB_AT_RESPONSE_HEADER_SIZE];
+  xbee_iov_t response_data[] = {
+    { response_header, xbee_encode_at_response(response_header, &response) },
+    { value, sizeof(value) }
+  };
+  uint16_t size = xbee_encode(frame, sizeof(frame), response_data, 2, FALSE);
+  assert(size == 5 + 2 + XB_FRAME_OVERHEAD);
+  assert(xbee_decode_at_response(&frame[3], size - XB_FRAME_OVERHEAD, &at));
+  assert(at.id == 0x01 && at.command[0] == 'M' && at.status == XB_AT_OK);
+  assert(at.size == 2 && at.data[0] == 0x12 && at.data[1] == 0x34);
+}
+
+void test_status(void) {
+  uint8_t frame[XB_TX_STATUS_SIZE];
+  uint8_t status;
+
+  xbee_encode_modem_status(frame, XB_MODEM_JOINED);
+  assert(xbee_decode_modem_status(frame, XB_MODEM_STATUS_SIZE, &status));
+  assert(status == XB_MODEM_JOINED);
+
+  xbee_tx_status_t tx = { 0x47, 0x7D84, 2, XB_DELIVERY_OK, 0x01 }, decoded;
+  xbee_encode_tx_status(frame, &tx);
+  assert(xbee_decode_tx_status(frame, XB_TX_STATUS_SIZE, &decoded));
+  assert(decoded.id == 0x47 && decoded.nw_address == 0x7D84);
+  assert(decoded.retries == 2 && decoded.delivery == XB_DELIVERY_OK);
+  assert(! xbee_decode_tx_status(frame, XB_TX_STATUS_SIZE - 1, &decoded));
+}
+
+void test_escaping(void) {
+  // payload full of bytes that need escaping
+  uint8_t       payload[] = { 0x7E, 0x7D, 0x11, 0x13, 0x42 };
+  uint8_t       frame[32], buffer[32];
+  xbee_iov_t    data = { payload, sizeof(payload) };
+  xbee_parser_t parser;
+
+  uint16_t size = xbee_encode(frame, sizeof(frame), &data, 1, TRUE);
+  assert(size == 1 + 2 + 5 + 4 + 1);   // 4 escaped bytes
+  for(int i=1; i<size; i++) { assert(frame[i] != XB_FRAME_START); }
+
+  xbee_parser_init(&parser, buffer, sizeof(buffer), TRUE);
+  assert(parse(&parser, frame, size) == XB_PARSE_FRAME);
+  assert(parser.length == sizeof(payload));
+  assert(memcmp(buffer, payload, sizeof(payload)) == 0);
+
+  // a start delimiter resynchronizes in the middle of a frame
+  xbee_parser_init(&parser, buffer, sizeof(buffer), TRUE);
+  assert(parse(&parser, frame, 5) == XB_PARSE_MORE);
+  assert(parse(&parser, frame, size) == XB_PARSE_FRAME);
+}
+
+void test_errors(void) {
+  xbee_parser_t parser;
+  uint8_t       buffer[16];
+  uint8_t       bad[sizeof(at_frame)];
+  uint8_t       garbage[] = { 0x00, 0x42, 0x13 };
+
+  xbee_parser_init(&parser, buffer, sizeof(buffer), FALSE);
+
+  // garbage is skipped
+  assert(parse(&parser, garbage, sizeof(garbage)) == XB_PARSE_MORE);
+  assert(parse(&parser, at_frame, sizeof(at_frame)) == XB_PARSE_FRAME);
+
+  // checksum errors are reported
+  memcpy(bad, at_frame, sizeof(bad));
+  bad[5]++;
+  assert(parse(&parser, bad, sizeof(bad)) == XB_PARSE_CHECKSUM_ERROR);
+
+  // frames that don't fit are skipped, including 0x7E bytes in them
+  assert(parse(&parser, tx_frame, sizeof(tx_frame)) == XB_PARSE_OVERSIZE);
+  assert(parse(&parser, at_frame, sizeof(at_frame)) == XB_PARSE_FRAME);
+}
+
+void test_scan(void) {
+  uint8_t      stream[64];
+  xbee_frame_t frame;
+  int          size = 0;
+
+  stream[size++] = 0x42;                                  // garbage
+  memcpy(&stream[size], at_frame, sizeof(at_frame));      // valid
+  size += sizeof(at_frame);
+  memcpy(&stream[size], at_frame, sizeof(at_frame));      // bad checksum
+  stream[size + 5]++;
+  size += sizeof(at_frame);
+  memcpy(&stream[size], rx_frame, 10);                    // incomplete
+  size += 10;
+
+  assert(xbee_scan(stream, size, &frame) == XB_PARSE_FRAME);
+  assert(frame.data == &stream[4]);                       // in place
+  assert(frame.length == 4 && frame.consumed == 1 + sizeof(at_frame));
+
+  int offset = frame.consumed;
+  assert(xbee_scan(&stream[offset], size - offset, &frame)
+         == XB_PARSE_CHECKSUM_ERROR);
+  assert(frame.consumed == 1);
+
+  offset += frame.consumed;
+  assert(xbee_scan(&stream[offset], size - offset, &frame) == XB_PARSE_MORE);
+  assert(offset + frame.consumed == 1 + 2 * sizeof(at_frame));
+}
+
+// encodes and scans frames with a full payload in a big buffer
+void bench_scan(void) {
+  static uint8_t stream[1 << 20];
+  uint8_t        payload[XB_MAX_PAYLOAD];
+  xbee_rx_t      rx = { 0, 0x0013A20040522BAA, 0x7D84, XB_RX_OPT_ACK, NULL };
+  uint8_t        header[XB_RX_HEADER_SIZE];
+  xbee_iov_t     data[] = {
+    { header,  xbee_encode_rx(header, &rx) },
+    { payload, sizeof(payload) }
+  };
+  uint32_t size = 0, frames = 0;
+  clock_t  start;
+
+  for(int i=0; i<sizeof(payload); i++) { payload[i] = i; }
+  while( size + 128 < sizeof(stream) ) {
+    size += xbee_encode(&stream[size], 128, data, 2, FALSE);
+  }
+
+  start = clock();
+  for(int round=0; round<20; round++) {
+    xbee_frame_t frame;
+    uint32_t     offset = 0;
+    while( xbee_scan(&stream[offset], size - offset, &frame)
+           == XB_PARSE_FRAME )
+    {
+      assert(xbee_decode_rx(frame.data, frame.length, &rx));
+      offset += frame.consumed;
+      frames++;
+    }
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("scanned %u frames of %u bytes in %.3fs = %.0f frames/s\n",
+         frames, (unsigned int)sizeof(payload), seconds, frames / seconds);
+}
+
+int main(void) {
+  test_encode_tx();
+  test_decode_tx();
+  test_rx();
+  test_explicit();
+  test_at();
+  test_status();
+  test_escaping();
+  test_errors();
+  test_scan();
+  bench_scan();
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,204 @@
+// timer.c
+// author: Christophe VG <contact@christophe.vg>
+
+// software timers in a hashed timing wheel (see timer.h)
+
+#include <stddef.h>
+#include <util/atomic.h>
+
+#include "timer.h"
+
+#if TIMER_SLOTS < 2 || TIMER_SLOTS > 256 || (TIMER_SLOTS & (TIMER_SLOTS - 1))
+#error "TIMER_SLOTS must be a power of 2, at most 256"
+#endif
+
+#define MASK (TIMER_SLOTS - 1)
+
+// true if time a is at or before time b, also across the wrap of the clock
+#define NOT_AFTER(a, b) ((int32_t)((a) - (b)) <= 0)
+
+typedef struct {
+  timer_entry_t *slots[TIMER_SLOTS];
+  time_t         cursor;                // the last visited ms
+} wheel_t;
+
+// forward declarations of "private" functions
+static wheel_t       *_wheel(timer_entry_t *timer);
+static void           _insert(wheel_t *wheel, timer_entry_t *timer);
+static void           _remove(wheel_t *wheel, timer_entry_t *timer);
+static void           _advance(wheel_t *wheel, time_t now);
+static timer_entry_t *_expired(wheel_t *wheel, uint8_t slot, time_t now);
+static bool           _earliest(wheel_t *wheel, time_t *deadline);
+static void           _alarm(void);
+
+static wheel_t wheel;                   // main loop class
+static wheel_t isr_wheel;               // TIMER_IN_ISR class
+
+void timer_init(void) {
+  time_t now = clock_get_millis();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(uint16_t i=0; i<TIMER_SLOTS; i++) {
+      wheel.slots[i] = isr_wheel.slots[i] = NULL;
+    }
+    wheel.cursor = isr_wheel.cursor = now;
+  }
+}
+
+// an active timer is linked into a wheel, forgetting that corrupts it
+bool timer_setup(timer_entry_t *timer, timer_callback_t callback, void *data,
+                 uint8_t flags)
+{
+  if( timer->flags & TIMER_ACTIVE ) { return FALSE; }
+  timer->callback = callback;
+  timer->data     = data;
+  timer->flags    = flags & TIMER_IN_ISR;
+  return TRUE;
+}
+
+void timer_start(timer_entry_t *timer, uint32_t delay, uint32_t period) {
+  time_t now = clock_get_millis();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    wheel_t *target = _wheel(timer);
+    if( timer->flags & TIMER_ACTIVE ) { _remove(target, timer); }
+    timer->deadline = now + delay;
+    timer->period   = period;
+    _insert(target, timer);
+  }
+#if CLOCK_TICKLESS
+  clock_alarm(timer->deadline);
+#endif
+}
+
+void timer_cancel(timer_entry_t *timer) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if( timer->flags & TIMER_ACTIVE ) { _remove(_wheel(timer), timer); }
+  }
+}
+
+bool timer_is_active(timer_entry_t *timer) {
+  return timer->flags & TIMER_ACTIVE;
+}
+
+void timer_process(void) {
+  _advance(&wheel, clock_get_millis());
+  _alarm();
+}
+
+void timer_isr(void) {
+  _advance(&isr_wheel, clock_get_millis());
+  _alarm();
+}
+
+bool timer_next_deadline(time_t *deadline) {
+  time_t main = 0, isr = 0;
+  bool   has_main, has_isr;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    has_main = _earliest(&wheel, &main);
+    has_isr  = _earliest(&isr_wheel, &isr);
+  }
+  if( has_main && has_isr ) {
+    *deadline = NOT_AFTER(main, isr) ? main : isr;
+  } else if( has_main || has_isr ) {
+    *deadline = has_main ? main : isr;
+  }
+  return has_main || has_isr;
+}
+
+static wheel_t *_wheel(timer_entry_t *timer) {
+  return timer->flags & TIMER_IN_ISR ? &isr_wheel : &wheel;
+}
+
+// timers that are already due go in the slot that is visited next, instead of
+// waiting for their own slot to come around again
+static void _insert(wheel_t *wheel, timer_entry_t *timer) {
+  time_t when = NOT_AFTER(timer->deadline, wheel->cursor) ?
+                  wheel->cursor + 1 : timer->deadline;
+
+  timer->slot = when & MASK;
+  timer->prev = NULL;
+  timer->next = wheel->slots[timer->slot];
+  if( timer->next ) { timer->next->prev = timer; }
+  wheel->slots[timer->slot] = timer;
+  timer->flags |= TIMER_ACTIVE;
+}
+
+static void _remove(wheel_t *wheel, timer_entry_t *timer) {
+  if( timer->prev ) { timer->prev->next = timer->next; }
+  else              { wheel->slots[timer->slot] = timer->next; }
+  if( timer->next ) { timer->next->prev = timer->prev; }
+  timer->flags &= ~TIMER_ACTIVE;
+}
+
+// visits the slots of the ms since the last visit, at most one revolution, as
+// that visits all slots
+static void _advance(wheel_t *wheel, time_t now) {
+  time_t cursor;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if( NOT_AFTER(now, wheel->cursor) ) {
+      wheel->cursor = now;              // nothing passed, or the clock went back
+    } else if( now - wheel->cursor > TIMER_SLOTS ) {
+      wheel->cursor = now - TIMER_SLOTS;
+    }
+    cursor = wheel->cursor;
+  }
+
+  while( cursor != now ) {
+    cursor++;
+    // timers that are started by callbacks and already due, go to the next ms
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      wheel->cursor = cursor;
+    }
+    timer_entry_t *timer;
+    while( (timer = _expired(wheel, cursor & MASK, now)) ) {
+      timer->callback(timer->data);
+    }
+  }
+}
+
+// takes the first expired timer from a slot, restarting periodic ones first,
+// so callbacks are free to start and cancel timers
+static timer_entry_t *_expired(wheel_t *wheel, uint8_t slot, time_t now) {
+  timer_entry_t *timer;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(timer = wheel->slots[slot]; timer; timer = timer->next) {
+      if( NOT_AFTER(timer->deadline, now) ) { break; }
+    }
+    if( timer ) {
+      _remove(wheel, timer);
+      if( timer->period ) {
+        timer->deadline += timer->period;
+        // skip the periods that were missed
+        if( NOT_AFTER(timer->deadline, now) ) {
+          timer->deadline = now + timer->period;
+        }
+        _insert(wheel, timer);
+      }
+    }
+  }
+  return timer;
+}
+
+static bool _earliest(wheel_t *wheel, time_t *deadline) {
+  bool found = FALSE;
+  for(uint16_t i=0; i<TIMER_SLOTS; i++) {
+    for(timer_entry_t *timer = wheel->slots[i]; timer; timer = timer->next) {
+      if( ! found || NOT_AFTER(timer->deadline, *deadline) ) {
+        *deadline = timer->deadline;
+        found     = TRUE;
+      }
+    }
+  }
+  return found;
+}
+
+// in tickless mode, the clock only interrupts for the next deadline. expired
+// timers of the main loop are handled once it runs, until then the clock
+// interrupts every ms, like it would without tickless mode.
+static void _alarm(void) {
+#if CLOCK_TICKLESS
+  time_t next, now = clock_get_millis();
+  if( timer_next_deadline(&next) ) {
+    clock_alarm(NOT_AFTER(next, now) ? now + 1 : next);
+  }
+#endif
+}
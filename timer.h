@@ -0,0 +1,74 @@
+// timer.h
+// author: Christophe VG <contact@christophe.vg>
+
+// software timers, calling back when a deadline on the ms clock has passed
+// timers are kept in a hashed timing wheel: a slot per ms of the wheel, each
+// with an unsorted list of the timers whose deadline falls in it, so starting
+// and cancelling a timer takes constant time. timer_process() visits the slots
+// of the ms that passed since its last call and runs the callbacks of expired
+// timers from the main loop. timers of the TIMER_ISR class are kept in their
+// own wheel, advanced by timer_isr() from the clock interrupt, for callbacks
+// that must be on time and are short. in tickless mode (see clock.h), the
+// clock is asked to interrupt at the next deadline, which also wakes up a
+// main loop that sleeps between events.
+
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "clock.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef TIMER_SLOTS               // ms per revolution of a wheel, power of 2
+#define TIMER_SLOTS 32
+#endif
+
+#ifndef TIMER_ISR                 // call timer_isr() from the clock interrupt
+#define TIMER_ISR   0
+#endif
+
+// flags
+#define TIMER_ACTIVE 0x01         // started, internal
+#define TIMER_IN_ISR 0x02         // class: call back from the clock interrupt
+
+typedef void (*timer_callback_t)(void *data);
+
+// timers are provided by the caller, zeroed (e.g. static) before they are set
+// up the first time, and must stay around while active
+typedef struct timer_entry {
+  struct timer_entry *prev, *next;      // in the slot of its deadline
+  time_t           deadline;
+  uint32_t         period;              // ms, 0 = once
+  timer_callback_t callback;
+  void            *data;
+  uint8_t          flags;
+  uint8_t          slot;                // internal
+} timer_entry_t;
+
+void timer_init(void);
+
+// prepares a timer, flags is 0 or TIMER_IN_ISR. returns FALSE for a timer that
+// is active, cancel it first.
+bool timer_setup(timer_entry_t *timer, timer_callback_t callback, void *data,
+                 uint8_t flags);
+
+// (re)starts a timer, to expire after delay ms and then every period ms
+void timer_start(timer_entry_t *timer, uint32_t delay, uint32_t period);
+
+void timer_cancel(timer_entry_t *timer);
+
+bool timer_is_active(timer_entry_t *timer);
+
+// calls back expired timers, call from the main loop
+void timer_process(void);
+
+// calls back expired TIMER_IN_ISR timers, call from a 1ms interrupt
+void timer_isr(void);
+
+// provides the earliest deadline of all active timers, returns FALSE if none
+bool timer_next_deadline(time_t *deadline);
+
+#endif
@@ -0,0 +1,289 @@
+// timesync.c
+// author: Christophe VG <contact@christophe.vg>
+
+// mesh-wide time synchronisation over XBee (see timesync.h)
+
+#include "timesync.h"
+#include "clock.h"
+
+// forward declarations of "private" functions
+static void     _send_beacon(void);
+static void     _send_request(void);
+static void     _receive_beacon(xbee_rx_t *frame);
+static void     _receive_request(xbee_rx_t *frame);
+static void     _receive_response(xbee_rx_t *frame);
+static void     _sample(int32_t offset, time_t now, uint16_t rtt);
+static void     _record(int32_t offset, time_t raw, uint16_t rtt);
+static int32_t  _estimate_drift(void);
+static void     _adjust(int32_t diff);
+static void     _dispatched(xbee_rx_t *frame);
+static void     _put_time(uint8_t *buffer, time_t time);
+static time_t   _get_time(const uint8_t *buffer);
+
+static bool              master;
+static timesync_status_t status;
+
+static uint8_t  id;                 // of the last request
+static time_t   next;               // next beacon or request
+static time_t   last_process;
+static int32_t  slew;               // ms still to be slewed
+static int32_t  drift_error;        // accumulated ppm*ms of drift
+static uint16_t best_rtt = 0xFFFF;  // ms, shortest recent round trip
+static int32_t  adjusted;           // ms, all corrections of the local clock
+
+// samples for the drift estimate, in terms of the local clock without the
+// corrections, the raw clock, which keeps its own, constant drift
+static struct {
+  time_t   raw;
+  int32_t  offset;                  // ms, of the master to the raw clock
+  uint16_t rtt;
+} history[TIMESYNC_DRIFT_SAMPLES];
+static uint8_t  recorded;           // samples in the history
+static uint8_t  newest;
+
+bool timesync_init(bool is_master) {
+  memset(&status, 0, sizeof(status));
+  master        = is_master;
+  status.synced = master;
+  next          = clock_get_millis();
+  last_process  = next;
+  slew          = 0;
+  drift_error   = 0;
+  best_rtt      = 0xFFFF;
+  adjusted      = 0;
+  recorded      = 0;
+  return xbee_subscribe(TIMESYNC_MSG_BEACON,   _dispatched) &&
+         xbee_subscribe(TIMESYNC_MSG_REQUEST,  _dispatched) &&
+         xbee_subscribe(TIMESYNC_MSG_RESPONSE, _dispatched);
+}
+
+bool timesync_is_synced(void) {
+  return status.synced;
+}
+
+timesync_status_t timesync_get_status(void) {
+  return status;
+}
+
+void timesync_process(void) {
+  time_t now = clock_get_millis();
+
+  if( master ) {
+    if( (int32_t)(now - next) >= 0 ) {
+      _send_beacon();
+      next = now + TIMESYNC_INTERVAL;
+    }
+    return;
+  }
+
+  // nodes that aren't synced don't wait for the next beacon
+  if( (int32_t)(now - next) >= 0 ) {
+    _send_request();
+    next = now + ( status.synced ? TIMESYNC_INTERVAL * 2 : TIMESYNC_RETRY );
+  }
+
+  // corrections are applied every TIMESYNC_SLEW ms
+  int32_t elapsed = now - last_process;
+  if( elapsed < TIMESYNC_SLEW ) { return; }
+  last_process = now;
+
+  // slew the last offset away, one ms at a time
+  if( slew != 0 ) {
+    int8_t step = slew > 0 ? 1 : -1;
+    _adjust(step);
+    slew -= step;
+  }
+
+  // compensate the drift, in ppm of the elapsed time
+  drift_error -= elapsed * status.drift;
+  while( drift_error >=  1000000L ) { _adjust( 1); drift_error -= 1000000L; }
+  while( drift_error <= -1000000L ) { _adjust(-1); drift_error += 1000000L; }
+}
+
+static void _dispatched(xbee_rx_t *frame) {
+  if( frame->size < 1 ) { return; }
+  switch( frame->data[0] ) {
+    case TIMESYNC_MSG_BEACON   : _receive_beacon(frame);   break;
+    case TIMESYNC_MSG_REQUEST  : _receive_request(frame);  break;
+    case TIMESYNC_MSG_RESPONSE : _receive_response(frame); break;
+  }
+}
+
+static void _send_beacon(void) {
+  uint8_t     payload[5];
+  xbee_dest_t dest;
+  xbee_iov_t  data = { payload, sizeof(payload) };
+
+  payload[0] = TIMESYNC_MSG_BEACON;
+  _put_time(&payload[1], clock_get_millis());
+
+  xbee_dest_init(&dest, XB_BROADCAST, XB_NW_BROADCAST, XB_MAX_RADIUS,
+                 XB_OPT_NONE);
+  xbee_send_to(&dest, &data, 1);
+}
+
+static void _send_request(void) {
+  uint8_t     payload[6];
+  xbee_dest_t dest;
+  xbee_iov_t  data = { payload, sizeof(payload) };
+
+  payload[0] = TIMESYNC_MSG_REQUEST;
+  payload[1] = ++id;
+  _put_time(&payload[2], clock_get_millis());
+
+  xbee_dest_init(&dest, XB_COORDINATOR, 0x0000, XB_MAX_RADIUS, XB_OPT_NONE);
+  xbee_send_to(&dest, &data, 1);
+  status.requests++;
+}
+
+// a beacon triggers a request, spread over time by the nw address to avoid
+// that all nodes answer at once
+static void _receive_beacon(xbee_rx_t *frame) {
+  if( master || frame->size < 5 ) { return; }
+  status.beacons++;
+
+  time_t now = clock_get_millis();
+
+  // a first, coarse estimate, without the latency of the beacon
+  if( ! status.synced && status.steps == 0 ) {
+    _adjust(_get_time(&frame->data[1]) - now);
+    status.steps++;
+    now = clock_get_millis();
+  }
+
+  next = now + xbee_get_nw_address() % TIMESYNC_JITTER;
+}
+
+static void _receive_request(xbee_rx_t *frame) {
+  if( ! master || frame->size < 6 ) { return; }
+
+  uint8_t   payload[10];
+  xbee_tx_t response;
+
+  payload[0] = TIMESYNC_MSG_RESPONSE;
+  memcpy(&payload[1], &frame->data[1], 5);    // id and t1
+  _put_time(&payload[6], clock_get_millis());
+
+  response.size       = sizeof(payload);
+  response.id         = XB_TX_NO_RESPONSE;
+  response.address    = frame->address;
+  response.nw_address = frame->nw_address;
+  response.radius     = XB_MAX_RADIUS;
+  response.options    = XB_OPT_NONE;
+  response.data       = payload;
+
+  xbee_send(&response);
+  status.requests++;
+}
+
+static void _receive_response(xbee_rx_t *frame) {
+  if( master || frame->size < 10 || frame->data[1] != id ) { return; }
+
+  time_t   now = clock_get_millis();
+  time_t   t1  = _get_time(&frame->data[2]);
+  time_t   t2  = _get_time(&frame->data[6]);
+  uint32_t rtt = now - t1;
+
+  id++;                                       // accept only one response
+  if( rtt > TIMESYNC_MAX_RTT ) {
+    status.rejected++;
+    return;
+  }
+
+  // queueing makes round trips asymmetric, only trust the shortest ones. the
+  // best round trip slowly follows longer ones, when conditions change.
+  if( rtt < best_rtt ) {
+    best_rtt = rtt;
+  } else {
+    best_rtt += (rtt - best_rtt + 7) / 8;
+  }
+  if( rtt > best_rtt + TIMESYNC_RTT_MARGIN ) {
+    status.rejected++;
+    return;
+  }
+  status.rtt = rtt;
+  _sample((int32_t)(t2 + rtt / 2 - now), now, rtt);
+}
+
+static void _sample(int32_t offset, time_t now, uint16_t rtt) {
+  status.samples++;
+  status.offset = offset;
+  _record(offset + adjusted, now - adjusted, rtt);
+
+  if( ! status.synced || offset > TIMESYNC_STEP || offset < -TIMESYNC_STEP ) {
+    _adjust(offset);
+    status.steps++;
+    slew = 0;
+  } else {
+    slew = offset;
+  }
+
+  status.synced = TRUE;
+}
+
+// one sample per TIMESYNC_DRIFT_SPACING, the one with the shortest round trip,
+// which is the least likely to be asymmetric
+static void _record(int32_t offset, time_t raw, uint16_t rtt) {
+  if( rtt > best_rtt + TIMESYNC_DRIFT_MARGIN ) { return; }
+
+  if( recorded == 0 ||
+      (int32_t)(raw - history[newest].raw) >= TIMESYNC_DRIFT_SPACING )
+  {
+    newest = (newest + 1) % TIMESYNC_DRIFT_SAMPLES;
+    if( recorded < TIMESYNC_DRIFT_SAMPLES ) { recorded++; }
+  } else if( rtt >= history[newest].rtt ) {
+    return;
+  }
+  history[newest].raw    = raw;
+  history[newest].offset = offset;
+  history[newest].rtt    = rtt;
+
+  if( recorded >= 3 ) { status.drift = _estimate_drift(); }
+}
+
+// the slope of a least squares fit of the offsets to the raw clock. relative to
+// the oldest sample, the values stay small enough for the precision of floats.
+static int32_t _estimate_drift(void) {
+  uint8_t oldest = (newest + 1 + TIMESYNC_DRIFT_SAMPLES - recorded)
+                 % TIMESYNC_DRIFT_SAMPLES;
+  float   st = 0, so = 0, stt = 0, sto = 0;
+
+  for(uint8_t i=0; i<recorded; i++) {
+    uint8_t s = (oldest + i) % TIMESYNC_DRIFT_SAMPLES;
+    float   t = (int32_t)(history[s].raw    - history[oldest].raw);
+    float   o =           history[s].offset - history[oldest].offset;
+    st  += t;
+    so  += o;
+    stt += t * t;
+    sto += t * o;
+  }
+  float variance = recorded * stt - st * st;
+  if( variance <= 0 ) { return status.drift; }
+
+  // a fast raw clock makes the offset of the master decrease
+  float drift = -(recorded * sto - st * so) / variance * 1000000.0;
+  if( drift >  TIMESYNC_MAX_DRIFT ) { return  TIMESYNC_MAX_DRIFT; }
+  if( drift < -TIMESYNC_MAX_DRIFT ) { return -TIMESYNC_MAX_DRIFT; }
+  return drift < 0 ? drift - 0.5 : drift + 0.5;
+}
+
+static void _adjust(int32_t diff) {
+  clock_adjust(diff);
+  adjusted     += diff;
+  // keep deadlines and intervals in terms of the adjusted clock
+  next         += diff;
+  last_process += diff;
+}
+
+// big endian, like all multi-byte fields in XBee frames
+static void _put_time(uint8_t *buffer, time_t time) {
+  buffer[0] = time >> 24;
+  buffer[1] = time >> 16;
+  buffer[2] = time >>  8;
+  buffer[3] = time;
+}
+
+static time_t _get_time(const uint8_t *buffer) {
+  return (time_t)buffer[0] << 24 | (time_t)buffer[1] << 16 |
+         (time_t)buffer[2] <<  8 | buffer[3];
+}
@@ -0,0 +1,102 @@
+// timesync.h
+// author: Christophe VG <contact@christophe.vg>
+
+// mesh-wide time synchronisation over XBee
+// the master (typically the coordinator) broadcasts beacons with its time.
+// other nodes answer a beacon with a request, which the master answers with
+// its time, and estimate their offset from it, assuming the round trip is
+// symmetric. large offsets are stepped, small ones slewed one ms at a time,
+// and the drift of the local clock is estimated and compensated, all through
+// clock_adjust(). the drift is the slope of a least squares fit of the
+// offsets to the uncorrected local clock, over the samples with the shortest
+// round trips of the last minutes, so the asymmetry of single round trips
+// averages out. once synced, clock_get_millis() on all nodes is comparable,
+// so timestamps in payloads give the one-way latency and order of events.
+
+#ifndef __TIMESYNC_H
+#define __TIMESYNC_H
+
+#include "bool.h"
+#include "xbee.h"
+
+// configuration, can be overridden from the Makefile (MORE_CDEFS)
+
+#ifndef TIMESYNC_INTERVAL         // ms between beacons of the master
+#define TIMESYNC_INTERVAL  10000
+#endif
+
+#ifndef TIMESYNC_RETRY            // ms between requests while not synced
+#define TIMESYNC_RETRY     1000
+#endif
+
+#ifndef TIMESYNC_JITTER           // ms over which requests are spread
+#define TIMESYNC_JITTER    500
+#endif
+
+#ifndef TIMESYNC_MAX_RTT          // ms, samples with longer round trips are
+#define TIMESYNC_MAX_RTT   500    // too asymmetric to be trusted
+#endif
+
+#ifndef TIMESYNC_RTT_MARGIN       // ms, samples with round trips this much
+#define TIMESYNC_RTT_MARGIN 20    // longer than the best recent one too
+#endif
+
+#ifndef TIMESYNC_STEP             // ms, larger offsets are stepped at once
+#define TIMESYNC_STEP      50
+#endif
+
+#ifndef TIMESYNC_SLEW             // ms of local time per slewed ms
+#define TIMESYNC_SLEW      10
+#endif
+
+#ifndef TIMESYNC_MAX_DRIFT        // ppm, largest drift that is compensated
+#define TIMESYNC_MAX_DRIFT 1000
+#endif
+
+#ifndef TIMESYNC_DRIFT_SAMPLES    // samples the drift is estimated from
+#define TIMESYNC_DRIFT_SAMPLES 8
+#endif
+
+#ifndef TIMESYNC_DRIFT_SPACING    // ms, one sample per period, the one with
+#define TIMESYNC_DRIFT_SPACING 120000 // the shortest round trip
+#endif
+
+#ifndef TIMESYNC_DRIFT_MARGIN     // ms, samples with round trips this much
+#define TIMESYNC_DRIFT_MARGIN 5   // longer than the best one are too noisy
+#endif                            // for the drift estimate
+
+// message types, the first payload byte of every time sync frame
+
+#ifndef TIMESYNC_MSG_BEACON
+#define TIMESYNC_MSG_BEACON   0xC8  // [type][time:4]
+#endif
+#ifndef TIMESYNC_MSG_REQUEST
+#define TIMESYNC_MSG_REQUEST  0xC9  // [type][id][t1:4]
+#endif
+#ifndef TIMESYNC_MSG_RESPONSE
+#define TIMESYNC_MSG_RESPONSE 0xCA  // [type][id][t1:4][t2:4]
+#endif
+
+typedef struct {
+  bool     synced;
+  uint32_t beacons;         // received
+  uint32_t requests;        // sent (by a node) or answered (by the master)
+  uint32_t samples;         // accepted responses
+  uint32_t rejected;        // responses with a too long round trip
+  uint32_t steps;
+  int32_t  offset;          // ms, of the last sample
+  uint16_t rtt;             // ms, of the last sample
+  int32_t  drift;           // ppm, estimated, positive = local clock is fast
+} timesync_status_t;
+
+// subscribes to the time sync message types with the xbee driver
+bool timesync_init(bool master);
+
+// sends beacons and requests and applies corrections, call from the main loop
+void timesync_process(void);
+
+bool timesync_is_synced(void);
+
+timesync_status_t timesync_get_status(void);
+
+#endif
@@ -10,12 +10,16 @@
 #include "bool.h"
 #include "wifi.h"
 #include "nmea.h"
+#include "energy.h"
+#include "profile.h"
 
 volatile static bool tx_in_progress;
 
 // interrupt vector for handling completion of transmission
 ISR (USARTw_TX_vect) {
+  PROFILE_ENTER();
   tx_in_progress = FALSE;
+  PROFILE_LEAVE(PROFILE_WIFI_TX);
 }
 
 static void _wait_until_tx_complete(void) {
@@ -40,7 +44,9 @@ volatile cyclic_buffer_t incoming = {0, 0, {0}};
 
 // interrupt vector for handling reception of a single byte
 ISR (USARTw_RX_vect) {
+  PROFILE_ENTER();
   incoming.buffer[incoming.tail++] = UDRw;
+  PROFILE_LEAVE(PROFILE_WIFI_RX);
 }
 
 static bool _data_available(void) {
@@ -49,7 +55,11 @@ static bool _data_available(void) {
 
 // blocking !
 static uint8_t _receive_byte(void) {
-  while( ! _data_available() );
+  if( ! _data_available() ) {
+    energy_state_t state = energy_switch(ENERGY_WIFI);
+    while( ! _data_available() );
+    energy_switch(state);
+  }
   return incoming.buffer[incoming.head++];
 }
 
@@ -103,11 +113,13 @@ void wifi_init(void) {
 }
 
 void wifi_send_cmd(const char *cmd, int size) {
+  energy_state_t state = energy_switch(ENERGY_WIFI);
   for(int b=0; b<size; b++) {
     _send_byte(cmd[b]);
   }
   _send_byte('\r');
   _send_byte('\n');
+  energy_switch(state);
 }
 
 uint8_t wifi_receive_byte(void) {
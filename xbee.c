@@ -7,50 +7,147 @@
 
 #include "xbee.h"
 #include "clock.h"
+#include "sleep.h"
+#include "energy.h"
+#include "profile.h"
 
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#ifdef XBEE_SCHED
+#include "sched.h"
+#endif
 
 // forward declarations of "private" functions to avoid puttin them on top ;-)
+static void    _send_frame(const uint8_t*, uint8_t, uint8_t,
+                           const xbee_iov_t*, uint8_t);
 static void    _send_byte(uint8_t);
+static void    _transmit_byte(uint8_t);
 static void    _wait_until_tx_complete(void);
 static uint8_t _receive_byte(void);
-static uint8_t _peek_byte(void);
 static bool    _data_available(void);
-static void    _receive_rx(uint8_t);
+static void    _init_parser(void);
+static void    _handle_frame(uint8_t*, uint16_t);
+static uint8_t _subscription(uint8_t);
+static void    _set_subscription(uint8_t, uint8_t);
+static uint8_t _acquire_slot(xbee_rx_handler_t);
+static void    _release_slot(uint8_t);
+static xbee_rx_handler_t _handler(xbee_rx_t*);
+static uint8_t _track(xbee_dest_t*, bool);
+static void    _send_to(xbee_dest_t*, uint8_t, const xbee_iov_t*, uint8_t);
+static void    _receive_rx(uint8_t*, uint16_t);
 static void    _send_at(uint8_t, uint8_t, xbee_at_handler_t);
-static void    _receive_at(uint8_t);
+static void    _receive_at(uint8_t*, uint16_t);
 static void    _check_ai(void);
 static void    _get_my(void);
 static void    _get_mp(void);
-static void    _receive_ai_response(unsigned long);
-static void    _receive_my_response(unsigned long);
-static void    _receive_mp_response(unsigned long);
+static void    _receive_ai_response(uint32_t);
+static void    _receive_my_response(uint32_t);
+static void    _receive_mp_response(uint32_t);
+static void    _receive_at_response(bool*, uint32_t);
 static bool    _ai_success(void);
 static bool    _my_success(void);
 static bool    _mp_success(void);
 static void    _handle_ai_response(uint8_t, uint8_t*);
 static void    _handle_my_response(uint8_t, uint8_t*);
 static void    _handle_mp_response(uint8_t, uint8_t*);
-static void    _start_tx_checksum(void);
-static void    _start_rx_checksum(void);
-static void    _send_checksum(void);
-static bool    _rx_checksum_isvalid(void);
-static void    _buffer_info(void);
-static void    _receive_modem(uint8_t size);
-static void    _receive_transmit_status(uint8_t size);
+static void    _receive_modem(uint8_t*, uint16_t);
+static void    _receive_transmit_status(uint8_t*, uint16_t);
+static void    _cache_learn(uint64_t, uint16_t);
+static void    _resolve(xbee_dest_t*);
+static void    _set_dest_nw_address(xbee_dest_t*, uint16_t);
+static void    _forget_association(void);
+static uint8_t _metrics_type(uint8_t);
+static uint8_t _failure_reason(uint8_t);
+static void    _count_tx(uint8_t, uint16_t);
+static void    _count_delivery(uint8_t, uint8_t);
+static void    _count_latency(time_t);
 
 // metrics support
+// counters are updated from the main loop and the RX interrupt, taking a
+// snapshot and resetting them is done with interrupts disabled
 volatile xbee_metrics_t metrics;
 
-xbee_metrics_t xbee_reset_counters(void) {
-  xbee_metrics_t old = metrics;
-  metrics.bytes  = 0;
-  metrics.frames = 0;
-  return old;
+void xbee_reset_counters(xbee_metrics_t *old) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if( old != NULL ) { memcpy(old, (void*)&metrics, sizeof(metrics)); }
+    memset((void*)&metrics, 0, sizeof(metrics));
+  }
+}
+
+void xbee_get_counters(xbee_metrics_t *snapshot) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memcpy(snapshot, (void*)&metrics, sizeof(metrics));
+  }
+}
+
+uint32_t xbee_get_failures(void) {
+  uint32_t failures = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(uint8_t i=0; i<XB_FAIL_REASONS; i++) {
+      failures += metrics.failures[i];
+    }
+  }
+  return failures;
+}
+
+// maps a frame type onto its index in the tx and rx counters
+static uint8_t _metrics_type(uint8_t type) {
+  switch( type ) {
+    case XB_TX_PACKET       : return XB_METRICS_TX_PACKET;
+    case XB_TX_EXPLICIT     : return XB_METRICS_TX_PACKET;
+    case XB_TX_AT           : return XB_METRICS_TX_AT;
+    case XB_RX_PACKET       : return XB_METRICS_RX_PACKET;
+    case XB_RX_EXPLICIT     : return XB_METRICS_RX_PACKET;
+    case XB_RX_AT           : return XB_METRICS_RX_AT;
+    case XB_MODEM_STATUS    : return XB_METRICS_MODEM_STATUS;
+    case XB_TRANSMIT_STATUS : return XB_METRICS_TRANSMIT_STATUS;
+  }
+  return XB_METRICS_OTHER;
+}
+
+// accounts for a transmitted frame, size is its length field
+static void _count_tx(uint8_t type, uint16_t size) {
+  uint8_t t = _metrics_type(type);
+  metrics.tx[t].frames++;
+  metrics.tx[t].bytes += size + XB_FRAME_OVERHEAD;
+  metrics.frames++;
+  metrics.bytes  += size + XB_FRAME_OVERHEAD;
+}
+
+// maps a delivery status onto its index in the failure counters
+static uint8_t _failure_reason(uint8_t delivery) {
+  switch( delivery ) {
+    case XB_DELIVERY_MAC_ACK           : return XB_FAIL_MAC_ACK;
+    case XB_DELIVERY_CCA               : return XB_FAIL_CCA;
+    case XB_DELIVERY_NETWORK_ACK       : return XB_FAIL_NETWORK_ACK;
+    case XB_DELIVERY_NOT_JOINED        : return XB_FAIL_NOT_JOINED;
+    case XB_DELIVERY_ADDRESS_NOT_FOUND : return XB_FAIL_ADDRESS_NOT_FOUND;
+    case XB_DELIVERY_ROUTE_NOT_FOUND   : return XB_FAIL_ROUTE_NOT_FOUND;
+    case XB_DELIVERY_PAYLOAD_TOO_LARGE : return XB_FAIL_PAYLOAD_TOO_LARGE;
+  }
+  return XB_FAIL_OTHER;
+}
+
+// accounts for a TX status: its outcome and, if known, the time it took
+static void _count_delivery(uint8_t delivery, uint8_t retries) {
+  metrics.retries += retries;
+
+  if( delivery != XB_DELIVERY_OK ) {
+    metrics.failures[_failure_reason(delivery)]++;
+  }
 }
 
-xbee_metrics_t xbee_get_counters(void) {
-  return metrics;
+static void _count_latency(time_t sent) {
+  // log2 histogram: bucket i holds latencies of i significant bits
+  time_t  latency = clock_get_millis() - sent;
+  uint8_t bucket  = 0;
+  while( latency > 0 && bucket < XB_METRICS_LATENCY_BUCKETS - 1 ) {
+    latency >>= 1;
+    bucket++;
+  }
+  metrics.latency[bucket]++;
 }
 
 // public interface
@@ -82,11 +179,13 @@ void xbee_init(void) {
   // https://sites.google.com/site/qeewiki/books/avr-guide/usart  
   UCSRxB |= (1 << RXCIEx);            // enable RX interrupt to accept bytes
   UCSRxB |= (1 << TXCIEx);            // enable TX interrupt to see EOT
+
+  _init_parser();
   
   // enable interrupts
   sei();
 
-  xbee_reset_counters();
+  xbee_reset_counters(NULL);
 }
 
 // power down XBee by setting its sleep pin high
@@ -94,170 +193,364 @@ void xbee_sleep(void) {
   avr_set_bit(XBEE_SLEEP_PORT, XBEE_SLEEP_PIN);
 }
 
+uint8_t xbee_sleep_guard(void) {
+  if( _data_available() ) { return SLEEP_BUSY; }
+  if( avr_bit_is_set(XBEE_SLEEP_PORT, XBEE_SLEEP_PIN) ) { return SLEEP_DEEP; }
+  return SLEEP_LIGHT;
+}
+
+// the end device normally keeps its association while sleeping, so once we
+// have our addresses, they remain valid until a modem status reports an
+// association change or a transmission fails
+static bool associated = FALSE;
+
 // power up XBee by setting its sleep pin low
 void xbee_wakeup(void) {
   avr_clear_bit(XBEE_SLEEP_PORT, XBEE_SLEEP_PIN);
+  // fast path: one AI check, reusing our nw address and our parent's
+  if( associated ) {
+    _check_ai();
+    _receive_ai_response(100);
+    if( _ai_success() ) { return; }
+  }
   xbee_wait_for_association();
 }
 
 // wrapper around the AI AT command check
 void xbee_wait_for_association(void) {
+  _forget_association();
   do {
     _check_ai();
-    _receive_ai_response(100L); // typical delay is 40ms
+    _receive_ai_response(100); // typical delay is 40ms
   } while( ! _ai_success() );
   // once we're associated, we want to fetch our own nw address and our parent's
   do {
     _get_my();
-    _receive_my_response(100L);
+    _receive_my_response(100);
   } while( ! _my_success() );
   do {
     _get_mp();
-    _receive_mp_response(100L);
+    _receive_mp_response(100);
   } while( ! _mp_success() );
+  associated = TRUE;
 }
 
 uint8_t frame_id = 1;
 
+// destinations of the last transmitted frames, to relate their TX status
+static struct {
+  uint8_t  id;
+  uint64_t address;
+  time_t   sent;
+} pending[XBEE_TX_PENDING];
+
 // sends a frame
 void xbee_send(xbee_tx_t *frame) {
-  _send_byte(XB_FRAME_START);
+  xbee_iov_t payload;
+  payload.data = frame->data;
+  payload.size = frame->size;
+  xbee_send_iov(frame, &payload, 1);
+}
 
-  // split out size + 14 bytes of protocol overhead into MSByte en LSByte
-  _send_byte((frame->size + 14) >> 8);
-  _send_byte(frame->size + 14);
+// sends a frame with the header of frame (data and size are ignored) and a
+// payload consisting of count segments. with frame->id XB_TX_NO_RESPONSE,
+// the module sends no TX status, otherwise the driver picks the frame id.
+void xbee_send_iov(xbee_tx_t *frame, const xbee_iov_t *iov, uint8_t count) {
+  xbee_dest_t dest;
+  xbee_dest_init(&dest, frame->address, frame->nw_address,
+                 frame->radius, frame->options);
+  _send_to(&dest, _track(&dest, frame->id != XB_TX_NO_RESPONSE), iov, count);
+}
 
-  _start_tx_checksum();
-  {
-    _send_byte(XB_TX_PACKET);       // frame type = transmit
-  
-    _send_byte(frame_id++);
+// sends a frame to a prepared destination, with a payload consisting of count
+// segments, that are sent straight from their own buffers
+void xbee_send_to(xbee_dest_t *dest, const xbee_iov_t *iov, uint8_t count) {
+  _send_to(dest, _track(dest, TRUE), iov, count);
+}
 
-    // 64-bit address (MSB -> LSB)
-    for(int8_t i=56;i>0;i-=8) {
-      _send_byte(frame->address >> i);
-    }
-    _send_byte(frame->address);
+static void _send_to(xbee_dest_t *dest, uint8_t id,
+                     const xbee_iov_t *iov, uint8_t count)
+{
+  uint8_t header[XB_TX_HEADER_SIZE];
+  xbee_encode_tx(header, id, dest);
 
-    // 16-bit network address
-    _send_byte(frame->nw_address >> 8);
-    _send_byte(frame->nw_address     );
+  // the addressing part of the checksum is known in advance
+  _send_frame(header, sizeof(header),
+              XB_TX_PACKET + id + dest->checksum, iov, count);
+}
 
-    _send_byte(frame->radius);   // broadcast radius
-    _send_byte(frame->options);  // options
+void xbee_send_explicit(xbee_dest_t *dest, const xbee_endpoint_t *endpoint,
+                        const xbee_iov_t *iov, uint8_t count)
+{
+  uint8_t id = _track(dest, TRUE);
+  uint8_t header[XB_TX_EXPLICIT_HEADER_SIZE];
+  xbee_encode_tx_explicit(header, id, dest, endpoint);
 
-    // data
-    for(int8_t i=0;i<frame->size;i++) {
-      _send_byte(frame->data[i]);
-    }
-  }
-  _send_checksum();
-  
-  metrics.frames++;
-  metrics.bytes += frame->size + 14 + 2; // +2 = start delim and checksum
-
-  _wait_until_tx_complete();
+  // the addressing part of the checksum is known, the endpoint part isn't
+  _send_frame(header, sizeof(header),
+              XB_TX_EXPLICIT + id + dest->checksum + xbee_sum(&header[12], 6),
+              iov, count);
 }
 
-// generic function to handle incoming packets.
-// deals with common bytes and dispatches to helper functions to handle
-// different known packet types
-void xbee_receive(void) {
-  // keep processing incoming data
-  while( _data_available() ) {
-    _buffer_info();
-    // skip to start of frame
-    while( _data_available() && _peek_byte() != XB_FRAME_START ) {
-      _receive_byte();
-    }
+// resolves the destination and remembers it, for when the TX status comes
+// back, returns the frame id to use. frames without a response don't take up
+// a pending slot.
+static uint8_t _track(xbee_dest_t *dest, bool response) {
+  if( dest->resolve ) { _resolve(dest); }
+  if( ! response ) { return XB_TX_NO_RESPONSE; }
 
-    // actual next packet ? -> this happens when we skip trailing garbage
-    if( ! _data_available() ) {
-      debug_printf("WARNING: no next packet...\n");
-      break;
-    }
+  if( frame_id == XB_TX_NO_RESPONSE ) { frame_id++; }
+  pending[frame_id % XBEE_TX_PENDING].id      = frame_id;
+  pending[frame_id % XBEE_TX_PENDING].address = dest->address;
+  pending[frame_id % XBEE_TX_PENDING].sent    = clock_get_millis();
 
-    _receive_byte();  // received peeked frame start
+  return frame_id++;
+}
 
-    // receive common to all packets: size and type
-    uint8_t size = (_receive_byte() << 8) | (_receive_byte() & 0xFF);
-    uint8_t type = _peek_byte();
+// incoming bytes are collected into frames by the parser
 
-    switch( type ) {
-      case XB_RX_PACKET       : _receive_rx(size);              break;
-      case XB_RX_AT           : _receive_at(size);              break;
-      case XB_MODEM_STATUS    : _receive_modem(size);           break;
-      case XB_TRANSMIT_STATUS : _receive_transmit_status(size); break;
+static uint8_t       frame[XBEE_FRAME_SIZE];
+static xbee_parser_t parser;
 
-      case XB_FRAME_START  : break; // this happens, let's not lose a packet
+static void _init_parser(void) {
+#ifdef XBEE_ESCAPED
+  xbee_parser_init(&parser, frame, sizeof(frame), TRUE);
+#else
+  xbee_parser_init(&parser, frame, sizeof(frame), FALSE);
+#endif
+}
 
-      default:
-        printf("WARNING: received unsupported packet type: %i\n", type);
+// processes all received bytes, handling complete frames
+void xbee_receive(void) {
+  while( _data_available() ) {
+    switch( xbee_parse(&parser, _receive_byte()) ) {
+      case XB_PARSE_MORE           : break;
+      case XB_PARSE_FRAME          : _handle_frame(frame, parser.length); break;
+      case XB_PARSE_CHECKSUM_ERROR :
+        metrics.checksum_errors++;
+        debug_printf("ERROR: invalid checksum\n");
+        break;
+      case XB_PARSE_OVERSIZE       :
+        // also counted by the RX interrupt, when the buffer is full
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+          metrics.overflows++;
+        }
+        debug_printf("WARNING: frame too large, skipped\n");
+        break;
     }
   }
-  // debug_printf("no more data...\n");
+}
+
+// dispatches different known frame types to helper functions
+static void _handle_frame(uint8_t *frame, uint16_t length) {
+  uint8_t type = frame[0];
+  uint8_t t    = _metrics_type(type);
+  metrics.rx[t].frames++;
+  metrics.rx[t].bytes += length + XB_FRAME_OVERHEAD;
+
+  switch( type ) {
+    case XB_RX_PACKET       : _receive_rx(frame, length);              break;
+    case XB_RX_EXPLICIT     : _receive_rx(frame, length);              break;
+    case XB_RX_AT           : _receive_at(frame, length);              break;
+    case XB_MODEM_STATUS    : _receive_modem(frame, length);           break;
+    case XB_TRANSMIT_STATUS : _receive_transmit_status(frame, length); break;
+
+    default:
+      metrics.unsupported++;
+      printf("WARNING: received unsupported packet type: %i\n", type);
+  }
 }
 
 // RX packet support
+// received packets are dispatched on their first payload byte, the message
+// type, to the handler that subscribed to it, or else to the default handler.
+// the handler of each type is looked up in a table of 4-bit indexes into the
+// list of subscribed handlers, two types per byte.
+// explicitly addressed packets are first matched against a short list of
+// endpoint/cluster subscriptions, that refer to the same list of handlers.
+
+#if XBEE_MAX_SUBSCRIBERS > 15
+#error "XBEE_MAX_SUBSCRIBERS can be at most 15"
+#endif
+
+static xbee_rx_handler_t rx_handler;                    // default handler
+static xbee_rx_handler_t handlers[XBEE_MAX_SUBSCRIBERS];
+static uint8_t           subscriptions[0x80];           // 0 = none, else i+1
+
+static struct {
+  uint8_t  endpoint;
+  uint16_t cluster;
+  uint8_t  slot;                                        // 0 = unused
+} endpoints[XBEE_MAX_ENDPOINTS];
+
+static uint8_t _subscription(uint8_t type) {
+  uint8_t slots = subscriptions[type >> 1];
+  return type & 0x01 ? slots >> 4 : slots & 0x0F;
+}
 
-// one RX packet handler
-static xbee_rx_handler_t rx_handler;
+static void _set_subscription(uint8_t type, uint8_t slot) {
+  if( type & 0x01 ) {
+    subscriptions[type >> 1] = (subscriptions[type >> 1] & 0x0F) | (slot << 4);
+  } else {
+    subscriptions[type >> 1] = (subscriptions[type >> 1] & 0xF0) | slot;
+  }
+}
 
-// function to register callback for the RX packet handler
+// function to register callback for packets that no one subscribed to
 void xbee_on_receive(xbee_rx_handler_t handler) {
   rx_handler = handler;
 }
 
-// handling of received (data) packets, dispatched by xbee_receive
-static void _receive_rx(uint8_t size) {
-  xbee_rx_t frame;
-
-  uint64_t  address    = 0;
-  uint16_t  nw_address = 0;
-  uint8_t   options    = 0;
-  uint8_t  *data = (uint8_t*)malloc(size-12); // 12 bytes are protocol overhead
-
-  _start_rx_checksum();
-  {
-    _receive_byte();                  // frame type is part of the checksum
-
-    address = ((uint64_t)(_receive_byte()) << 56)
-            | ((uint64_t)(_receive_byte()) << 48)
-            | ((uint64_t)(_receive_byte()) << 40)
-            | ((uint64_t)(_receive_byte()) << 32)
-            | ((uint64_t)(_receive_byte()) << 24)
-            | ((uint64_t)(_receive_byte()) << 16)
-            | ((uint64_t)(_receive_byte()) <<  8)
-            | ((uint64_t)(_receive_byte()));
-
-    // 16bit network address
-    nw_address = ((uint16_t)(_receive_byte()) << 8)
-               | ((uint16_t)(_receive_byte()));
-
-    options = _receive_byte();
-  
-    // data
-    for(int8_t i=0; i<size-12; i++) {
-      data[i] = _receive_byte();
+// handlers that subscribe to more types or endpoints, take only one slot
+static uint8_t _acquire_slot(xbee_rx_handler_t handler) {
+  uint8_t slot, free = 0;
+
+  if( handler == NULL ) { return 0; }
+
+  for(slot=1; slot<=XBEE_MAX_SUBSCRIBERS; slot++) {
+    if( handlers[slot-1] == handler ) { return slot; }
+    if( handlers[slot-1] == NULL && ! free ) { free = slot; }
+  }
+  if( free ) { handlers[free-1] = handler; }
+  return free;
+}
+
+// frees a slot once its handler has no types or endpoints left
+static void _release_slot(uint8_t slot) {
+  for(uint16_t t=0; t<=0xFF; t++) {
+    if( _subscription(t) == slot ) { return; }
+  }
+  for(uint8_t e=0; e<XBEE_MAX_ENDPOINTS; e++) {
+    if( endpoints[e].slot == slot ) { return; }
+  }
+  handlers[slot-1] = NULL;
+}
+
+bool xbee_subscribe(uint8_t type, xbee_rx_handler_t handler) {
+  xbee_unsubscribe(type);
+
+  uint8_t slot = _acquire_slot(handler);
+  if( ! slot ) { return FALSE; }
+
+  _set_subscription(type, slot);
+  return TRUE;
+}
+
+void xbee_unsubscribe(uint8_t type) {
+  uint8_t slot = _subscription(type);
+  if( ! slot ) { return; }
+
+  _set_subscription(type, 0);
+  _release_slot(slot);
+}
+
+bool xbee_subscribe_endpoint(uint8_t endpoint, uint16_t cluster,
+                             xbee_rx_handler_t handler)
+{
+  uint8_t e;
+
+  xbee_unsubscribe_endpoint(endpoint, cluster);
+
+  for(e=0; e<XBEE_MAX_ENDPOINTS && endpoints[e].slot; e++);
+  if( e == XBEE_MAX_ENDPOINTS ) { return FALSE; }
+
+  uint8_t slot = _acquire_slot(handler);
+  if( ! slot ) { return FALSE; }
+
+  endpoints[e].endpoint = endpoint;
+  endpoints[e].cluster  = cluster;
+  endpoints[e].slot     = slot;
+  return TRUE;
+}
+
+void xbee_unsubscribe_endpoint(uint8_t endpoint, uint16_t cluster) {
+  for(uint8_t e=0; e<XBEE_MAX_ENDPOINTS; e++) {
+    if( endpoints[e].slot && endpoints[e].endpoint == endpoint &&
+        endpoints[e].cluster == cluster )
+    {
+      uint8_t slot = endpoints[e].slot;
+      endpoints[e].slot = 0;
+      _release_slot(slot);
+      return;
     }
-  }  
-  if( ! _rx_checksum_isvalid() ) {
-    free(data);
-    return;
   }
+}
 
-  // create a frame and have it taken care of
-  frame.size       = size-12; // return actual payload size (excluding headers)
-  frame.address    = address;
-  frame.nw_address = nw_address;
-  frame.options    = options;
-  frame.data       = data;
+// finds the handler of a packet: by endpoint and cluster, by message type
+// (on the Digi data endpoint) or else the default handler
+static xbee_rx_handler_t _handler(xbee_rx_t *rx) {
+  uint8_t slot = 0;
 
-  rx_handler(&frame);
+  for(uint8_t e=0; e<XBEE_MAX_ENDPOINTS; e++) {
+    if( ! endpoints[e].slot ||
+        endpoints[e].endpoint != rx->endpoint.destination )
+    {
+      continue;
+    }
+    if( endpoints[e].cluster == rx->endpoint.cluster ) {
+      slot = endpoints[e].slot;
+      break;
+    }
+    if( endpoints[e].cluster == XB_ANY_CLUSTER ) { slot = endpoints[e].slot; }
+  }
+
+  if( ! slot && rx->endpoint.destination == XB_DATA_ENDPOINT && rx->size > 0 ) {
+    slot = _subscription(rx->data[0]);
+  }
+  return slot ? handlers[slot-1] : rx_handler;
+}
+
+// handling of received (data) packets, dispatched by xbee_receive
+static void _receive_rx(uint8_t *frame, uint16_t length) {
+  xbee_rx_t         rx;
+  xbee_rx_handler_t handler;
+
+  if( ! xbee_decode_rx(frame, length, &rx) ) { return; }
+
+  _cache_learn(rx.address, rx.nw_address);
+
+  handler = _handler(&rx);
+  if( handler == NULL ) {
+    metrics.unhandled++;
+    return;
+  }
+  handler(&rx);
 }
 
 // AT command support
 
+// waits until the handler of the response sets the flag, or the timeout
+// expires. in between, the CPU idles until the next byte arrives or the clock
+// ticks. this blocks the caller, nothing else runs meanwhile.
+static void _receive_at_response(bool *received, uint32_t timeout) {
+  time_t until = clock_get_millis() + timeout;
+  debug_printf("starting wait for AT response at %lu\n", until - timeout);
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  for(;;) {
+    xbee_receive();
+    if( *received ) { break; }
+    // a byte that arrives after checking, would not wake us up in time
+    cli();
+    if( (int32_t)(until - clock_get_millis()) <= 0 ) { break; }
+    if( ! _data_available() ) {
+#if CLOCK_TICKLESS
+      clock_alarm(until);
+#endif
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+    }
+    sei();
+  }
+  sei();
+  if( *received ) {
+    debug_printf("got AT response at %lu\n", clock_get_millis());
+  } else {
+    debug_printf("timeout waiting for AT response (%lu)\n", clock_get_millis());
+  }
+}
+
 // global AI response
 static uint8_t ai_response;
 static bool    ai_response_received;
@@ -270,18 +563,8 @@ static void _check_ai(void) {
   _send_at('A', 'I', _handle_ai_response);
 }
 
-static void _receive_ai_response(unsigned long timeout) {
-  unsigned long stop = clock_get_millis() + timeout;
-  debug_printf("starting wait for ai response at %lu\n", stop - timeout);
-  while(clock_get_millis() < stop) {
-    xbee_receive();
-    if( ai_response_received ) {
-      debug_printf("got ai response at %lu\n", clock_get_millis());
-      return;
-    }
-  }
-  // timeout occured
-  debug_printf("timeout waiting for AI response (%lu)\n", clock_get_millis());
+static void _receive_ai_response(uint32_t timeout) {
+  _receive_at_response(&ai_response_received, timeout);
 }
 
 // callback for handling AI responses
@@ -312,18 +595,8 @@ static void _get_my(void) {
   _send_at('M', 'Y', _handle_my_response);
 }
 
-static void _receive_my_response(unsigned long timeout) {
-  unsigned long stop = clock_get_millis() + timeout;
-  debug_printf("starting wait for MY response at %lu\n", stop - timeout);
-  while(clock_get_millis() < stop) {
-    xbee_receive();
-    if( my_response_received ) {
-      debug_printf("got MY response at %lu\n", clock_get_millis());
-      return;
-    }
-  }
-  // timeout occured
-  debug_printf("timeout waiting for MY response (%lu)\n", clock_get_millis());
+static void _receive_my_response(uint32_t timeout) {
+  _receive_at_response(&my_response_received, timeout);
 }
 
 // callback for handling MY responses
@@ -353,18 +626,8 @@ static void _get_mp(void) {
   _send_at('M', 'P', _handle_mp_response);
 }
 
-static void _receive_mp_response(unsigned long timeout) {
-  unsigned long stop = clock_get_millis() + timeout;
-  debug_printf("starting wait for MP response at %lu\n", stop - timeout);
-  while(clock_get_millis() < stop) {
-    xbee_receive();
-    if( mp_response_received ) {
-      debug_printf("got MP response at %lu\n", clock_get_millis());
-      return;
-    }
-  }
-  // timeout occured
-  debug_printf("timeout waiting for MP response (%lu)\n", clock_get_millis());
+static void _receive_mp_response(uint32_t timeout) {
+  _receive_at_response(&mp_response_received, timeout);
 }
 
 static void _handle_mp_response(uint8_t status, uint8_t* response) {
@@ -379,8 +642,14 @@ static bool _mp_success(void) {
   return mp_response_received; // parent_address != 0xFFFE; <-- routers
 }
 
-// cyclic buffer of handlers for at responses
-static xbee_at_handler_t at_handlers[0xFF];
+static void _forget_association(void) {
+  associated     = FALSE;
+  nw_address     = 0xFFFE;
+  parent_address = 0xFFFE;
+}
+
+// cyclic buffer of handlers for at responses, indexed by the uint8_t frame id
+static xbee_at_handler_t at_handlers[0x100];
 static uint8_t           at_handler_id = 0;
 
 // generic function to send AT command, requires two command letters + handler
@@ -392,124 +661,150 @@ static void _send_at(uint8_t ch1, uint8_t ch2, xbee_at_handler_t handler) {
   at_handlers[at_handler_id] = handler;
 
   // send frame
-  _send_byte(XB_FRAME_START);
-  
-  _send_byte(0x00);          // MSB
-  _send_byte(0x04);          // LSB (fixed length)
+  uint8_t header[XB_AT_HEADER_SIZE];
+  xbee_encode_at(header, at_handler_id, ch1, ch2);
+  _send_frame(header, sizeof(header), xbee_sum(header, sizeof(header)),
+              NULL, 0);
 
-  _start_tx_checksum();
-  {
-    _send_byte(XB_TX_AT);
-    _send_byte(at_handler_id); // frame ID
-    _send_byte(ch1);           // AT command char 1
-    _send_byte(ch2);           // AT command char 2
-  }
-  _send_checksum();
-  
   at_handler_id++;
 
+  energy_state_t state = energy_switch(ENERGY_XBEE_TX);
   _wait_until_tx_complete();
+  energy_switch(state);
   debug_printf("at tx complete\n");
 }
 
 // generic handling of AT responses, dispatched by xbee_receive
-static void _receive_at(uint8_t size) {
-  uint8_t id;
-  uint8_t status;
-  uint8_t* data = NULL;
-
-  _start_rx_checksum();
-  {
-    _receive_byte();          // frame type is part of the checksum
-    id = _receive_byte();
-    _receive_byte();          // first command character
-    _receive_byte();          // second
-    status = _receive_byte();
-
-    if(size - 5 > 0) {        // command data available ?
-      data = malloc((size-5)*sizeof(uint8_t));
-      for(uint8_t i=0; i<size-5; i++) {
-        data[i] = _receive_byte();
-      }
-    }
-  }
-  if( _rx_checksum_isvalid() ) {
-    (*(at_handlers[id]))(status, data);
+static void _receive_at(uint8_t *frame, uint16_t length) {
+  xbee_at_t at;
+
+  if( ! xbee_decode_at_response(frame, length, &at) ) { return; }
+
+  if( at_handlers[at.id] != NULL ) {
+    // command data available ?
+    (*(at_handlers[at.id]))(at.status, at.size > 0 ? at.data : NULL);
   }
-  if(data != NULL) { free(data); }
 }
 
 // modem status support
 
-static void _receive_modem(uint8_t size) {
-  // status is only used while debugging, so only include is if needed :-)
-#ifdef DEBUG
+static void _receive_modem(uint8_t *frame, uint16_t length) {
   uint8_t status;
-#endif
-  _start_rx_checksum();
-  {
-    _receive_byte();        // frame type is part of the checksum
-#ifdef DEBUG
-    status =
-#endif
-             _receive_byte();
-  }
-  if( _rx_checksum_isvalid() ) {
-    debug_printf("modem status: %i\n", status);
+
+  if( ! xbee_decode_modem_status(frame, length, &status) ) { return; }
+
+  debug_printf("modem status: %i\n", status);
+
+  switch( status ) {
+    case XB_MODEM_HW_RESET:
+    case XB_MODEM_WDT_RESET:
+    case XB_MODEM_JOINED:
+    case XB_MODEM_DISASSOCIATED:
+    case XB_MODEM_COORD_STARTED:
+      associated = FALSE;     // next wakeup re-queries everything
   }
 }
 
 // TX status support
 
-static void _receive_transmit_status(uint8_t size) {
+static void _receive_transmit_status(uint8_t *frame, uint16_t length) {
+  xbee_tx_status_t status;
 
-  uint8_t id, addr_h, addr_l, retries, delivery, discovery;
+  if( ! xbee_decode_tx_status(frame, length, &status) ) { return; }
 
-  _start_rx_checksum();
-  {
-    _receive_byte();        // frame type is part of the checksum
+  uint8_t id = status.id;
 
-    id        = _receive_byte();
-    addr_h    = _receive_byte();
-    addr_l    = _receive_byte();
-    retries   = _receive_byte();
-    delivery  = _receive_byte();
-    discovery = _receive_byte();
-  }
-  if( _rx_checksum_isvalid() && delivery != 0x00) {
-    printf("transmission failed: %d (%02x %02x) %d : %02x  / %02x\n",
-           id, addr_h, addr_l, retries, delivery, discovery);
+  // find the destination of the frame, to learn or forget its nw address
+  bool     known   = pending[id % XBEE_TX_PENDING].id == id;
+  uint64_t address = pending[id % XBEE_TX_PENDING].address;
+
+  // the latency can only be known for frames that are still remembered
+  _count_delivery(status.delivery, status.retries);
+  if( known ) { _count_latency(pending[id % XBEE_TX_PENDING].sent); }
+
+  if( status.delivery == XB_DELIVERY_OK ) {
+    if( known ) { _cache_learn(address, status.nw_address); }
+  } else {
+    if( known ) { xbee_forget_nw_address(address); }
+    associated = FALSE;       // our own addresses might have changed too
+    printf("transmission failed: %d (%04x) %d : %02x  / %02x\n",
+           id, status.nw_address, status.retries, status.delivery,
+           status.discovery);
   }
 }
 
+// network address cache
+// maps 64-bit addresses onto 16-bit network addresses, learned from received
+// frames and TX statuses. entries are kept in most recently used order.
+
+static struct {
+  uint64_t address;
+  uint16_t nw_address;
+} cache[XBEE_ADDR_CACHE_SIZE];
+static uint8_t cache_size = 0;
 
-// checksumming support
+// moves entry i to the front, dropping the last entry if it's beyond the end
+static void _cache_promote(uint8_t i) {
+  if( i >= XBEE_ADDR_CACHE_SIZE ) { i = XBEE_ADDR_CACHE_SIZE - 1; }
+  for(; i>0; i--) {
+    cache[i] = cache[i-1];
+  }
+}
 
-static uint8_t tx_checksum = 0,
-               rx_checksum = 0;
+static void _cache_learn(uint64_t address, uint16_t nw_address) {
+  if( nw_address == XB_NW_ADDR_UNKNOWN || address == XB_BROADCAST ) { return; }
 
-static void _start_tx_checksum(void) {
-  tx_checksum = 0;
+  uint8_t i;
+  for(i=0; i<cache_size; i++) {
+    if( cache[i].address == address ) { break; }
+  }
+  if( i == cache_size && cache_size < XBEE_ADDR_CACHE_SIZE ) { cache_size++; }
+  _cache_promote(i);
+  cache[0].address    = address;
+  cache[0].nw_address = nw_address;
+}
+
+uint16_t xbee_lookup_nw_address(uint64_t address) {
+  if( address == XB_COORDINATOR ) { return 0x0000; } // always
+
+  for(uint8_t i=0; i<cache_size; i++) {
+    if( cache[i].address == address ) {
+      uint16_t nw_address = cache[i].nw_address;
+      _cache_promote(i);
+      cache[0].address    = address;
+      cache[0].nw_address = nw_address;
+      return nw_address;
+    }
+  }
+  return XB_NW_ADDR_UNKNOWN;
 }
 
-static void _start_rx_checksum(void) {
-  rx_checksum = 0;
+void xbee_forget_nw_address(uint64_t address) {
+  for(uint8_t i=0; i<cache_size; i++) {
+    if( cache[i].address == address ) {
+      cache_size--;
+      for(; i<cache_size; i++) {
+        cache[i] = cache[i+1];
+      }
+      return;
+    }
+  }
 }
 
-static void _send_checksum(void) {
-  _send_byte(0xFF - tx_checksum);
+// fills in the nw address of a prepared destination from the cache, or
+// resets it to unknown when it was forgotten
+static void _resolve(xbee_dest_t *dest) {
+  _set_dest_nw_address(dest, xbee_lookup_nw_address(dest->address));
 }
 
-static bool _rx_checksum_isvalid(void) {
-  _receive_byte();
-  // after receiving the checksum byte, the checksum should be zero
-  if( rx_checksum != 0xFF ) {
-    debug_printf("ERROR: invalid checksum = %i\n", rx_checksum);
-    return FALSE;
-  }
-  return TRUE;
+static void _set_dest_nw_address(xbee_dest_t *dest, uint16_t nw_address) {
+  dest->checksum -= dest->header[8] + dest->header[9];
+  dest->header[8] = nw_address >> 8;
+  dest->header[9] = nw_address;
+  dest->checksum += dest->header[8] + dest->header[9];
 }
 
+
 // technical (serial-oriented) functions to send one byte and wait until
 // transmission has finished receiving of one byte is done through interrupts
 // and an internal buffer see below
@@ -518,14 +813,65 @@ volatile static bool tx_in_progress;
 
 // interrupt vector for handling completion of transmission
 ISR (USARTx_TX_vect) {
+  PROFILE_ENTER();
   tx_in_progress = FALSE;
+  PROFILE_LEAVE(PROFILE_XBEE_TX);
+}
+
+// transmits a frame: a header, whose contribution to the checksum is given,
+// followed by a payload consisting of count segments
+static void _send_frame(const uint8_t *header, uint8_t size, uint8_t sum,
+                        const xbee_iov_t *iov, uint8_t count)
+{
+  uint16_t length = size;
+  for(uint8_t s=0; s<count; s++) {
+    length += iov[s].size;
+  }
+
+  // sending is synchronous, every byte waits for the previous one to be sent
+  energy_state_t state = energy_switch(ENERGY_XBEE_TX);
+
+  _transmit_byte(XB_FRAME_START);
+
+  // split out length into MSByte en LSByte
+  _send_byte(length >> 8);
+  _send_byte(length);
+
+  for(uint8_t i=0; i<size; i++) {
+    _send_byte(header[i]);
+  }
+
+  // data
+  for(uint8_t s=0; s<count; s++) {
+    for(uint16_t i=0; i<iov[s].size; i++) {
+      sum += iov[s].data[i];
+      _send_byte(iov[s].data[i]);
+    }
+  }
+
+  _send_byte(0xFF - sum);
+
+  _count_tx(header[0], length);
+
+  _wait_until_tx_complete();
+  energy_switch(state);
 }
 
+// sends a byte, escaping it when using API mode 2
 static void _send_byte(uint8_t c) {
+#ifdef XBEE_ESCAPED
+  if( xbee_needs_escape(c) ) {
+    _transmit_byte(XB_ESCAPE);
+    c ^= XB_ESCAPE_XOR;
+  }
+#endif
+  _transmit_byte(c);
+}
+
+static void _transmit_byte(uint8_t c) {
   loop_until_bit_is_set(UCSRxA, UDREx); // wait until USART Data Reg Empty
   tx_in_progress = TRUE;
-  UDRx = c;
-  tx_checksum += c;
+  xbee_usart_write(c);
   _wait_until_tx_complete();
 }
 
@@ -534,41 +880,38 @@ static void _wait_until_tx_complete(void) {
 }
 
 // cyclic IO buffers
+// the uint8_t head and tail wrap at 256, so the buffer must have 256 entries
 typedef struct {
   volatile uint8_t head;
   volatile uint8_t tail;
-  volatile uint8_t buffer[0xff];
+  volatile uint8_t buffer[0x100];
 } cyclic_buffer_t;
 
-volatile cyclic_buffer_t incoming = {0, 0, {0}};
+static volatile cyclic_buffer_t incoming = {0, 0, {0}};
 
 // interrupt vector for handling reception of a single byte
+// when the buffer is full, the byte is dropped instead of the whole buffer
 ISR (USARTx_RX_vect) {
-  incoming.buffer[incoming.tail++] = UDRx;
+  PROFILE_ENTER();
+  uint8_t c = UDRx;
+  if( (uint8_t)(incoming.tail + 1) == incoming.head ) {
+    metrics.overflows++;
+  } else {
+    incoming.buffer[incoming.tail++] = c;
+#ifdef XBEE_SCHED
+    sched_signal(SCHED_XBEE);
+#endif
+  }
+  PROFILE_LEAVE(PROFILE_XBEE_RX);
 }
 
 // blocking !
 static uint8_t _receive_byte(void) {
   while( ! _data_available() );
-  rx_checksum += incoming.buffer[incoming.head];
   return incoming.buffer[incoming.head++];
 }
 
-// blocking !
-static uint8_t _peek_byte(void) {
-  while( ! _data_available() );
-
-  return incoming.buffer[incoming.head];
-}
-
 static bool _data_available(void) {
   return incoming.head != incoming.tail;
 }
 
-static void _buffer_info(void) {
-  debug_printf("buffer: head = %i : ", incoming.head);
-  for(uint8_t i=incoming.head;i!=incoming.tail;i++) {
-    debug_printf("%i ", incoming.buffer[i]);
-  }
-  debug_printf(" / tail = %i\n", incoming.tail);
-}
@@ -15,40 +15,8 @@
 #include "bool.h"
 #include "avr.h"
 
-// magic bytes
-
-// internal
-#define XB_FRAME_START      0x7E
-#define XB_TX_PACKET        0x10
-#define XB_MODEM_STATUS     0x8A
-#define XB_TRANSMIT_STATUS  0x8B
-
-// externally useable
-#define XB_RX_PACKET        0x90
-#define XB_TX_AT            0x08
-#define XB_RX_AT            0x88
-
-#define XB_COORDINATOR      0x0000000000000000
-#define XB_BROADCAST        0x000000000000FFFF
-#define XB_TX_NO_RESPONSE   0x00      // id to use when no response wanted
-#define XB_NW_BROADCAST     0xFFFE    // nw_address for broadcast
-#define XB_NW_ADDR_UNKNOWN  0xFFFE    //             or unknown
-#define XB_MAX_RADIUS       0x00
-#define XB_OPT_NO_ACK       0x01
-#define XB_OPT_NONE         0x00
-#define XB_OPT_APS_ENC      0x20
-#define XB_OPT_EXT_TIMEOUT  0x40
-
-// AT command status
-#define XB_AT_OK            0x00
-#define XB_AT_ERROR         0x01
-#define XB_AT_INV_CMD       0x02
-#define XB_AT_INV_PARAM     0x03
-#define XB_AT_TX_FAIL       0x04
-
-// AT AI responses
-#define XB_AT_AI_SUCCESS    0x00
-#define XB_AT_AI_SCANNING   0xFF
+// frame definitions, encoding and decoding
+#include "xbee_codec.h"
 
 // XBEE is controled via USART, some AVR devices have multiple USARTs
 // the identifying 0 or 1 is replace by an 'x'
@@ -107,32 +75,50 @@
 #define TXCIEx TXCIE0
 #endif
 
+// writes one byte to the USART, host builds (see host/) replace this with their
+// own simulated USART
+#ifndef xbee_usart_write
+#define xbee_usart_write(c) (UDRx = (c))
+#endif
+
+// size of the buffer for one incoming frame, larger frames are dropped
+#ifndef XBEE_FRAME_SIZE
+#define XBEE_FRAME_SIZE      (XB_RX_EXPLICIT_HEADER_SIZE + XB_MAX_PAYLOAD)
+#endif
+
+// define XBEE_ESCAPED when the XBee is configured for API mode 2 (AP=2)
+
+// define XBEE_SCHED to signal SCHED_XBEE for each received byte, so a task of
+// the scheduler can call xbee_receive() (see sched.h)
+
+// size of the cache of 64-bit -> 16-bit network address mappings
+#ifndef XBEE_ADDR_CACHE_SIZE
+#define XBEE_ADDR_CACHE_SIZE 8
+#endif
+
+// number of transmitted frames whose destination is remembered until their
+// TX status comes back
+#ifndef XBEE_TX_PENDING
+#define XBEE_TX_PENDING      4
+#endif
+
+// number of different handlers that can subscribe to message types
+#ifndef XBEE_MAX_SUBSCRIBERS
+#define XBEE_MAX_SUBSCRIBERS 8
+#endif
+
+// number of endpoint (and cluster) subscriptions
+#ifndef XBEE_MAX_ENDPOINTS
+#define XBEE_MAX_ENDPOINTS   4
+#endif
+
 // pin mapping
 // TODO: externalize this
 #define XBEE_SLEEP_PORT PORTD
 #define XBEE_SLEEP_PIN  4
 
-// TX struct
-typedef struct {
-  uint16_t size;
-  uint8_t  id;
-  uint64_t address;
-  uint16_t nw_address;
-  uint8_t  radius;
-  uint8_t  options;
-  uint8_t *data;
-} xbee_tx_t;
-
-// RX struct
-typedef struct {
-  uint16_t size;
-  uint64_t address;
-  uint16_t nw_address;
-  uint8_t  options;
-  uint8_t *data;
-} xbee_rx_t;
-
 // RX handler type
+// frame->data points into the receive buffer and is only valid during the call
 typedef void (*xbee_rx_handler_t)(xbee_rx_t *frame);
 
 // AT response handler type
@@ -144,21 +130,106 @@ void xbee_init(void);
 
 void xbee_sleep(void);
 void xbee_wakeup(void);
+// tells how deep the CPU may sleep (see sleep.h): not while received bytes
+// wait to be handled, lightly while the module is awake and can send frames
+uint8_t xbee_sleep_guard(void);
+// blocks until the module is associated, idling while it waits for the
+// responses to its AT commands
 void xbee_wait_for_association(void);
 
 void xbee_send(xbee_tx_t *frame);
+void xbee_send_iov(xbee_tx_t *frame, const xbee_iov_t *iov, uint8_t count);
+// see xbee_dest_init() in xbee_codec.h to prepare a destination
+void xbee_send_to(xbee_dest_t *dest, const xbee_iov_t *iov, uint8_t count);
+// sends an explicit addressing command frame (0x11), from and to an endpoint,
+// with a cluster and profile, e.g. to interoperate with ZigBee devices
+void xbee_send_explicit(xbee_dest_t *dest, const xbee_endpoint_t *endpoint,
+                        const xbee_iov_t *iov, uint8_t count);
 void xbee_receive(void);
+
+// received packets are dispatched on their first payload byte (message type)
+// a handler can subscribe to several types, each type has at most one handler
+// returns FALSE when XBEE_MAX_SUBSCRIBERS different handlers are subscribed
+bool xbee_subscribe(uint8_t type, xbee_rx_handler_t handler);
+void xbee_unsubscribe(uint8_t type);
+// default handler for packets without a subscribed handler, without one they
+// are counted as unhandled and dropped
 void xbee_on_receive(xbee_rx_handler_t handler);
 
+// explicitly addressed packets (0x91, requires AT AO=1) are dispatched on their
+// destination endpoint and cluster, before falling back to message types for
+// the Digi data endpoint. a subscription to a cluster takes precedence over
+// one to XB_ANY_CLUSTER of the same endpoint. these handlers share the
+// XBEE_MAX_SUBSCRIBERS handler slots with the message type subscriptions.
+// returns FALSE when no subscription or handler slot is available
+#define XB_ANY_CLUSTER 0xFFFF
+bool xbee_subscribe_endpoint(uint8_t endpoint, uint16_t cluster,
+                             xbee_rx_handler_t handler);
+void xbee_unsubscribe_endpoint(uint8_t endpoint, uint16_t cluster);
+
+// nw address cache, used by the send functions when the nw address is unknown
+uint16_t xbee_lookup_nw_address(uint64_t address);
+void     xbee_forget_nw_address(uint64_t address);
+
 uint16_t xbee_get_nw_address(void);
 uint16_t xbee_get_parent_address(void);
 
+// metrics
+
+// frame types that are counted separately
+enum {
+  XB_METRICS_TX_PACKET,
+  XB_METRICS_TX_AT,
+  XB_METRICS_RX_PACKET,
+  XB_METRICS_RX_AT,
+  XB_METRICS_MODEM_STATUS,
+  XB_METRICS_TRANSMIT_STATUS,
+  XB_METRICS_OTHER,
+  XB_METRICS_TYPES
+};
+
+// reasons of failed deliveries that are counted separately
+enum {
+  XB_FAIL_MAC_ACK,
+  XB_FAIL_CCA,
+  XB_FAIL_NETWORK_ACK,
+  XB_FAIL_NOT_JOINED,
+  XB_FAIL_ADDRESS_NOT_FOUND,
+  XB_FAIL_ROUTE_NOT_FOUND,
+  XB_FAIL_PAYLOAD_TOO_LARGE,
+  XB_FAIL_OTHER,
+  XB_FAIL_REASONS
+};
+
+// bucket i counts send-to-status latencies of i significant bits (in ms),
+// i.e. 0, 1, 2-3, 4-7,... the last bucket also holds everything beyond
+#define XB_METRICS_LATENCY_BUCKETS 12
+
 typedef struct {
-  uint16_t bytes;
-  uint16_t frames;
+  uint32_t frames;
+  uint32_t bytes;               // complete frames, including framing
+} xbee_counter_t;
+
+typedef struct {
+  uint32_t       bytes;         // all transmitted bytes
+  uint32_t       frames;        // all transmitted frames
+  xbee_counter_t tx[XB_METRICS_TYPES];
+  xbee_counter_t rx[XB_METRICS_TYPES];
+  uint32_t       checksum_errors;
+  uint32_t       unsupported;   // received frames of unknown types
+  uint32_t       unhandled;     // received packets without a handler
+  uint32_t       overflows;     // dropped: RX buffer full or frame too large
+  uint32_t       retries;       // retransmissions reported by TX statuses
+  uint32_t       failures[XB_FAIL_REASONS];
+  uint32_t       latency[XB_METRICS_LATENCY_BUCKETS];
 } xbee_metrics_t;
 
-xbee_metrics_t xbee_reset_counters(void);
-xbee_metrics_t xbee_get_counters(void);
+// the metrics are copied into storage of the caller, they're too large for
+// a temporary on the stack of a small part. reset accepts NULL.
+void xbee_get_counters(xbee_metrics_t *metrics);
+void xbee_reset_counters(xbee_metrics_t *metrics);
+
+// failed transmissions, for all reasons
+uint32_t xbee_get_failures(void);
 
 #endif
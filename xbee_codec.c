@@ -0,0 +1,415 @@
+// xbee_codec.c
+// author: Christophe VG <contact@christophe.vg>
+
+// encoding and decoding of XBee S2/ZB API frames to and from memory buffers
+// this is plain C, without any hardware dependencies, so it can be used on the
+// AVR (see xbee.c) as well as on a host (tests, gateways, simulators,...)
+
+#include <string.h>
+
+#include "xbee_codec.h"
+
+// forward declarations of "private" functions
+static void     _put_address(uint8_t *buffer, uint64_t address);
+static uint64_t _get_address(uint8_t *buffer);
+static void     _put_endpoint(uint8_t *buffer, const xbee_endpoint_t *endpoint);
+static void     _get_endpoint(uint8_t *buffer, xbee_endpoint_t *endpoint);
+static void     _data_endpoint(xbee_endpoint_t *endpoint);
+static uint16_t _put(uint8_t *buffer, uint16_t capacity, uint16_t index,
+                     uint8_t byte, bool escaped);
+
+// parser states
+enum { WAIT_START, LENGTH_MSB, LENGTH_LSB, DATA, CHECKSUM, SKIP };
+
+// addresses are big endian (MSB -> LSB)
+
+static void _put_address(uint8_t *buffer, uint64_t address) {
+  for(uint8_t i=0; i<8; i++) {
+    buffer[i] = address >> (56 - 8 * i);
+  }
+}
+
+static uint64_t _get_address(uint8_t *buffer) {
+  uint64_t address = 0;
+  for(uint8_t i=0; i<8; i++) {
+    address = (address << 8) | buffer[i];
+  }
+  return address;
+}
+
+// source and destination endpoint, cluster and profile, as in explicit frames
+
+static void _put_endpoint(uint8_t *buffer, const xbee_endpoint_t *endpoint) {
+  buffer[0] = endpoint->source;
+  buffer[1] = endpoint->destination;
+  buffer[2] = endpoint->cluster >> 8;
+  buffer[3] = endpoint->cluster;
+  buffer[4] = endpoint->profile >> 8;
+  buffer[5] = endpoint->profile;
+}
+
+static void _get_endpoint(uint8_t *buffer, xbee_endpoint_t *endpoint) {
+  endpoint->source      = buffer[0];
+  endpoint->destination = buffer[1];
+  endpoint->cluster     = ((uint16_t)buffer[2] << 8) | buffer[3];
+  endpoint->profile     = ((uint16_t)buffer[4] << 8) | buffer[5];
+}
+
+// plain packets implicitly go between the Digi data endpoints
+static void _data_endpoint(xbee_endpoint_t *endpoint) {
+  endpoint->source      = XB_DATA_ENDPOINT;
+  endpoint->destination = XB_DATA_ENDPOINT;
+  endpoint->cluster     = XB_DATA_CLUSTER;
+  endpoint->profile     = XB_DIGI_PROFILE;
+}
+
+// prepares the addressing part of a transmit request once, including its
+// contribution to the checksum
+void xbee_dest_init(xbee_dest_t *dest, uint64_t address, uint16_t nw_address,
+                    uint8_t radius, uint8_t options)
+{
+  dest->address = address;
+  dest->resolve = nw_address == XB_NW_ADDR_UNKNOWN && address != XB_BROADCAST;
+
+  _put_address(dest->header, address);
+  dest->header[8]  = nw_address >> 8;
+  dest->header[9]  = nw_address;
+  dest->header[10] = radius;
+  dest->header[11] = options;
+
+  dest->checksum = xbee_sum(dest->header, sizeof(dest->header));
+}
+
+uint8_t xbee_sum(const uint8_t *data, uint16_t size) {
+  uint8_t sum = 0;
+  for(uint16_t i=0; i<size; i++) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+// encoding
+
+uint8_t xbee_encode_tx(uint8_t *header, uint8_t id, const xbee_dest_t *dest) {
+  header[0] = XB_TX_PACKET;
+  header[1] = id;
+  memcpy(&header[2], dest->header, sizeof(dest->header));
+  return XB_TX_HEADER_SIZE;
+}
+
+// the endpoint fields are inserted between the nw address and the radius
+uint8_t xbee_encode_tx_explicit(uint8_t *header, uint8_t id,
+                                const xbee_dest_t *dest,
+                                const xbee_endpoint_t *endpoint)
+{
+  header[0] = XB_TX_EXPLICIT;
+  header[1] = id;
+  memcpy(&header[2], dest->header, 10);
+  _put_endpoint(&header[12], endpoint);
+  header[18] = dest->header[10];
+  header[19] = dest->header[11];
+  return XB_TX_EXPLICIT_HEADER_SIZE;
+}
+
+uint8_t xbee_encode_rx(uint8_t *header, const xbee_rx_t *rx) {
+  header[0] = XB_RX_PACKET;
+  _put_address(&header[1], rx->address);
+  header[9]  = rx->nw_address >> 8;
+  header[10] = rx->nw_address;
+  header[11] = rx->options;
+  return XB_RX_HEADER_SIZE;
+}
+
+uint8_t xbee_encode_rx_explicit(uint8_t *header, const xbee_rx_t *rx) {
+  header[0] = XB_RX_EXPLICIT;
+  _put_address(&header[1], rx->address);
+  header[9]  = rx->nw_address >> 8;
+  header[10] = rx->nw_address;
+  _put_endpoint(&header[11], &rx->endpoint);
+  header[17] = rx->options;
+  return XB_RX_EXPLICIT_HEADER_SIZE;
+}
+
+uint8_t xbee_encode_at(uint8_t *header, uint8_t id, uint8_t ch1, uint8_t ch2) {
+  header[0] = XB_TX_AT;
+  header[1] = id;
+  header[2] = ch1;
+  header[3] = ch2;
+  return XB_AT_HEADER_SIZE;
+}
+
+uint8_t xbee_encode_at_response(uint8_t *header, const xbee_at_t *at) {
+  header[0] = XB_RX_AT;
+  header[1] = at->id;
+  header[2] = at->command[0];
+  header[3] = at->command[1];
+  header[4] = at->status;
+  return XB_AT_RESPONSE_HEADER_SIZE;
+}
+
+uint8_t xbee_encode_modem_status(uint8_t *header, uint8_t status) {
+  header[0] = XB_MODEM_STATUS;
+  header[1] = status;
+  return XB_MODEM_STATUS_SIZE;
+}
+
+uint8_t xbee_encode_tx_status(uint8_t *header, const xbee_tx_status_t *status) {
+  header[0] = XB_TRANSMIT_STATUS;
+  header[1] = status->id;
+  header[2] = status->nw_address >> 8;
+  header[3] = status->nw_address;
+  header[4] = status->retries;
+  header[5] = status->delivery;
+  header[6] = status->discovery;
+  return XB_TX_STATUS_SIZE;
+}
+
+// adds one byte to an encoded frame, escaping it when needed
+// returns the next index, or 0 if it didn't fit
+static uint16_t _put(uint8_t *buffer, uint16_t capacity, uint16_t index,
+                     uint8_t byte, bool escaped)
+{
+  if( escaped && xbee_needs_escape(byte) ) {
+    if( index + 2 > capacity ) { return 0; }
+    buffer[index++] = XB_ESCAPE;
+    byte ^= XB_ESCAPE_XOR;
+  }
+  if( index + 1 > capacity ) { return 0; }
+  buffer[index++] = byte;
+  return index;
+}
+
+uint16_t xbee_encode(uint8_t *buffer, uint16_t capacity,
+                     const xbee_iov_t *data, uint8_t count, bool escaped)
+{
+  uint16_t length = 0;
+  for(uint8_t s=0; s<count; s++) {
+    length += data[s].size;
+  }
+  if( length + XB_FRAME_OVERHEAD > capacity ) { return 0; }
+
+  uint16_t index = 0;
+  uint8_t  sum   = 0;
+
+  buffer[index++] = XB_FRAME_START;   // never escaped
+
+  if( ! (index = _put(buffer, capacity, index, length >> 8, escaped)) ||
+      ! (index = _put(buffer, capacity, index, length,      escaped)) )
+  {
+    return 0;
+  }
+  for(uint8_t s=0; s<count; s++) {
+    for(uint16_t i=0; i<data[s].size; i++) {
+      sum += data[s].data[i];
+      index = _put(buffer, capacity, index, data[s].data[i], escaped);
+      if( ! index ) { return 0; }
+    }
+  }
+  return _put(buffer, capacity, index, 0xFF - sum, escaped);
+}
+
+// decoding
+
+void xbee_parser_init(xbee_parser_t *parser, uint8_t *buffer, uint16_t capacity,
+                      bool escaped)
+{
+  parser->state       = WAIT_START;
+  parser->escaped     = escaped;
+  parser->escape_next = FALSE;
+  parser->buffer      = buffer;
+  parser->capacity    = capacity;
+  parser->length      = 0;
+  parser->index       = 0;
+}
+
+xbee_parse_result_t xbee_parse(xbee_parser_t *parser, uint8_t byte) {
+  if( parser->escaped ) {
+    // in API mode 2 a start delimiter can't appear inside a frame
+    if( byte == XB_FRAME_START ) {
+      parser->escape_next = FALSE;
+      parser->state       = LENGTH_MSB;
+      return XB_PARSE_MORE;
+    }
+    if( byte == XB_ESCAPE ) {
+      parser->escape_next = TRUE;
+      return XB_PARSE_MORE;
+    }
+    if( parser->escape_next ) {
+      byte ^= XB_ESCAPE_XOR;
+      parser->escape_next = FALSE;
+    }
+  }
+
+  switch( parser->state ) {
+    case WAIT_START:
+      if( byte == XB_FRAME_START ) { parser->state = LENGTH_MSB; }
+      break;
+
+    case LENGTH_MSB:
+      parser->length = (uint16_t)byte << 8;
+      parser->state  = LENGTH_LSB;
+      break;
+
+    case LENGTH_LSB:
+      parser->length |= byte;
+      parser->index   = 0;
+      parser->sum     = 0;
+      if( parser->length == 0 ) {
+        parser->state = WAIT_START;
+      } else if( parser->length > parser->capacity ) {
+        parser->state = SKIP;            // skip frame data and checksum
+      } else {
+        parser->state = DATA;
+      }
+      break;
+
+    case DATA:
+      parser->buffer[parser->index++] = byte;
+      parser->sum += byte;
+      if( parser->index == parser->length ) { parser->state = CHECKSUM; }
+      break;
+
+    case CHECKSUM:
+      parser->state = WAIT_START;
+      // including the checksum byte, all bytes should add up to 0xFF
+      if( (uint8_t)(parser->sum + byte) != 0xFF ) {
+        return XB_PARSE_CHECKSUM_ERROR;
+      }
+      return XB_PARSE_FRAME;
+
+    case SKIP:
+      if( parser->index++ == parser->length ) {
+        parser->state = WAIT_START;
+        return XB_PARSE_OVERSIZE;
+      }
+      break;
+  }
+  return XB_PARSE_MORE;
+}
+
+xbee_parse_result_t xbee_scan(uint8_t *buffer, uint16_t size,
+                              xbee_frame_t *frame)
+{
+  uint16_t start = 0;
+
+  // skip to start of frame
+  while( start < size && buffer[start] != XB_FRAME_START ) { start++; }
+
+  frame->consumed = start;
+  if( size - start < XB_FRAME_OVERHEAD ) { return XB_PARSE_MORE; }
+
+  uint16_t length = ((uint16_t)buffer[start+1] << 8) | buffer[start+2];
+  if( size - start < length + XB_FRAME_OVERHEAD ) { return XB_PARSE_MORE; }
+
+  uint8_t *data = &buffer[start+3];
+  if( length == 0 ||
+      (uint8_t)(xbee_sum(data, length) + data[length]) != 0xFF )
+  {
+    // only consume the start delimiter, to resynchronize on the next one
+    frame->consumed = start + 1;
+    return XB_PARSE_CHECKSUM_ERROR;
+  }
+
+  frame->data     = data;
+  frame->length   = length;
+  frame->consumed = start + length + XB_FRAME_OVERHEAD;
+  return XB_PARSE_FRAME;
+}
+
+bool xbee_decode_tx(uint8_t *frame, uint16_t length, xbee_tx_t *tx) {
+  uint8_t size;
+
+  if( length < 1 ) { return FALSE; }
+  switch( frame[0] ) {
+    case XB_TX_PACKET   : size = XB_TX_HEADER_SIZE;          break;
+    case XB_TX_EXPLICIT : size = XB_TX_EXPLICIT_HEADER_SIZE; break;
+    default             : return FALSE;
+  }
+  if( length < size ) { return FALSE; }
+
+  tx->id         = frame[1];
+  tx->address    = _get_address(&frame[2]);
+  tx->nw_address = ((uint16_t)frame[10] << 8) | frame[11];
+  if( frame[0] == XB_TX_EXPLICIT ) {
+    _get_endpoint(&frame[12], &tx->endpoint);
+  } else {
+    _data_endpoint(&tx->endpoint);
+  }
+  tx->radius     = frame[size - 2];
+  tx->options    = frame[size - 1];
+  tx->data       = &frame[size];
+  tx->size       = length - size;
+  return TRUE;
+}
+
+bool xbee_decode_rx(uint8_t *frame, uint16_t length, xbee_rx_t *rx) {
+  uint8_t size;
+
+  if( length < 1 ) { return FALSE; }
+  switch( frame[0] ) {
+    case XB_RX_PACKET   : size = XB_RX_HEADER_SIZE;          break;
+    case XB_RX_EXPLICIT : size = XB_RX_EXPLICIT_HEADER_SIZE; break;
+    default             : return FALSE;
+  }
+  if( length < size ) { return FALSE; }
+
+  rx->address    = _get_address(&frame[1]);
+  rx->nw_address = ((uint16_t)frame[9] << 8) | frame[10];
+  if( frame[0] == XB_RX_EXPLICIT ) {
+    _get_endpoint(&frame[11], &rx->endpoint);
+  } else {
+    _data_endpoint(&rx->endpoint);
+  }
+  rx->options    = frame[size - 1];
+  rx->data       = &frame[size];
+  rx->size       = length - size;
+  return TRUE;
+}
+
+bool xbee_decode_at(uint8_t *frame, uint16_t length, xbee_at_t *at) {
+  if( length < XB_AT_HEADER_SIZE || frame[0] != XB_TX_AT ) { return FALSE; }
+  at->id         = frame[1];
+  at->command[0] = frame[2];
+  at->command[1] = frame[3];
+  at->status     = XB_AT_OK;
+  at->data       = &frame[XB_AT_HEADER_SIZE];
+  at->size       = length - XB_AT_HEADER_SIZE;
+  return TRUE;
+}
+
+bool xbee_decode_at_response(uint8_t *frame, uint16_t length, xbee_at_t *at) {
+  if( length < XB_AT_RESPONSE_HEADER_SIZE || frame[0] != XB_RX_AT ) {
+    return FALSE;
+  }
+  at->id         = frame[1];
+  at->command[0] = frame[2];
+  at->command[1] = frame[3];
+  at->status     = frame[4];
+  at->data       = &frame[XB_AT_RESPONSE_HEADER_SIZE];
+  at->size       = length - XB_AT_RESPONSE_HEADER_SIZE;
+  return TRUE;
+}
+
+bool xbee_decode_modem_status(uint8_t *frame, uint16_t length,
+                              uint8_t *status)
+{
+  if( length < XB_MODEM_STATUS_SIZE || frame[0] != XB_MODEM_STATUS ) {
+    return FALSE;
+  }
+  *status = frame[1];
+  return TRUE;
+}
+
+bool xbee_decode_tx_status(uint8_t *frame, uint16_t length,
+                           xbee_tx_status_t *status)
+{
+  if( length < XB_TX_STATUS_SIZE || frame[0] != XB_TRANSMIT_STATUS ) {
+    return FALSE;
+  }
+  status->id         = frame[1];
+  status->nw_address = ((uint16_t)frame[2] << 8) | frame[3];
+  status->retries    = frame[4];
+  status->delivery   = frame[5];
+  status->discovery  = frame[6];
+  return TRUE;
+}
@@ -0,0 +1,243 @@
+// xbee_codec.h
+// author: Christophe VG <contact@christophe.vg>
+
+// encoding and decoding of XBee S2/ZB API frames to and from memory buffers
+// this is plain C, without any hardware dependencies, so it can be used on the
+// AVR (see xbee.c) as well as on a host (tests, gateways, simulators,...)
+
+#ifndef __XBEE_CODEC_H
+#define __XBEE_CODEC_H
+
+#include <stdint.h>
+
+#include "bool.h"
+
+// magic bytes
+
+#define XB_FRAME_START      0x7E
+#define XB_ESCAPE           0x7D      // API mode 2 (AP=2) escaping
+#define XB_XON              0x11
+#define XB_XOFF             0x13
+#define XB_ESCAPE_XOR       0x20
+
+// frame types
+#define XB_TX_AT            0x08
+#define XB_TX_PACKET        0x10
+#define XB_TX_EXPLICIT      0x11      // explicit addressing command frame
+#define XB_RX_AT            0x88
+#define XB_MODEM_STATUS     0x8A
+#define XB_TRANSMIT_STATUS  0x8B
+#define XB_RX_PACKET        0x90
+#define XB_RX_EXPLICIT      0x91      // explicit RX indicator (AT AO=1)
+
+#define XB_COORDINATOR      0x0000000000000000
+#define XB_BROADCAST        0x000000000000FFFF
+#define XB_TX_NO_RESPONSE   0x00      // id to use when no response wanted
+#define XB_NW_BROADCAST     0xFFFE    // nw_address for broadcast
+#define XB_NW_ADDR_UNKNOWN  0xFFFE    //             or unknown
+#define XB_MAX_RADIUS       0x00
+#define XB_OPT_NO_ACK       0x01
+#define XB_OPT_NONE         0x00
+#define XB_OPT_APS_ENC      0x20
+#define XB_OPT_EXT_TIMEOUT  0x40
+
+// plain packets (0x10/0x90) are sent between the Digi data endpoints
+#define XB_DATA_ENDPOINT    0xE8
+#define XB_DATA_CLUSTER     0x0011
+#define XB_DIGI_PROFILE     0xC105
+
+// RX options
+#define XB_RX_OPT_ACK       0x01
+#define XB_RX_OPT_BROADCAST 0x02
+
+// maximum RF payload of a unicast without APS encryption (see AT NP)
+#define XB_MAX_PAYLOAD      84
+
+// AT command status
+#define XB_AT_OK            0x00
+#define XB_AT_ERROR         0x01
+#define XB_AT_INV_CMD       0x02
+#define XB_AT_INV_PARAM     0x03
+#define XB_AT_TX_FAIL       0x04
+
+// modem status
+#define XB_MODEM_HW_RESET       0x00
+#define XB_MODEM_WDT_RESET      0x01
+#define XB_MODEM_JOINED         0x02
+#define XB_MODEM_DISASSOCIATED  0x03
+#define XB_MODEM_COORD_STARTED  0x06
+
+// TX status delivery status
+#define XB_DELIVERY_OK                0x00
+#define XB_DELIVERY_MAC_ACK           0x01
+#define XB_DELIVERY_CCA               0x02
+#define XB_DELIVERY_NETWORK_ACK       0x21
+#define XB_DELIVERY_NOT_JOINED        0x22
+#define XB_DELIVERY_ADDRESS_NOT_FOUND 0x24
+#define XB_DELIVERY_ROUTE_NOT_FOUND   0x25
+#define XB_DELIVERY_PAYLOAD_TOO_LARGE 0x74
+
+// AT AI responses
+#define XB_AT_AI_SUCCESS    0x00
+#define XB_AT_AI_SCANNING   0xFF
+
+// sizes of the fixed parts of the frame data (frame type included)
+#define XB_TX_HEADER_SIZE         14
+#define XB_RX_HEADER_SIZE         12
+#define XB_TX_EXPLICIT_HEADER_SIZE 20
+#define XB_RX_EXPLICIT_HEADER_SIZE 18
+#define XB_AT_HEADER_SIZE          4
+#define XB_AT_RESPONSE_HEADER_SIZE 5
+#define XB_MODEM_STATUS_SIZE       2
+#define XB_TX_STATUS_SIZE          7
+
+// framing overhead: start delimiter, two length bytes and checksum
+#define XB_FRAME_OVERHEAD          4
+
+// bytes that must be escaped in API mode 2
+#define xbee_needs_escape(b) ( (b) == XB_FRAME_START || (b) == XB_ESCAPE || \
+                               (b) == XB_XON         || (b) == XB_XOFF )
+
+// endpoints, cluster and profile of explicitly addressed packets
+typedef struct {
+  uint8_t  source;
+  uint8_t  destination;
+  uint16_t cluster;
+  uint16_t profile;
+} xbee_endpoint_t;
+
+// TX struct
+typedef struct {
+  uint16_t        size;
+  uint8_t         id;
+  uint64_t        address;
+  uint16_t        nw_address;
+  uint8_t         radius;
+  uint8_t         options;
+  uint8_t        *data;
+  xbee_endpoint_t endpoint;   // decoding only, see xbee_encode_tx_explicit
+} xbee_tx_t;
+
+// RX struct
+typedef struct {
+  uint16_t        size;
+  uint64_t        address;
+  uint16_t        nw_address;
+  uint8_t         options;
+  uint8_t        *data;
+  xbee_endpoint_t endpoint;   // the Digi data endpoint for plain packets
+} xbee_rx_t;
+
+// AT command (status unused) or AT command response
+typedef struct {
+  uint8_t  id;
+  uint8_t  command[2];
+  uint8_t  status;
+  uint8_t *data;        // parameter or response value
+  uint16_t size;
+} xbee_at_t;
+
+// TX status
+typedef struct {
+  uint8_t  id;
+  uint16_t nw_address;
+  uint8_t  retries;
+  uint8_t  delivery;
+  uint8_t  discovery;
+} xbee_tx_status_t;
+
+// payload segment, for sending payloads that consist of several buffers
+typedef struct {
+  const uint8_t *data;
+  uint16_t       size;
+} xbee_iov_t;
+
+// prepared destination: the addressing part of a transmit request, with its
+// partial checksum, for destinations that are used repeatedly
+typedef struct {
+  uint64_t address;
+  bool     resolve;     // nw address is unknown, the sender may look it up
+  uint8_t  header[12];  // 64-bit address, 16-bit nw address, radius, options
+  uint8_t  checksum;
+} xbee_dest_t;
+
+void xbee_dest_init(xbee_dest_t *dest, uint64_t address, uint16_t nw_address,
+                    uint8_t radius, uint8_t options);
+
+// checksumming
+
+// sum of bytes, as used to compute and verify checksums
+uint8_t xbee_sum(const uint8_t *data, uint16_t size);
+
+// encoding
+
+// frame data headers, written to header, return the number of bytes written
+uint8_t xbee_encode_tx(uint8_t *header, uint8_t id, const xbee_dest_t *dest);
+uint8_t xbee_encode_tx_explicit(uint8_t *header, uint8_t id,
+                                const xbee_dest_t *dest,
+                                const xbee_endpoint_t *endpoint);
+uint8_t xbee_encode_rx(uint8_t *header, const xbee_rx_t *rx);
+uint8_t xbee_encode_rx_explicit(uint8_t *header, const xbee_rx_t *rx);
+uint8_t xbee_encode_at(uint8_t *header, uint8_t id, uint8_t ch1, uint8_t ch2);
+uint8_t xbee_encode_at_response(uint8_t *header, const xbee_at_t *at);
+uint8_t xbee_encode_modem_status(uint8_t *header, uint8_t status);
+uint8_t xbee_encode_tx_status(uint8_t *header, const xbee_tx_status_t *status);
+
+// encodes a complete frame, with the concatenation of count segments as frame
+// data, into buffer. returns the size of the frame, or 0 if it doesn't fit
+uint16_t xbee_encode(uint8_t *buffer, uint16_t capacity,
+                     const xbee_iov_t *data, uint8_t count, bool escaped);
+
+// decoding
+
+// results of parsing and scanning
+typedef enum {
+  XB_PARSE_MORE,              // no complete frame yet
+  XB_PARSE_FRAME,             // a complete and valid frame is available
+  XB_PARSE_CHECKSUM_ERROR,
+  XB_PARSE_OVERSIZE           // frame didn't fit the buffer and was skipped
+} xbee_parse_result_t;
+
+// streaming parser, fed one byte at a time, collects frame data into buffer
+typedef struct {
+  uint8_t  state;
+  bool     escaped;           // API mode 2
+  bool     escape_next;
+  uint8_t  sum;
+  uint16_t length;
+  uint16_t index;
+  uint8_t *buffer;
+  uint16_t capacity;
+} xbee_parser_t;
+
+void xbee_parser_init(xbee_parser_t *parser, uint8_t *buffer, uint16_t capacity,
+                      bool escaped);
+
+// after XB_PARSE_FRAME, the frame data is in parser->buffer, its size is
+// parser->length. it remains valid until the next byte is parsed.
+xbee_parse_result_t xbee_parse(xbee_parser_t *parser, uint8_t byte);
+
+// a frame found in place, in a buffer with unescaped frames
+typedef struct {
+  uint8_t  *data;             // frame data, pointing into the scanned buffer
+  uint16_t  length;
+  uint16_t  consumed;         // bytes of the buffer that have been dealt with
+} xbee_frame_t;
+
+// scans size bytes of buffer for the next frame, without copying it
+xbee_parse_result_t xbee_scan(uint8_t *buffer, uint16_t size,
+                              xbee_frame_t *frame);
+
+// frame data decoders, return FALSE if the frame isn't of the expected type or
+// is too short. data pointers in the results point into the frame.
+// TX and RX decoders accept plain as well as explicitly addressed frames.
+bool xbee_decode_tx(uint8_t *frame, uint16_t length, xbee_tx_t *tx);
+bool xbee_decode_rx(uint8_t *frame, uint16_t length, xbee_rx_t *rx);
+bool xbee_decode_at(uint8_t *frame, uint16_t length, xbee_at_t *at);
+bool xbee_decode_at_response(uint8_t *frame, uint16_t length, xbee_at_t *at);
+bool xbee_decode_modem_status(uint8_t *frame, uint16_t length,
+                              uint8_t *status);
+bool xbee_decode_tx_status(uint8_t *frame, uint16_t length,
+                           xbee_tx_status_t *status);
+
+#endif